@@ -0,0 +1,91 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_endpoint.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <QDebug>
+#include <QFile>
+
+#include "engine/dbus_epoll_engine.h"
+#include "engine/dbus_local_engine.h"
+#include "engine/dbus_uring_engine.h"
+
+bool DbusEndpoint::takeDescriptors(int count, QVector<int> *fds)
+{
+    fds->clear();
+    return count == 0;
+}
+
+qint64 DbusEndpoint::writeWithDescriptors(const QByteArray &data, const QVector<int> &fds)
+{
+    // 不支持传递文件描述符的连接只发送数据
+    if (!fds.isEmpty()) {
+        qWarning() << this << "can not pass file descriptors, drop:" << fds.size();
+    }
+    for (int fd : fds) {
+        ::close(fd);
+    }
+    return write(data);
+}
+
+/*
+ * 填充Unix socket地址
+ *
+ * @param path: socket地址
+ * @param addr: 地址结构
+ *
+ * @return bool: true:成功 false:地址为空或过长
+ */
+bool fillSocketAddress(const QString &path, struct sockaddr_un *addr)
+{
+    QByteArray encoded = QFile::encodeName(path);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (encoded.isEmpty() || encoded.size() >= static_cast<int>(sizeof(addr->sun_path))) {
+        return false;
+    }
+    memcpy(addr->sun_path, encoded.constData(), encoded.size());
+    return true;
+}
+
+/*
+ * 创建指定名称的I/O引擎，不支持或初始化失败时使用基于QLocalSocket的引擎
+ *
+ * @param name: 引擎名称 qt epoll io_uring
+ *
+ * @return DbusEngine: I/O引擎
+ */
+DbusEngine *DbusEngine::create(const QString &name)
+{
+    if (name == "io_uring") {
+#ifdef HAVE_IO_URING
+        DbusUringEngine *engine = new DbusUringEngine();
+        if (engine->init()) {
+            return engine;
+        }
+        delete engine;
+        qWarning() << "init io_uring engine failed, fallback to epoll engine";
+#else
+        qWarning() << "io_uring engine not supported, fallback to epoll engine";
+#endif
+    }
+    if (name == "epoll" || name == "io_uring") {
+        DbusEpollEngine *engine = new DbusEpollEngine();
+        if (engine->init()) {
+            return engine;
+        }
+        delete engine;
+        qWarning() << "init epoll engine failed, fallback to qt engine";
+    } else if (!name.isEmpty() && name != "qt") {
+        qWarning() << "unknown engine:" << name << ", fallback to qt engine";
+    }
+    return new DbusLocalEngine();
+}
@@ -0,0 +1,236 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_ENGINE_DBUS_ENDPOINT_H
+#define LINGLONG_DBUS_PROXY_SRC_ENGINE_DBUS_ENDPOINT_H
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+/*
+ * 代理两端的socket连接
+ *
+ * 屏蔽不同I/O引擎的差异，DbusProxy只通过该接口读写数据，
+ * 信号与QLocalSocket的同名信号含义一致
+ */
+class DbusEndpoint : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DbusEndpoint(QObject *parent = nullptr)
+        : QObject(parent)
+        , userContext(nullptr)
+    {
+    }
+    virtual ~DbusEndpoint() {}
+
+    /*
+     * 连接指定地址的socket，连接成功后发送connected信号，失败时发送connectFailed信号
+     *
+     * @param path: socket地址
+     */
+    virtual void connectToServer(const QString &path) = 0;
+
+    /*
+     * 等待连接完成
+     *
+     * @param msecs: 超时时间，单位毫秒
+     *
+     * @return bool: true:已连接 false:连接失败或超时
+     */
+    virtual bool waitForConnected(int msecs) = 0;
+
+    virtual bool isConnected() const = 0;
+
+    /*
+     * 非阻塞读取数据
+     *
+     * @param data: 读缓存
+     * @param maxSize: 读缓存大小
+     *
+     * @return qint64: 读取的字节数，无数据时为0，连接关闭或出错时为-1
+     */
+    virtual qint64 read(char *data, qint64 maxSize) = 0;
+
+    /*
+     * 非阻塞写入数据，未能立即发送的数据保存在写缓存中由事件循环发送
+     *
+     * @param data: 待写数据
+     *
+     * @return qint64: 写入的字节数，出错时为-1
+     */
+    virtual qint64 write(const QByteArray &data) = 0;
+
+    /*
+     * 写缓存中待发送的字节数
+     */
+    virtual qint64 bytesToWrite() const = 0;
+
+    virtual int socketDescriptor() const = 0;
+
+    /*
+     * 发送完写缓存中的数据后断开连接，断开后发送disconnected信号
+     */
+    virtual void disconnectFromServer() = 0;
+
+    virtual QString errorString() const = 0;
+
+    /*
+     * 写缓存为空时调用方是否可以直接向socketDescriptor写入数据
+     *
+     * @return bool: true:可以 false:只能通过write写入
+     */
+    virtual bool canWriteDirectly() const { return true; }
+
+    /*
+     * 调用方是否可以绕过read直接从socketDescriptor读取数据，连接自身没有读缓存时才可以
+     *
+     * @return bool: true:可以 false:只能通过read读取
+     */
+    virtual bool canReadDirectly() const { return false; }
+
+    /*
+     * 连接能否通过SCM_RIGHTS收发文件描述符
+     *
+     * @return bool: true:能 false:附带的文件描述符会丢失
+     */
+    virtual bool canPassDescriptors() const { return false; }
+
+    /*
+     * 随数据收到、还未取出的文件描述符数
+     */
+    virtual int pendingDescriptors() const { return 0; }
+
+    /*
+     * 按接收顺序取出随数据收到的文件描述符，由调用方负责关闭
+     *
+     * @param count: 需要的个数
+     * @param fds: 取出的文件描述符
+     *
+     * @return bool: true:成功 false:已收到的不足count个，不取出
+     */
+    virtual bool takeDescriptors(int count, QVector<int> *fds);
+
+    /*
+     * 写入一条消息，文件描述符随消息的第一个字节发送，发送后或出错时由连接关闭
+     *
+     * @param data: 一条完整的消息
+     * @param fds: 随消息发送的文件描述符
+     *
+     * @return qint64: 写入的字节数，出错时为-1
+     */
+    virtual qint64 writeWithDescriptors(const QByteArray &data, const QVector<int> &fds);
+
+    /*
+     * 关联使用该连接的上层对象，事件回调中直接取得，不需要查表
+     *
+     * @param context: 上层对象，由使用方管理
+     */
+    void setContext(void *context) { userContext = context; }
+    void *context() const { return userContext; }
+
+signals:
+    void connected();
+    void connectFailed();
+    void disconnected();
+    void readyRead();
+    void bytesWritten(qint64 bytes);
+
+private:
+    void *userContext;
+};
+
+struct sockaddr_un;
+
+/*
+ * 填充Unix socket地址
+ *
+ * @param path: socket地址
+ * @param addr: 地址结构
+ *
+ * @return bool: true:成功 false:地址为空或过长
+ */
+bool fillSocketAddress(const QString &path, struct sockaddr_un *addr);
+
+/*
+ * 监听客户端连接的socket
+ */
+class DbusListener : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DbusListener(QObject *parent = nullptr)
+        : QObject(parent)
+    {
+    }
+    virtual ~DbusListener() {}
+
+    /*
+     * 删除已存在的socket文件后开始监听，socket文件只允许当前用户访问
+     *
+     * @param path: socket监听地址
+     *
+     * @return bool: true:成功 false:失败
+     */
+    virtual bool listen(const QString &path) = 0;
+
+    virtual void close() = 0;
+
+    /*
+     * 获取下一个已接受的客户端连接，连接归监听socket所有
+     *
+     * @return DbusEndpoint: 客户端连接，没有时为空
+     */
+    virtual DbusEndpoint *nextPendingConnection() = 0;
+
+    /*
+     * 获取下一个已接受的客户端socket，用于交给其它线程的引擎接管
+     *
+     * @return int: 客户端socket，归调用方所有，没有时为-1
+     */
+    virtual int nextPendingDescriptor() = 0;
+
+    virtual QString errorString() const = 0;
+
+signals:
+    void newConnection();
+};
+
+/*
+ * I/O引擎，创建监听socket及连接dbus-daemon的socket
+ */
+class DbusEngine
+{
+public:
+    virtual ~DbusEngine() {}
+
+    virtual QString name() const = 0;
+    virtual DbusListener *createListener() = 0;
+    virtual DbusEndpoint *createEndpoint() = 0;
+
+    /*
+     * 接管已连接的socket，socket可以由其它线程的监听socket接受
+     *
+     * @param fd: 已连接的socket，失败时由引擎关闭
+     *
+     * @return DbusEndpoint: 连接，归调用方所有，失败时isConnected为false
+     */
+    virtual DbusEndpoint *adoptEndpoint(int fd) = 0;
+
+    /*
+     * 创建指定名称的I/O引擎，不支持或初始化失败时使用基于QLocalSocket的引擎
+     *
+     * @param name: 引擎名称 qt epoll io_uring
+     *
+     * @return DbusEngine: I/O引擎
+     */
+    static DbusEngine *create(const QString &name);
+};
+#endif
@@ -0,0 +1,615 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_epoll_engine.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <QDebug>
+#include <QFile>
+
+// 一次epoll_wait最多取出的事件数
+static const int kMaxEvents = 64;
+
+// 连接关注的事件
+static const quint32 kEndpointEvents = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+// 一次sendmsg/recvmsg最多传递的文件描述符数，与内核SCM_MAX_FD一致
+static const int kMaxDescriptors = 253;
+
+// SCM_RIGHTS控制消息缓存
+union DescriptorControl {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int) * kMaxDescriptors)];
+};
+
+/*
+ * 关闭文件描述符
+ *
+ * @param fds: 文件描述符
+ */
+static void closeAll(const QVector<int> &fds)
+{
+    for (int fd : fds) {
+        ::close(fd);
+    }
+}
+
+DbusEpollEndpoint::DbusEpollEndpoint(DbusEpollEngine *engine, int fd, QObject *parent)
+    : DbusEndpoint(parent)
+    , engine(engine)
+    , fd(fd)
+    , state(fd >= 0 ? State::Connected : State::Unconnected)
+    , isPeerClosed(false)
+    , writeOffset(0)
+{
+    if (fd >= 0 && !engine->add(fd, kEndpointEvents, this)) {
+        setError("epoll_ctl");
+        ::close(fd);
+        this->fd = -1;
+        state = State::Unconnected;
+    }
+}
+
+DbusEpollEndpoint::~DbusEpollEndpoint()
+{
+    if (fd >= 0) {
+        engine->remove(fd);
+        ::close(fd);
+    }
+    closeDescriptors();
+}
+
+void DbusEpollEndpoint::setError(const char *what)
+{
+    error = QString("%1: %2").arg(what).arg(strerror(errno));
+}
+
+void DbusEpollEndpoint::connectToServer(const QString &path)
+{
+    if (state != State::Unconnected) {
+        return;
+    }
+    struct sockaddr_un addr;
+    if (!fillSocketAddress(path, &addr)) {
+        error = "invalid socket path: " + path;
+        emit connectFailed();
+        return;
+    }
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        setError("socket");
+        emit connectFailed();
+        return;
+    }
+    int ret;
+    do {
+        ret = ::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    } while (ret < 0 && errno == EINTR);
+    // 监听队列满时连接未完成，等待socket可写
+    if (ret < 0 && errno != EAGAIN && errno != EINPROGRESS) {
+        setError("connect");
+        ::close(fd);
+        fd = -1;
+        emit connectFailed();
+        return;
+    }
+    if (!engine->add(fd, kEndpointEvents, this)) {
+        setError("epoll_ctl");
+        ::close(fd);
+        fd = -1;
+        emit connectFailed();
+        return;
+    }
+    state = State::Connecting;
+    if (ret == 0) {
+        finishConnect();
+    }
+}
+
+void DbusEpollEndpoint::finishConnect()
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        err = errno;
+    }
+    if (err != 0) {
+        errno = err;
+        setError("connect");
+        engine->remove(fd);
+        ::close(fd);
+        fd = -1;
+        state = State::Unconnected;
+        emit connectFailed();
+        return;
+    }
+    state = State::Connected;
+    emit connected();
+}
+
+bool DbusEpollEndpoint::waitForConnected(int msecs)
+{
+    if (state == State::Connecting) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        int ret;
+        do {
+            ret = ::poll(&pfd, 1, msecs);
+        } while (ret < 0 && errno == EINTR);
+        if (ret > 0) {
+            finishConnect();
+        } else if (ret == 0) {
+            error = "connect timeout";
+        }
+    }
+    return state == State::Connected;
+}
+
+qint64 DbusEpollEndpoint::read(char *data, qint64 maxSize)
+{
+    if (state != State::Connected && state != State::Closing) {
+        return -1;
+    }
+    // 使用recvmsg，对端随数据发送的文件描述符保存到receivedDescriptors中
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = maxSize;
+    DescriptorControl control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t ret;
+    do {
+        ret = ::recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    } while (ret < 0 && errno == EINTR);
+    if (ret > 0) {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int *fds = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+            for (int i = 0; i < count; i++) {
+                receivedDescriptors.append(fds[i]);
+            }
+        }
+        if (!(msg.msg_flags & MSG_CTRUNC)) {
+            return ret;
+        }
+    }
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    // 文件描述符被截断后无法确定之后的消息对应哪些描述符，与对端关闭一样丢弃数据并关闭连接
+    if (ret > 0) {
+        qWarning() << this << "file descriptors truncated, disconnect";
+        error = "file descriptors truncated";
+        for (int received : receivedDescriptors) {
+            ::close(received);
+        }
+        receivedDescriptors.clear();
+    } else if (ret < 0) {
+        // 对端关闭或出错，在事件处理结束后关闭连接
+        setError("recv");
+    }
+    if (!isPeerClosed) {
+        isPeerClosed = true;
+        // 暂停读取后恢复时才读到对端关闭，不会再有epoll事件
+        QMetaObject::invokeMethod(this, "onAbort", Qt::QueuedConnection);
+    }
+    return -1;
+}
+
+qint64 DbusEpollEndpoint::write(const QByteArray &data)
+{
+    if (state != State::Connected) {
+        return -1;
+    }
+    qint64 written = 0;
+    // 写缓存为空时直接发送，不能立即发送的部分追加到写缓存
+    if (bytesToWrite() == 0) {
+        ssize_t ret;
+        do {
+            ret = ::send(fd, data.constData(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            setError("send");
+            // 不在调用方的处理流程中发送disconnected信号
+            QMetaObject::invokeMethod(this, "onAbort", Qt::QueuedConnection);
+            return -1;
+        }
+        written = qMax<ssize_t>(ret, 0);
+        if (written == data.size()) {
+            return written;
+        }
+        writeBuffer.clear();
+        writeOffset = 0;
+    }
+    writeBuffer.append(data.constData() + written, data.size() - written);
+    return data.size();
+}
+
+bool DbusEpollEndpoint::takeDescriptors(int count, QVector<int> *fds)
+{
+    fds->clear();
+    if (count > receivedDescriptors.size()) {
+        return false;
+    }
+    fds->reserve(count);
+    for (int i = 0; i < count; i++) {
+        fds->append(receivedDescriptors.takeFirst());
+    }
+    return true;
+}
+
+qint64 DbusEpollEndpoint::writeWithDescriptors(const QByteArray &data, const QVector<int> &fds)
+{
+    if (fds.isEmpty()) {
+        return write(data);
+    }
+    if (state != State::Connected || fds.size() > kMaxDescriptors) {
+        closeAll(fds);
+        return -1;
+    }
+    qint64 written = 0;
+    if (bytesToWrite() == 0) {
+        qint64 ret = sendData(data.constData(), data.size(), fds);
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            setError("sendmsg");
+            closeAll(fds);
+            QMetaObject::invokeMethod(this, "onAbort", Qt::QueuedConnection);
+            return -1;
+        }
+        written = qMax<qint64>(ret, 0);
+        // 内核已持有文件描述符的引用
+        if (written > 0) {
+            closeAll(fds);
+        }
+        if (written == data.size()) {
+            return written;
+        }
+        writeBuffer.clear();
+        writeOffset = 0;
+    }
+    // 文件描述符未发送时随剩余数据的第一个字节发送，已发送时剩余数据按普通数据发送
+    if (written == 0) {
+        DescriptorMessage message;
+        message.offset = writeBuffer.size();
+        message.fds = fds;
+        descriptorMessages.append(message);
+    }
+    writeBuffer.append(data.constData() + written, data.size() - written);
+    return data.size();
+}
+
+qint64 DbusEpollEndpoint::sendData(const char *data, qint64 size, const QVector<int> &fds)
+{
+    struct iovec iov;
+    iov.iov_base = const_cast<char *>(data);
+    iov.iov_len = size;
+    DescriptorControl control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (!fds.isEmpty()) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.constData(), sizeof(int) * fds.size());
+    }
+    ssize_t ret;
+    do {
+        ret = ::sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+void DbusEpollEndpoint::closeDescriptors()
+{
+    for (int received : receivedDescriptors) {
+        ::close(received);
+    }
+    receivedDescriptors.clear();
+    for (const DescriptorMessage &message : descriptorMessages) {
+        closeAll(message.fds);
+    }
+    descriptorMessages.clear();
+}
+
+bool DbusEpollEndpoint::flush()
+{
+    qint64 flushed = 0;
+    while (bytesToWrite() > 0) {
+        // 附带文件描述符的消息单独发送，文件描述符不能随之前消息的数据到达对端
+        qint64 size = bytesToWrite();
+        QVector<int> fds;
+        if (!descriptorMessages.isEmpty()) {
+            if (descriptorMessages.first().offset == writeOffset) {
+                fds = descriptorMessages.first().fds;
+                if (descriptorMessages.size() > 1) {
+                    size = descriptorMessages.at(1).offset - writeOffset;
+                }
+            } else {
+                size = descriptorMessages.first().offset - writeOffset;
+            }
+        }
+        qint64 ret = sendData(writeBuffer.constData() + writeOffset, size, fds);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (ret < 0) {
+            setError("send");
+            return false;
+        }
+        if (!fds.isEmpty()) {
+            closeAll(fds);
+            descriptorMessages.removeFirst();
+        }
+        writeOffset += ret;
+        flushed += ret;
+    }
+    if (bytesToWrite() == 0) {
+        writeBuffer.clear();
+        writeOffset = 0;
+    } else if (writeOffset > writeBuffer.size() / 2) {
+        writeBuffer.remove(0, writeOffset);
+        for (DescriptorMessage &message : descriptorMessages) {
+            message.offset -= writeOffset;
+        }
+        writeOffset = 0;
+    }
+    if (flushed > 0) {
+        emit bytesWritten(flushed);
+    }
+    return true;
+}
+
+void DbusEpollEndpoint::disconnectFromServer()
+{
+    if (state == State::Unconnected || state == State::Closing) {
+        return;
+    }
+    // 写缓存中的数据发送完后再关闭
+    if (state == State::Connected && bytesToWrite() > 0) {
+        state = State::Closing;
+        return;
+    }
+    closeSocket();
+}
+
+void DbusEpollEndpoint::closeSocket()
+{
+    if (fd < 0) {
+        return;
+    }
+    bool wasConnected = state == State::Connected || state == State::Closing;
+    engine->remove(fd);
+    ::close(fd);
+    fd = -1;
+    state = State::Unconnected;
+    writeBuffer.clear();
+    writeOffset = 0;
+    closeDescriptors();
+    if (wasConnected) {
+        emit disconnected();
+    }
+}
+
+void DbusEpollEndpoint::onAbort()
+{
+    closeSocket();
+}
+
+void DbusEpollEndpoint::handleEvents(quint32 events)
+{
+    // 同一批事件中之前的事件已关闭连接
+    if (state == State::Unconnected) {
+        return;
+    }
+    if (state == State::Connecting) {
+        if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            finishConnect();
+        }
+        return;
+    }
+    if ((events & (EPOLLOUT | EPOLLERR)) && !flush()) {
+        closeSocket();
+        return;
+    }
+    if (state == State::Closing && bytesToWrite() == 0) {
+        closeSocket();
+        return;
+    }
+    // 边沿触发，由DbusProxy一次读完所有数据
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        emit readyRead();
+    }
+    if (state != State::Unconnected && (isPeerClosed || (events & (EPOLLHUP | EPOLLERR)))) {
+        closeSocket();
+    }
+}
+
+DbusEpollListener::DbusEpollListener(DbusEpollEngine *engine, QObject *parent)
+    : DbusListener(parent)
+    , engine(engine)
+    , fd(-1)
+{
+}
+
+DbusEpollListener::~DbusEpollListener()
+{
+    close();
+    for (int clientFd : pendingDescriptors) {
+        ::close(clientFd);
+    }
+}
+
+bool DbusEpollListener::listen(const QString &path)
+{
+    struct sockaddr_un addr;
+    if (fd >= 0 || !fillSocketAddress(path, &addr)) {
+        error = "invalid socket path: " + path;
+        return false;
+    }
+    ::unlink(addr.sun_path);
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = QString("socket: %1").arg(strerror(errno));
+        return false;
+    }
+    if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0
+        || ::chmod(addr.sun_path, S_IRWXU) < 0 || ::listen(fd, SOMAXCONN) < 0
+        || !engine->add(fd, EPOLLIN | EPOLLET, this)) {
+        error = QString("listen: %1").arg(strerror(errno));
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    socketPath = path;
+    return true;
+}
+
+void DbusEpollListener::close()
+{
+    if (fd < 0) {
+        return;
+    }
+    engine->remove(fd);
+    ::close(fd);
+    fd = -1;
+    QFile::remove(socketPath);
+}
+
+DbusEndpoint *DbusEpollListener::nextPendingConnection()
+{
+    int clientFd = nextPendingDescriptor();
+    if (clientFd < 0) {
+        return nullptr;
+    }
+    DbusEpollEndpoint *endpoint = new DbusEpollEndpoint(engine, clientFd, this);
+    if (!endpoint->isConnected()) {
+        qWarning() << "register client failed:" << endpoint->errorString();
+        delete endpoint;
+        return nullptr;
+    }
+    return endpoint;
+}
+
+int DbusEpollListener::nextPendingDescriptor()
+{
+    if (pendingDescriptors.isEmpty()) {
+        return -1;
+    }
+    return pendingDescriptors.takeFirst();
+}
+
+void DbusEpollListener::handleEvents(quint32 events)
+{
+    Q_UNUSED(events);
+    // 边沿触发，一次接受所有待处理连接
+    while (fd >= 0) {
+        int clientFd = ::accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientFd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                qWarning() << "accept4 failed:" << strerror(errno);
+            }
+            break;
+        }
+        pendingDescriptors.append(clientFd);
+        emit newConnection();
+    }
+}
+
+DbusEpollEngine::DbusEpollEngine()
+    : epollFd(-1)
+{
+}
+
+DbusEpollEngine::~DbusEpollEngine()
+{
+    if (epollFd >= 0) {
+        ::close(epollFd);
+    }
+}
+
+/*
+ * 创建epoll fd
+ *
+ * @return bool: true:成功 false:失败
+ */
+bool DbusEpollEngine::init()
+{
+    epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        qWarning() << "epoll_create1 failed:" << strerror(errno);
+        return false;
+    }
+    notifier.reset(new QSocketNotifier(epollFd, QSocketNotifier::Read));
+    connect(notifier.get(), SIGNAL(activated(int)), this, SLOT(processEvents()));
+    return true;
+}
+
+/*
+ * 以边沿触发方式注册socket
+ *
+ * @param fd: socket
+ * @param events: 关注的epoll事件
+ * @param handler: 事件处理对象
+ *
+ * @return bool: true:成功 false:失败
+ */
+bool DbusEpollEngine::add(int fd, quint32 events, DbusEpollHandler *handler)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = handler;
+    return ::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+/*
+ * 取消注册socket
+ *
+ * @param fd: socket
+ */
+void DbusEpollEngine::remove(int fd)
+{
+    ::epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+/*
+ * 取出所有就绪事件并分发
+ */
+void DbusEpollEngine::processEvents()
+{
+    struct epoll_event events[kMaxEvents];
+    int count;
+    do {
+        count = ::epoll_wait(epollFd, events, kMaxEvents, 0);
+        for (int i = 0; i < count; i++) {
+            static_cast<DbusEpollHandler *>(events[i].data.ptr)->handleEvents(events[i].events);
+        }
+    } while (count == kMaxEvents);
+}
@@ -0,0 +1,213 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_ENGINE_DBUS_EPOLL_ENGINE_H
+#define LINGLONG_DBUS_PROXY_SRC_ENGINE_DBUS_EPOLL_ENGINE_H
+
+#include <QList>
+#include <QObject>
+#include <QScopedPointer>
+#include <QSocketNotifier>
+
+#include "engine/dbus_endpoint.h"
+
+class DbusEpollEngine;
+
+// epoll事件处理接口，注册时保存在epoll_event.data.ptr中
+class DbusEpollHandler
+{
+public:
+    virtual ~DbusEpollHandler() {}
+
+    /*
+     * 处理epoll事件
+     *
+     * @param events: epoll事件
+     */
+    virtual void handleEvents(quint32 events) = 0;
+};
+
+// 基于非阻塞Unix socket的连接，读写直接通过系统调用完成
+class DbusEpollEndpoint : public DbusEndpoint, public DbusEpollHandler
+{
+    Q_OBJECT
+
+public:
+    /*
+     * @param engine: 所属的epoll引擎
+     * @param fd: 已连接的socket，为-1时需要调用connectToServer
+     * @param parent: 父对象
+     */
+    DbusEpollEndpoint(DbusEpollEngine *engine, int fd = -1, QObject *parent = nullptr);
+    ~DbusEpollEndpoint() override;
+
+    void connectToServer(const QString &path) override;
+    bool waitForConnected(int msecs) override;
+    bool isConnected() const override { return state == State::Connected; }
+    qint64 read(char *data, qint64 maxSize) override;
+    qint64 write(const QByteArray &data) override;
+    qint64 bytesToWrite() const override { return writeBuffer.size() - writeOffset; }
+    int socketDescriptor() const override { return fd; }
+    void disconnectFromServer() override;
+    QString errorString() const override { return error; }
+    bool canReadDirectly() const override { return state == State::Connected; }
+    bool canPassDescriptors() const override { return true; }
+    int pendingDescriptors() const override { return receivedDescriptors.size(); }
+    bool takeDescriptors(int count, QVector<int> *fds) override;
+    qint64 writeWithDescriptors(const QByteArray &data, const QVector<int> &fds) override;
+
+    void handleEvents(quint32 events) override;
+
+private slots:
+    // 写入出错后在事件循环中关闭连接
+    void onAbort();
+
+private:
+    enum class State { Unconnected, Connecting, Connected, Closing };
+
+    // 写缓存中附带文件描述符的消息
+    struct DescriptorMessage {
+        // 消息在写缓存中的偏移
+        int offset;
+        QVector<int> fds;
+    };
+
+    /*
+     * 连接完成或失败
+     */
+    void finishConnect();
+
+    /*
+     * 发送写缓存中的数据
+     *
+     * @return bool: true:成功 false:出错
+     */
+    bool flush();
+
+    /*
+     * 关闭socket并发送disconnected信号
+     */
+    void closeSocket();
+
+    /*
+     * 发送数据，文件描述符不为空时随数据的第一个字节发送
+     *
+     * @param data: 数据地址
+     * @param size: 数据长度
+     * @param fds: 文件描述符
+     *
+     * @return qint64: 发送的字节数，出错时为-1并设置errno
+     */
+    qint64 sendData(const char *data, qint64 size, const QVector<int> &fds);
+
+    /*
+     * 关闭已收到未取出及待发送的文件描述符
+     */
+    void closeDescriptors();
+
+    /*
+     * 记录系统调用错误
+     *
+     * @param what: 出错的操作
+     */
+    void setError(const char *what);
+
+    DbusEpollEngine *engine;
+    int fd;
+    State state;
+    // 对端已关闭
+    bool isPeerClosed;
+    QByteArray writeBuffer;
+    // 写缓存中已发送的字节数
+    int writeOffset;
+    // 写缓存中附带文件描述符的消息，按偏移排列，发送时不与之前的数据合并
+    QList<DescriptorMessage> descriptorMessages;
+    // 已收到未取出的文件描述符
+    QList<int> receivedDescriptors;
+    QString error;
+};
+
+// 基于accept4的监听socket，边沿触发时一次接受所有待处理连接
+class DbusEpollListener : public DbusListener, public DbusEpollHandler
+{
+    Q_OBJECT
+
+public:
+    explicit DbusEpollListener(DbusEpollEngine *engine, QObject *parent = nullptr);
+    ~DbusEpollListener() override;
+
+    bool listen(const QString &path) override;
+    void close() override;
+    DbusEndpoint *nextPendingConnection() override;
+    int nextPendingDescriptor() override;
+    QString errorString() const override { return error; }
+
+    void handleEvents(quint32 events) override;
+
+private:
+    DbusEpollEngine *engine;
+    int fd;
+    QString socketPath;
+    // 已接受未取出的客户端socket
+    QList<int> pendingDescriptors;
+    QString error;
+};
+
+/*
+ * 基于epoll边沿触发的I/O引擎
+ *
+ * epoll fd通过QSocketNotifier接入Qt事件循环，权限申请等Qt异步调用可以继续使用，
+ * epoll fd可读时一次取出所有就绪事件直接分发给对应的连接
+ */
+class DbusEpollEngine : public QObject, public DbusEngine
+{
+    Q_OBJECT
+
+public:
+    DbusEpollEngine();
+    ~DbusEpollEngine() override;
+
+    /*
+     * 创建epoll fd
+     *
+     * @return bool: true:成功 false:失败
+     */
+    bool init();
+
+    QString name() const override { return "epoll"; }
+    DbusListener *createListener() override { return new DbusEpollListener(this); }
+    DbusEndpoint *createEndpoint() override { return new DbusEpollEndpoint(this); }
+    DbusEndpoint *adoptEndpoint(int fd) override { return new DbusEpollEndpoint(this, fd); }
+
+    /*
+     * 以边沿触发方式注册socket
+     *
+     * @param fd: socket
+     * @param events: 关注的epoll事件
+     * @param handler: 事件处理对象
+     *
+     * @return bool: true:成功 false:失败
+     */
+    bool add(int fd, quint32 events, DbusEpollHandler *handler);
+
+    /*
+     * 取消注册socket
+     *
+     * @param fd: socket
+     */
+    void remove(int fd);
+
+public slots:
+    /*
+     * 取出所有就绪事件并分发
+     */
+    void processEvents();
+
+private:
+    int epollFd;
+    QScopedPointer<QSocketNotifier> notifier;
+};
+#endif
@@ -0,0 +1,144 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_local_engine.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <QDebug>
+
+// socket读缓存大小，暂停读取时未读数据留在内核socket缓存中
+static const qint64 kReadBufferSize = 64 * 1024;
+
+DbusLocalEndpoint::DbusLocalEndpoint(QLocalSocket *localSocket, QObject *parent)
+    : DbusEndpoint(parent)
+    , socket(localSocket ? localSocket : new QLocalSocket())
+    , isConnecting(false)
+{
+    socket->setParent(this);
+    socket->setReadBufferSize(kReadBufferSize);
+    connect(socket, SIGNAL(connected()), this, SLOT(onConnected()));
+    connect(socket, SIGNAL(connected()), this, SIGNAL(connected()));
+    connect(socket, SIGNAL(error(QLocalSocket::LocalSocketError)), this, SLOT(onError()));
+    connect(socket, SIGNAL(disconnected()), this, SIGNAL(disconnected()));
+    connect(socket, SIGNAL(readyRead()), this, SIGNAL(readyRead()));
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SIGNAL(bytesWritten(qint64)));
+}
+
+void DbusLocalEndpoint::connectToServer(const QString &path)
+{
+    isConnecting = true;
+    socket->connectToServer(path);
+}
+
+void DbusLocalEndpoint::onConnected()
+{
+    isConnecting = false;
+}
+
+void DbusLocalEndpoint::onError()
+{
+    if (isConnecting) {
+        isConnecting = false;
+        emit connectFailed();
+    }
+}
+
+bool DbusLocalEndpoint::waitForConnected(int msecs)
+{
+    return socket->waitForConnected(msecs);
+}
+
+bool DbusLocalEndpoint::isConnected() const
+{
+    return socket->state() == QLocalSocket::ConnectedState;
+}
+
+qint64 DbusLocalEndpoint::read(char *data, qint64 maxSize)
+{
+    return socket->read(data, maxSize);
+}
+
+qint64 DbusLocalEndpoint::write(const QByteArray &data)
+{
+    return socket->write(data);
+}
+
+qint64 DbusLocalEndpoint::bytesToWrite() const
+{
+    return socket->bytesToWrite();
+}
+
+int DbusLocalEndpoint::socketDescriptor() const
+{
+    return socket->socketDescriptor();
+}
+
+void DbusLocalEndpoint::disconnectFromServer()
+{
+    socket->disconnectFromServer();
+}
+
+QString DbusLocalEndpoint::errorString() const
+{
+    return socket->errorString();
+}
+
+DbusLocalListener::DbusLocalListener(QObject *parent)
+    : DbusListener(parent)
+    , server(new QLocalServer(this))
+{
+    connect(server, SIGNAL(newConnection()), this, SIGNAL(newConnection()));
+}
+
+bool DbusLocalListener::listen(const QString &path)
+{
+    QLocalServer::removeServer(path);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    return server->listen(path);
+}
+
+void DbusLocalListener::close()
+{
+    server->close();
+}
+
+DbusEndpoint *DbusLocalListener::nextPendingConnection()
+{
+    QLocalSocket *socket = server->nextPendingConnection();
+    if (!socket) {
+        return nullptr;
+    }
+    return new DbusLocalEndpoint(socket, this);
+}
+
+int DbusLocalListener::nextPendingDescriptor()
+{
+    QLocalSocket *socket = server->nextPendingConnection();
+    if (!socket) {
+        return -1;
+    }
+    // 新连接还未进入事件循环，数据仍在内核socket缓存中，复制socket后释放QLocalSocket
+    int fd = ::fcntl(socket->socketDescriptor(), F_DUPFD_CLOEXEC, 0);
+    delete socket;
+    return fd;
+}
+
+QString DbusLocalListener::errorString() const
+{
+    return server->errorString();
+}
+
+DbusEndpoint *DbusLocalEngine::adoptEndpoint(int fd)
+{
+    QLocalSocket *socket = new QLocalSocket();
+    if (!socket->setSocketDescriptor(fd)) {
+        qWarning() << "adopt socket failed:" << socket->errorString();
+        ::close(fd);
+    }
+    return new DbusLocalEndpoint(socket);
+}
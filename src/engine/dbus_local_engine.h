@@ -0,0 +1,73 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_ENGINE_DBUS_LOCAL_ENGINE_H
+#define LINGLONG_DBUS_PROXY_SRC_ENGINE_DBUS_LOCAL_ENGINE_H
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QScopedPointer>
+
+#include "engine/dbus_endpoint.h"
+
+// 基于QLocalSocket的连接
+class DbusLocalEndpoint : public DbusEndpoint
+{
+    Q_OBJECT
+
+public:
+    explicit DbusLocalEndpoint(QLocalSocket *localSocket = nullptr, QObject *parent = nullptr);
+
+    void connectToServer(const QString &path) override;
+    bool waitForConnected(int msecs) override;
+    bool isConnected() const override;
+    qint64 read(char *data, qint64 maxSize) override;
+    qint64 write(const QByteArray &data) override;
+    qint64 bytesToWrite() const override;
+    int socketDescriptor() const override;
+    void disconnectFromServer() override;
+    QString errorString() const override;
+
+private slots:
+    // 连接完成，不再将错误视为连接失败
+    void onConnected();
+    // 连接过程中出错时发送connectFailed信号
+    void onError();
+
+private:
+    QLocalSocket *socket;
+    // 是否正在连接
+    bool isConnecting;
+};
+
+// 基于QLocalServer的监听socket
+class DbusLocalListener : public DbusListener
+{
+    Q_OBJECT
+
+public:
+    explicit DbusLocalListener(QObject *parent = nullptr);
+
+    bool listen(const QString &path) override;
+    void close() override;
+    DbusEndpoint *nextPendingConnection() override;
+    int nextPendingDescriptor() override;
+    QString errorString() const override;
+
+private:
+    QLocalServer *server;
+};
+
+// 基于Qt socket及信号槽的I/O引擎
+class DbusLocalEngine : public DbusEngine
+{
+public:
+    QString name() const override { return "qt"; }
+    DbusListener *createListener() override { return new DbusLocalListener(); }
+    DbusEndpoint *createEndpoint() override { return new DbusLocalEndpoint(); }
+    DbusEndpoint *adoptEndpoint(int fd) override;
+};
+#endif
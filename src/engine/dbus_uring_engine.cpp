@@ -0,0 +1,1048 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_uring_engine.h"
+
+#ifdef HAVE_IO_URING
+
+#include <endian.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <QDebug>
+#include <QFile>
+
+// 提交队列长度
+static const unsigned kRingEntries = 256;
+
+// 接收缓冲区个数，必须为2的幂
+static const int kBufferCount = 256;
+
+// 单个接收缓冲区大小
+static const int kBufferSize = 16 * 1024;
+
+// 接收缓冲区组id
+static const quint16 kBufferGroup = 0;
+
+// 单个连接最多占用的接收缓冲区数，超过后暂停接收直到数据被读取
+static const int kMaxHeldBuffers = 32;
+
+// 一条send请求链最多包含的请求数
+static const int kMaxLinkedSends = 64;
+
+static int ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+// poll32_events在大端系统上需要交换高低16位
+static quint32 pollEvents(quint32 events)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16);
+#endif
+    return events;
+}
+
+DbusUringEndpoint::DbusUringEndpoint(DbusUringEngine *engine, int fd, QObject *parent)
+    : DbusEndpoint(parent)
+    , engine(engine)
+    , id(engine->addHandler(this))
+    , fd(fd)
+    , state(fd >= 0 ? State::Connected : State::Unconnected)
+    , isPeerClosed(false)
+    , isRecvArmed(false)
+    , isRecvCanceling(false)
+    , isPollArmed(false)
+    , sendsInFlight(0)
+    , pendingBytes(0)
+{
+    if (fd >= 0) {
+        armRecv();
+    }
+}
+
+DbusUringEndpoint::~DbusUringEndpoint()
+{
+    releaseBuffers();
+    int pendingOps = sendsInFlight + (isRecvArmed ? 1 : 0) + (isPollArmed ? 1 : 0);
+    if (fd >= 0) {
+        if (isRecvArmed && !isRecvCanceling) {
+            engine->cancel(id, OpRecv);
+        }
+        if (isPollArmed) {
+            engine->cancel(id, OpPoll);
+        }
+        ::shutdown(fd, SHUT_RDWR);
+        engine->closeDescriptor(id, fd, pendingOps);
+    }
+    // 内核完成前send请求引用的数据不能释放
+    engine->removeHandler(id, pendingOps, sendQueue.mid(0, sendsInFlight));
+}
+
+void DbusUringEndpoint::setError(const char *what, int err)
+{
+    error = QString("%1: %2").arg(what).arg(strerror(err));
+}
+
+void DbusUringEndpoint::connectToServer(const QString &path)
+{
+    if (state != State::Unconnected || fd >= 0) {
+        return;
+    }
+    struct sockaddr_un addr;
+    if (!fillSocketAddress(path, &addr)) {
+        error = "invalid socket path: " + path;
+        emit connectFailed();
+        return;
+    }
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        setError("socket", errno);
+        emit connectFailed();
+        return;
+    }
+    isPeerClosed = false;
+    int ret;
+    do {
+        ret = ::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0 && errno != EAGAIN && errno != EINPROGRESS) {
+        setError("connect", errno);
+        ::close(fd);
+        fd = -1;
+        emit connectFailed();
+        return;
+    }
+    state = State::Connecting;
+    if (ret == 0) {
+        finishConnect();
+        return;
+    }
+    // 监听队列满时连接未完成，等待socket可写
+    struct io_uring_sqe *sqe = engine->getSqe(id, OpPoll);
+    if (sqe) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = pollEvents(POLLOUT);
+        isPollArmed = true;
+    }
+}
+
+void DbusUringEndpoint::finishConnect()
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        err = errno;
+    }
+    if (err != 0) {
+        setError("connect", err);
+        if (isPollArmed) {
+            engine->cancel(id, OpPoll);
+        }
+        engine->closeDescriptor(id, fd, isPollArmed ? 1 : 0);
+        fd = -1;
+        state = State::Unconnected;
+        emit connectFailed();
+        return;
+    }
+    state = State::Connected;
+    armRecv();
+    emit connected();
+}
+
+bool DbusUringEndpoint::waitForConnected(int msecs)
+{
+    if (state == State::Connecting) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        int ret;
+        do {
+            ret = ::poll(&pfd, 1, msecs);
+        } while (ret < 0 && errno == EINTR);
+        if (ret > 0) {
+            finishConnect();
+        } else if (ret == 0) {
+            error = "connect timeout";
+        }
+    }
+    return state == State::Connected;
+}
+
+void DbusUringEndpoint::armRecv()
+{
+    if (isRecvArmed || fd < 0 || isPeerClosed || recvQueue.size() >= kMaxHeldBuffers) {
+        return;
+    }
+    struct io_uring_sqe *sqe = engine->getSqe(id, OpRecv);
+    if (!sqe) {
+        engine->addStarved(id);
+        return;
+    }
+    // 不指定接收地址，由内核从缓冲区组中选择缓冲区
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    isRecvArmed = true;
+}
+
+void DbusUringEndpoint::resumeRecv()
+{
+    if (state == State::Connected || state == State::Closing) {
+        armRecv();
+    }
+}
+
+qint64 DbusUringEndpoint::read(char *data, qint64 maxSize)
+{
+    if (state != State::Connected && state != State::Closing) {
+        return -1;
+    }
+    qint64 total = 0;
+    while (total < maxSize && !recvQueue.isEmpty()) {
+        RecvBuffer &buffer = recvQueue.first();
+        int size = static_cast<int>(qMin<qint64>(maxSize - total, buffer.size - buffer.offset));
+        memcpy(data + total, engine->bufferAddress(buffer.bid) + buffer.offset, size);
+        buffer.offset += size;
+        total += size;
+        if (buffer.offset == buffer.size) {
+            engine->recycleBuffer(buffer.bid);
+            recvQueue.removeFirst();
+        }
+    }
+    // 因占用缓冲区过多而停止的接收在数据被读取后恢复
+    armRecv();
+    if (total > 0) {
+        return total;
+    }
+    if (isPeerClosed) {
+        // 暂停读取后恢复时才读到对端关闭，不会再有完成事件
+        QMetaObject::invokeMethod(this, "onAbort", Qt::QueuedConnection);
+        return -1;
+    }
+    return 0;
+}
+
+qint64 DbusUringEndpoint::write(const QByteArray &data)
+{
+    if (state != State::Connected) {
+        return -1;
+    }
+    if (data.isEmpty()) {
+        return 0;
+    }
+    // data可能引用分帧器缓存，内核发送完成前需要保持有效
+    sendQueue.append(QByteArray(data.constData(), data.size()));
+    pendingBytes += data.size();
+    if (sendsInFlight == 0) {
+        submitSends();
+    }
+    return data.size();
+}
+
+void DbusUringEndpoint::submitSends()
+{
+    int count = engine->reserveSqes(qMin(sendQueue.size(), kMaxLinkedSends));
+    struct io_uring_sqe *last = nullptr;
+    for (int i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = engine->getSqe(id, OpSend);
+        if (!sqe) {
+            break;
+        }
+        const QByteArray &chunk = sendQueue.at(i);
+        // MSG_WAITALL保证流式socket上的请求完整发送，否则请求失败并取消后续请求
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<quint64>(chunk.constData());
+        sqe->len = chunk.size();
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        if (last) {
+            last->flags |= IOSQE_IO_LINK;
+        }
+        last = sqe;
+        sendsInFlight++;
+    }
+}
+
+void DbusUringEndpoint::handleSend(int res)
+{
+    sendsInFlight--;
+    if (state == State::Unconnected || state == State::Connecting) {
+        if (sendsInFlight == 0) {
+            sendQueue.clear();
+        }
+        return;
+    }
+    if (res >= 0) {
+        pendingBytes -= res;
+        if (res >= sendQueue.first().size()) {
+            sendQueue.removeFirst();
+        } else {
+            // 部分发送后请求链已被取消，剩余数据重新提交
+            sendQueue.first() = sendQueue.first().mid(res);
+        }
+    } else if (res != -ECANCELED) {
+        setError("send", -res);
+        closeSocket();
+        return;
+    }
+    if (sendsInFlight == 0) {
+        if (!sendQueue.isEmpty()) {
+            submitSends();
+        } else if (state == State::Closing) {
+            closeSocket();
+            return;
+        }
+    }
+    if (res > 0) {
+        emit bytesWritten(res);
+    }
+}
+
+void DbusUringEndpoint::handleRecv(int res, quint32 flags)
+{
+    if (!(flags & IORING_CQE_F_MORE)) {
+        isRecvArmed = false;
+        isRecvCanceling = false;
+    }
+    bool isAlive = state == State::Connected || state == State::Closing;
+    if (flags & IORING_CQE_F_BUFFER) {
+        quint16 bid = static_cast<quint16>(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (res > 0 && isAlive) {
+            RecvBuffer buffer = {bid, 0, res};
+            recvQueue.append(buffer);
+            // multishot recv会一直接收，占用缓冲区过多时取消，数据被读取后在read中重新提交
+            if (isRecvArmed && !isRecvCanceling && recvQueue.size() >= kMaxHeldBuffers) {
+                isRecvCanceling = engine->cancel(id, OpRecv);
+            }
+        } else {
+            engine->recycleBuffer(bid);
+        }
+    }
+    if (!isAlive) {
+        return;
+    }
+    if (res > 0) {
+        emit readyRead();
+    } else if (res == 0) {
+        // 对端关闭，剩余数据读完后关闭连接
+        isPeerClosed = true;
+        emit readyRead();
+        if (state != State::Unconnected && recvQueue.isEmpty()) {
+            closeSocket();
+        }
+        return;
+    } else if (res == -ENOBUFS) {
+        // 缓冲区耗尽，等待其它连接归还缓冲区
+        engine->addStarved(id);
+        return;
+    } else if (res != -ECANCELED) {
+        setError("recv", -res);
+        closeSocket();
+        return;
+    }
+    if (state != State::Unconnected && !isRecvArmed) {
+        armRecv();
+    }
+}
+
+void DbusUringEndpoint::handleCompletion(int op, int res, quint32 flags)
+{
+    switch (op) {
+    case OpRecv:
+        handleRecv(res, flags);
+        break;
+    case OpSend:
+        handleSend(res);
+        break;
+    case OpPoll:
+        isPollArmed = false;
+        if (state == State::Connecting) {
+            finishConnect();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void DbusUringEndpoint::releaseBuffers()
+{
+    for (const RecvBuffer &buffer : recvQueue) {
+        engine->recycleBuffer(buffer.bid);
+    }
+    recvQueue.clear();
+}
+
+void DbusUringEndpoint::disconnectFromServer()
+{
+    if (state == State::Unconnected || state == State::Closing) {
+        return;
+    }
+    // 待发送数据发送完后再关闭
+    if (state == State::Connected && pendingBytes > 0) {
+        state = State::Closing;
+        return;
+    }
+    closeSocket();
+}
+
+void DbusUringEndpoint::closeSocket()
+{
+    if (fd < 0) {
+        return;
+    }
+    bool wasConnected = state == State::Connected || state == State::Closing;
+    if (isRecvArmed && !isRecvCanceling) {
+        engine->cancel(id, OpRecv);
+    }
+    if (isPollArmed) {
+        engine->cancel(id, OpPoll);
+    }
+    // 未完成的send请求因shutdown失败，描述符在请求全部结束后关闭
+    ::shutdown(fd, SHUT_RDWR);
+    engine->closeDescriptor(id, fd, sendsInFlight + (isRecvArmed ? 1 : 0) + (isPollArmed ? 1 : 0));
+    fd = -1;
+    state = State::Unconnected;
+    releaseBuffers();
+    sendQueue = sendQueue.mid(0, sendsInFlight);
+    pendingBytes = 0;
+    if (wasConnected) {
+        emit disconnected();
+    }
+}
+
+void DbusUringEndpoint::onAbort()
+{
+    closeSocket();
+}
+
+DbusUringListener::DbusUringListener(DbusUringEngine *engine, QObject *parent)
+    : DbusListener(parent)
+    , engine(engine)
+    , id(engine->addHandler(this))
+    , fd(-1)
+    , isAcceptArmed(false)
+{
+}
+
+DbusUringListener::~DbusUringListener()
+{
+    close();
+    engine->removeHandler(id, isAcceptArmed ? 1 : 0, QList<QByteArray>());
+    for (int clientFd : pendingDescriptors) {
+        ::close(clientFd);
+    }
+}
+
+bool DbusUringListener::listen(const QString &path)
+{
+    struct sockaddr_un addr;
+    if (fd >= 0 || !fillSocketAddress(path, &addr)) {
+        error = "invalid socket path: " + path;
+        return false;
+    }
+    ::unlink(addr.sun_path);
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = QString("socket: %1").arg(strerror(errno));
+        return false;
+    }
+    if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0
+        || ::chmod(addr.sun_path, S_IRWXU) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        error = QString("listen: %1").arg(strerror(errno));
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    socketPath = path;
+    armAccept();
+    return true;
+}
+
+void DbusUringListener::armAccept()
+{
+    struct io_uring_sqe *sqe = engine->getSqe(id, OpAccept);
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    isAcceptArmed = true;
+}
+
+void DbusUringListener::close()
+{
+    if (fd < 0) {
+        return;
+    }
+    if (isAcceptArmed) {
+        engine->cancel(id, OpAccept);
+    }
+    ::shutdown(fd, SHUT_RDWR);
+    engine->closeDescriptor(id, fd, isAcceptArmed ? 1 : 0);
+    fd = -1;
+    QFile::remove(socketPath);
+}
+
+DbusEndpoint *DbusUringListener::nextPendingConnection()
+{
+    int clientFd = nextPendingDescriptor();
+    if (clientFd < 0) {
+        return nullptr;
+    }
+    return new DbusUringEndpoint(engine, clientFd, this);
+}
+
+int DbusUringListener::nextPendingDescriptor()
+{
+    if (pendingDescriptors.isEmpty()) {
+        return -1;
+    }
+    return pendingDescriptors.takeFirst();
+}
+
+void DbusUringListener::handleCompletion(int op, int res, quint32 flags)
+{
+    if (op != OpAccept) {
+        return;
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+        isAcceptArmed = false;
+    }
+    if (res >= 0) {
+        if (fd < 0) {
+            ::close(res);
+            return;
+        }
+        pendingDescriptors.append(res);
+        emit newConnection();
+    } else if (res != -ECANCELED) {
+        qWarning() << "accept failed:" << strerror(-res);
+    }
+    // multishot accept被内核终止时重新提交
+    if (fd >= 0 && !isAcceptArmed) {
+        armAccept();
+    }
+}
+
+DbusUringEngine::DbusUringEngine()
+    : ringFd(-1)
+    , eventFd(-1)
+    , sqRing(MAP_FAILED)
+    , sqRingSize(0)
+    , sqHead(nullptr)
+    , sqTail(nullptr)
+    , sqMask(0)
+    , sqEntries(0)
+    , sqes(static_cast<struct io_uring_sqe *>(MAP_FAILED))
+    , sqesSize(0)
+    , sqeTail(0)
+    , cqRing(MAP_FAILED)
+    , cqRingSize(0)
+    , cqHead(nullptr)
+    , cqTail(nullptr)
+    , cqMask(0)
+    , cqes(nullptr)
+    , bufRing(static_cast<struct io_uring_buf_ring *>(MAP_FAILED))
+    , bufRingSize(0)
+    , bufBase(static_cast<char *>(MAP_FAILED))
+    , bufTail(0)
+    , freeBuffers(0)
+    , nextId(1)
+    , isSubmitScheduled(false)
+    , isProcessing(false)
+{
+}
+
+DbusUringEngine::~DbusUringEngine()
+{
+    release();
+}
+
+/*
+ * 释放io_uring实例及映射的内存
+ */
+void DbusUringEngine::release()
+{
+    notifier.reset();
+    // 关闭ring fd后内核取消所有未完成的请求
+    if (ringFd >= 0) {
+        ::close(ringFd);
+        ringFd = -1;
+    }
+    if (eventFd >= 0) {
+        ::close(eventFd);
+        eventFd = -1;
+    }
+    if (sqRing != MAP_FAILED) {
+        ::munmap(sqRing, qMax(sqRingSize, cqRingSize));
+        sqRing = MAP_FAILED;
+        cqRing = MAP_FAILED;
+    }
+    if (sqes != MAP_FAILED) {
+        ::munmap(sqes, sqesSize);
+        sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+    }
+    if (bufRing != MAP_FAILED) {
+        ::munmap(bufRing, bufRingSize);
+        bufRing = static_cast<struct io_uring_buf_ring *>(MAP_FAILED);
+    }
+    if (bufBase != MAP_FAILED) {
+        ::munmap(bufBase, static_cast<size_t>(kBufferCount) * kBufferSize);
+        bufBase = static_cast<char *>(MAP_FAILED);
+    }
+    orphans.clear();
+    for (const PendingClose &closing : pendingCloses) {
+        ::close(closing.fd);
+    }
+    pendingCloses.clear();
+}
+
+/*
+ * 创建io_uring实例并注册接收缓冲区环
+ *
+ * @return bool: true:成功 false:失败
+ */
+bool DbusUringEngine::init()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = ioUringSetup(kRingEntries, &params);
+    if (ringFd < 0) {
+        qWarning() << "io_uring_setup failed:" << strerror(errno);
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        qWarning() << "io_uring features not supported:" << params.features;
+        release();
+        return false;
+    }
+
+    // 提交队列与完成队列共用一次映射
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqRing = ::mmap(nullptr, qMax(sqRingSize, cqRingSize), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ringFd, IORING_OFF_SQ_RING);
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqesMap =
+        ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    sqes = static_cast<struct io_uring_sqe *>(sqesMap);
+    if (sqRing == MAP_FAILED || sqesMap == MAP_FAILED) {
+        qWarning() << "mmap io_uring failed:" << strerror(errno);
+        release();
+        return false;
+    }
+    cqRing = sqRing;
+    char *sq = static_cast<char *>(sqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    // 提交队列项与索引一一对应，之后不再修改
+    unsigned *sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sqEntries; i++) {
+        sqArray[i] = i;
+    }
+    sqeTail = *sqTail;
+    char *cq = static_cast<char *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // 注册接收缓冲区环，内核接收数据时从中选择缓冲区
+    bufRingSize = kBufferCount * sizeof(struct io_uring_buf);
+    void *ringMap = ::mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bufRing = static_cast<struct io_uring_buf_ring *>(ringMap);
+    void *baseMap = ::mmap(nullptr, static_cast<size_t>(kBufferCount) * kBufferSize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bufBase = static_cast<char *>(baseMap);
+    if (ringMap == MAP_FAILED || baseMap == MAP_FAILED) {
+        qWarning() << "mmap buffer ring failed:" << strerror(errno);
+        release();
+        return false;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<quint64>(bufRing);
+    reg.ring_entries = kBufferCount;
+    reg.bgid = kBufferGroup;
+    if (ioUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        qWarning() << "register buffer ring failed:" << strerror(errno);
+        release();
+        return false;
+    }
+    for (int bid = 0; bid < kBufferCount; bid++) {
+        recycleBuffer(static_cast<quint16>(bid));
+    }
+
+    if (!probeRecvMultishot()) {
+        qWarning() << "io_uring multishot recv not supported";
+        release();
+        return false;
+    }
+
+    // 完成事件通过eventfd通知Qt事件循环
+    eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0 || ioUringRegister(ringFd, IORING_REGISTER_EVENTFD, &eventFd, 1) < 0) {
+        qWarning() << "register eventfd failed:" << strerror(errno);
+        release();
+        return false;
+    }
+    notifier.reset(new QSocketNotifier(eventFd, QSocketNotifier::Read));
+    connect(notifier.get(), SIGNAL(activated(int)), this, SLOT(processEvents()));
+    return true;
+}
+
+/*
+ * 检查内核是否支持multishot recv，5.19内核支持缓冲区环但不支持multishot recv
+ *
+ * @return bool: true:支持 false:不支持
+ */
+bool DbusUringEngine::probeRecvMultishot()
+{
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+        return false;
+    }
+    bool isSupported = false;
+    bool isFinished = false;
+    if (::send(fds[1], "x", 1, MSG_NOSIGNAL) == 1) {
+        // id 0不对应任何处理对象
+        struct io_uring_sqe *sqe = getSqe(0, DbusUringHandler::OpRecv);
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fds[0];
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kBufferGroup;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        ::close(fds[1]);
+        fds[1] = -1;
+        __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+        // 数据及对端关闭各产生一个完成事件，不支持时只有一个错误事件
+        while (!isFinished && ioUringEnter(ringFd, 1, 1, IORING_ENTER_GETEVENTS) >= 0) {
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                const struct io_uring_cqe &cqe = cqes[head & cqMask];
+                if (cqe.flags & IORING_CQE_F_BUFFER) {
+                    freeBuffers--;
+                    recycleBuffer(static_cast<quint16>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+                }
+                if (cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE)) {
+                    isSupported = true;
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                    isFinished = true;
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+    ::close(fds[0]);
+    if (fds[1] >= 0) {
+        ::close(fds[1]);
+    }
+    return isSupported && isFinished;
+}
+
+/*
+ * 注册完成事件处理对象
+ *
+ * @param handler: 处理对象
+ *
+ * @return quint64: 处理对象id
+ */
+quint64 DbusUringEngine::addHandler(DbusUringHandler *handler)
+{
+    quint64 id = nextId++;
+    handlers.insert(id, handler);
+    return id;
+}
+
+/*
+ * 取消注册处理对象，未完成的请求由引擎接管
+ *
+ * @param id: 处理对象id
+ * @param pendingOps: 未完成的请求数
+ * @param buffers: 未完成的send请求引用的数据
+ */
+void DbusUringEngine::removeHandler(quint64 id, int pendingOps, const QList<QByteArray> &buffers)
+{
+    handlers.remove(id);
+    starved.removeAll(id);
+    if (pendingOps > 0) {
+        Orphan orphan = {pendingOps, buffers};
+        orphans.insert(id, orphan);
+    }
+}
+
+/*
+ * 关闭socket描述符，socket还有未完成的请求时在请求全部结束后关闭
+ * 未提交的请求及请求链中未开始的请求在执行时才按描述符查找socket，提前关闭时描述符可能已分配给新连接
+ *
+ * @param id: 处理对象id
+ * @param fd: socket描述符
+ * @param pendingOps: 使用该描述符且未完成的请求数，不含取消请求
+ */
+void DbusUringEngine::closeDescriptor(quint64 id, int fd, int pendingOps)
+{
+    if (pendingOps <= 0 || ringFd < 0) {
+        ::close(fd);
+        return;
+    }
+    PendingClose closing = {fd, pendingOps};
+    pendingCloses.insert(id, closing);
+}
+
+/*
+ * 获取一个空闲的提交队列项，提交队列满时先提交已准备的请求
+ *
+ * @param id: 处理对象id
+ * @param op: 请求类型
+ *
+ * @return io_uring_sqe: 提交队列项，失败时为空
+ */
+struct io_uring_sqe *DbusUringEngine::getSqe(quint64 id, int op)
+{
+    if (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        submit();
+        if (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+            qWarning() << "io_uring submission queue full";
+            return nullptr;
+        }
+    }
+    struct io_uring_sqe *sqe = &sqes[sqeTail & sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (id << 8) | static_cast<quint64>(op);
+    sqeTail++;
+    // 分发完成事件时准备的请求在分发结束后统一提交
+    if (!isProcessing && !isSubmitScheduled) {
+        isSubmitScheduled = true;
+        QMetaObject::invokeMethod(this, "submit", Qt::QueuedConnection);
+    }
+    return sqe;
+}
+
+/*
+ * 预留连续的提交队列项，保证之后的getSqe不会提交一半的请求链
+ *
+ * @param count: 需要的提交队列项数
+ *
+ * @return int: 可用的提交队列项数，不超过count
+ */
+int DbusUringEngine::reserveSqes(int count)
+{
+    int space = static_cast<int>(sqEntries - (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)));
+    if (space < count) {
+        submit();
+        space = static_cast<int>(sqEntries - (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)));
+    }
+    return qMin(space, count);
+}
+
+/*
+ * 取消处理对象的一个请求
+ *
+ * @param id: 处理对象id
+ * @param op: 请求类型
+ *
+ * @return bool: true:已提交取消请求 false:失败
+ */
+bool DbusUringEngine::cancel(quint64 id, int op)
+{
+    struct io_uring_sqe *sqe = getSqe(id, DbusUringHandler::OpCancel);
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (id << 8) | static_cast<quint64>(op);
+    return true;
+}
+
+/*
+ * 接收缓冲区地址
+ *
+ * @param bid: 缓冲区id
+ *
+ * @return char: 缓冲区地址
+ */
+const char *DbusUringEngine::bufferAddress(quint16 bid) const
+{
+    return bufBase + static_cast<size_t>(bid) * kBufferSize;
+}
+
+/*
+ * 归还接收缓冲区，有等待缓冲区的连接时重新提交其recv请求
+ *
+ * @param bid: 缓冲区id
+ */
+void DbusUringEngine::recycleBuffer(quint16 bid)
+{
+    // C++中bufs成员的偏移与C不同，缓冲区环按io_uring_buf数组访问，tail与首项的resv重叠
+    struct io_uring_buf *buf = reinterpret_cast<struct io_uring_buf *>(bufRing) + (bufTail & (kBufferCount - 1));
+    buf->addr = reinterpret_cast<quint64>(bufBase + static_cast<size_t>(bid) * kBufferSize);
+    buf->len = kBufferSize;
+    buf->bid = bid;
+    bufTail++;
+    __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+    freeBuffers++;
+    // 空闲缓冲区足够时再恢复，避免每归还一个缓冲区就重新提交一次
+    if (starved.isEmpty() || freeBuffers < kBufferCount / 4) {
+        return;
+    }
+    QList<quint64> ids;
+    ids.swap(starved);
+    for (quint64 id : ids) {
+        DbusUringHandler *handler = handlers.value(id);
+        if (handler) {
+            handler->resumeRecv();
+        }
+    }
+}
+
+/*
+ * 记录因缓冲区耗尽而停止接收的连接
+ *
+ * @param id: 处理对象id
+ */
+void DbusUringEngine::addStarved(quint64 id)
+{
+    if (!starved.contains(id)) {
+        starved.append(id);
+    }
+}
+
+/*
+ * 分发一个完成事件
+ *
+ * @param userData: 请求的user_data
+ * @param res: 请求结果
+ * @param flags: 完成事件标志
+ */
+void DbusUringEngine::dispatch(quint64 userData, int res, quint32 flags)
+{
+    quint64 id = userData >> 8;
+    int op = static_cast<int>(userData & 0xff);
+    if (flags & IORING_CQE_F_BUFFER) {
+        freeBuffers--;
+    }
+    // 等待关闭的socket在最后一个请求结束后关闭
+    if (op != DbusUringHandler::OpCancel && !(flags & IORING_CQE_F_MORE)) {
+        auto closing = pendingCloses.find(id);
+        if (closing != pendingCloses.end() && --closing->pendingOps <= 0) {
+            ::close(closing->fd);
+            pendingCloses.erase(closing);
+        }
+    }
+    DbusUringHandler *handler = handlers.value(id);
+    if (handler) {
+        handler->handleCompletion(op, res, flags);
+        return;
+    }
+    // 处理对象已销毁，归还缓冲区并在请求全部完成后释放发送数据
+    if (flags & IORING_CQE_F_BUFFER) {
+        recycleBuffer(static_cast<quint16>(flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+    if (op == DbusUringHandler::OpCancel || (flags & IORING_CQE_F_MORE)) {
+        return;
+    }
+    auto it = orphans.find(id);
+    if (it != orphans.end() && --it->pendingOps <= 0) {
+        orphans.erase(it);
+    }
+}
+
+/*
+ * 取出所有完成事件并分发，然后提交已准备的请求
+ */
+void DbusUringEngine::processEvents()
+{
+    if (ringFd < 0) {
+        return;
+    }
+    if (eventFd >= 0) {
+        quint64 value;
+        ssize_t ret = ::read(eventFd, &value, sizeof(value));
+        Q_UNUSED(ret);
+    }
+    isProcessing = true;
+    for (;;) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+        for (; head != tail; head++) {
+            const struct io_uring_cqe &cqe = cqes[head & cqMask];
+            quint64 userData = cqe.user_data;
+            int res = cqe.res;
+            quint32 flags = cqe.flags;
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            dispatch(userData, res, flags);
+        }
+    }
+    isProcessing = false;
+    submit();
+}
+
+/*
+ * 提交已准备的请求
+ */
+void DbusUringEngine::submit()
+{
+    isSubmitScheduled = false;
+    if (ringFd < 0) {
+        return;
+    }
+    __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (toSubmit == 0) {
+        return;
+    }
+    int ret;
+    do {
+        ret = ioUringEnter(ringFd, toSubmit, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret >= 0) {
+        return;
+    }
+    // 完成队列积压时先取出完成事件再提交
+    if (errno == EBUSY || errno == EAGAIN) {
+        QMetaObject::invokeMethod(this, "processEvents", Qt::QueuedConnection);
+    } else {
+        qWarning() << "io_uring_enter failed:" << strerror(errno);
+    }
+}
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_ENGINE_DBUS_URING_ENGINE_H
+#define LINGLONG_DBUS_PROXY_SRC_ENGINE_DBUS_URING_ENGINE_H
+
+#ifdef HAVE_IO_URING
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QScopedPointer>
+#include <QSocketNotifier>
+
+#include "engine/dbus_endpoint.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+class DbusUringEngine;
+
+// io_uring完成事件处理接口，注册后通过user_data中的id找到处理对象
+class DbusUringHandler
+{
+public:
+    // 请求类型，保存在user_data低8位
+    enum Op { OpRecv = 1, OpSend, OpAccept, OpPoll, OpCancel };
+
+    virtual ~DbusUringHandler() {}
+
+    /*
+     * 处理完成事件
+     *
+     * @param op: 请求类型
+     * @param res: 请求结果，小于0时为-errno
+     * @param flags: 完成事件标志
+     */
+    virtual void handleCompletion(int op, int res, quint32 flags) = 0;
+
+    /*
+     * 接收缓冲区已归还，因缓冲区耗尽而停止的接收可以继续
+     */
+    virtual void resumeRecv() {}
+};
+
+/*
+ * 基于io_uring的连接
+ *
+ * 接收使用multishot recv，数据由内核直接写入引擎提供的缓冲区环，read时拷贝后归还缓冲区；
+ * 发送使用IOSQE_IO_LINK串联的send请求，同一时间只有一条请求链，保证发送顺序
+ */
+class DbusUringEndpoint : public DbusEndpoint, public DbusUringHandler
+{
+    Q_OBJECT
+
+public:
+    /*
+     * @param engine: 所属的io_uring引擎
+     * @param fd: 已连接的socket，为-1时需要调用connectToServer
+     * @param parent: 父对象
+     */
+    DbusUringEndpoint(DbusUringEngine *engine, int fd = -1, QObject *parent = nullptr);
+    ~DbusUringEndpoint() override;
+
+    void connectToServer(const QString &path) override;
+    bool waitForConnected(int msecs) override;
+    bool isConnected() const override { return state == State::Connected; }
+    qint64 read(char *data, qint64 maxSize) override;
+    qint64 write(const QByteArray &data) override;
+    qint64 bytesToWrite() const override { return pendingBytes; }
+    int socketDescriptor() const override { return fd; }
+    void disconnectFromServer() override;
+    QString errorString() const override { return error; }
+    // 发送请求由内核异步完成，直接写socket会打乱发送顺序
+    bool canWriteDirectly() const override { return false; }
+
+    void handleCompletion(int op, int res, quint32 flags) override;
+    void resumeRecv() override;
+
+private slots:
+    // 读取到对端关闭后在事件循环中关闭连接
+    void onAbort();
+
+private:
+    enum class State { Unconnected, Connecting, Connected, Closing };
+
+    // 已收到未读取的缓冲区
+    struct RecvBuffer {
+        quint16 bid;
+        int offset;
+        int size;
+    };
+
+    /*
+     * 连接完成或失败
+     */
+    void finishConnect();
+
+    /*
+     * 提交multishot recv请求
+     */
+    void armRecv();
+
+    /*
+     * 将发送队列中的数据作为一条请求链提交
+     */
+    void submitSends();
+
+    /*
+     * 处理send请求完成事件
+     *
+     * @param res: 请求结果
+     */
+    void handleSend(int res);
+
+    /*
+     * 处理recv请求完成事件
+     *
+     * @param res: 请求结果
+     * @param flags: 完成事件标志
+     */
+    void handleRecv(int res, quint32 flags);
+
+    /*
+     * 归还所有已收到未读取的缓冲区
+     */
+    void releaseBuffers();
+
+    /*
+     * 关闭socket并发送disconnected信号
+     */
+    void closeSocket();
+
+    /*
+     * 记录错误
+     *
+     * @param what: 出错的操作
+     * @param err: 错误码
+     */
+    void setError(const char *what, int err);
+
+    DbusUringEngine *engine;
+    quint64 id;
+    int fd;
+    State state;
+    // 对端已关闭
+    bool isPeerClosed;
+    // multishot recv请求是否有效
+    bool isRecvArmed;
+    // 占用缓冲区过多时已提交取消recv请求，等待内核结束该请求
+    bool isRecvCanceling;
+    // 连接中的poll请求是否有效
+    bool isPollArmed;
+    QList<RecvBuffer> recvQueue;
+    // 待发送数据，队首的sendsInFlight个已提交给内核
+    QList<QByteArray> sendQueue;
+    int sendsInFlight;
+    qint64 pendingBytes;
+    QString error;
+};
+
+// 基于multishot accept的监听socket
+class DbusUringListener : public DbusListener, public DbusUringHandler
+{
+    Q_OBJECT
+
+public:
+    explicit DbusUringListener(DbusUringEngine *engine, QObject *parent = nullptr);
+    ~DbusUringListener() override;
+
+    bool listen(const QString &path) override;
+    void close() override;
+    DbusEndpoint *nextPendingConnection() override;
+    int nextPendingDescriptor() override;
+    QString errorString() const override { return error; }
+
+    void handleCompletion(int op, int res, quint32 flags) override;
+
+private:
+    /*
+     * 提交multishot accept请求
+     */
+    void armAccept();
+
+    DbusUringEngine *engine;
+    quint64 id;
+    int fd;
+    bool isAcceptArmed;
+    QString socketPath;
+    // 已接受未取出的客户端socket
+    QList<int> pendingDescriptors;
+    QString error;
+};
+
+/*
+ * 基于io_uring的I/O引擎，不依赖liburing，直接使用系统调用
+ *
+ * 完成队列通过注册的eventfd接入Qt事件循环，每次唤醒时取出所有完成事件分发，
+ * 处理过程中准备的请求在结束时通过一次io_uring_enter批量提交。
+ * 需要内核支持provided buffer ring(5.19)及multishot recv(6.0)，否则初始化失败
+ */
+class DbusUringEngine : public QObject, public DbusEngine
+{
+    Q_OBJECT
+
+public:
+    DbusUringEngine();
+    ~DbusUringEngine() override;
+
+    /*
+     * 创建io_uring实例并注册接收缓冲区环
+     *
+     * @return bool: true:成功 false:失败
+     */
+    bool init();
+
+    QString name() const override { return "io_uring"; }
+    DbusListener *createListener() override { return new DbusUringListener(this); }
+    DbusEndpoint *createEndpoint() override { return new DbusUringEndpoint(this); }
+    DbusEndpoint *adoptEndpoint(int fd) override { return new DbusUringEndpoint(this, fd); }
+
+    /*
+     * 注册完成事件处理对象
+     *
+     * @param handler: 处理对象
+     *
+     * @return quint64: 处理对象id
+     */
+    quint64 addHandler(DbusUringHandler *handler);
+
+    /*
+     * 取消注册处理对象，未完成的请求由引擎接管
+     *
+     * @param id: 处理对象id
+     * @param pendingOps: 未完成的请求数
+     * @param buffers: 未完成的send请求引用的数据
+     */
+    void removeHandler(quint64 id, int pendingOps, const QList<QByteArray> &buffers);
+
+    /*
+     * 关闭socket描述符，socket还有未完成的请求时在请求全部结束后关闭
+     * 每个处理对象同一时间只有一个等待关闭的描述符
+     *
+     * @param id: 处理对象id
+     * @param fd: socket描述符
+     * @param pendingOps: 使用该描述符且未完成的请求数，不含取消请求
+     */
+    void closeDescriptor(quint64 id, int fd, int pendingOps);
+
+    /*
+     * 获取一个空闲的提交队列项，提交队列满时先提交已准备的请求
+     *
+     * @param id: 处理对象id
+     * @param op: 请求类型
+     *
+     * @return io_uring_sqe: 提交队列项，失败时为空
+     */
+    struct io_uring_sqe *getSqe(quint64 id, int op);
+
+    /*
+     * 预留连续的提交队列项，保证之后的getSqe不会提交一半的请求链
+     *
+     * @param count: 需要的提交队列项数
+     *
+     * @return int: 可用的提交队列项数，不超过count
+     */
+    int reserveSqes(int count);
+
+    /*
+     * 取消处理对象的一个请求
+     *
+     * @param id: 处理对象id
+     * @param op: 请求类型
+     *
+     * @return bool: true:已提交取消请求 false:失败
+     */
+    bool cancel(quint64 id, int op);
+
+    /*
+     * 接收缓冲区地址
+     *
+     * @param bid: 缓冲区id
+     *
+     * @return char: 缓冲区地址
+     */
+    const char *bufferAddress(quint16 bid) const;
+
+    /*
+     * 归还接收缓冲区，有等待缓冲区的连接时重新提交其recv请求
+     *
+     * @param bid: 缓冲区id
+     */
+    void recycleBuffer(quint16 bid);
+
+    /*
+     * 空闲的接收缓冲区数
+     *
+     * @return int: 缓冲区环中可供内核选择的缓冲区数
+     */
+    int freeBufferCount() const { return freeBuffers; }
+
+    /*
+     * 记录因缓冲区耗尽而停止接收的连接
+     *
+     * @param id: 处理对象id
+     */
+    void addStarved(quint64 id);
+
+public slots:
+    /*
+     * 取出所有完成事件并分发，然后提交已准备的请求
+     */
+    void processEvents();
+
+    /*
+     * 提交已准备的请求
+     */
+    void submit();
+
+private:
+    // 处理对象销毁后仍未完成的请求
+    struct Orphan {
+        int pendingOps;
+        QList<QByteArray> buffers;
+    };
+
+    // 请求未全部结束、暂不关闭的socket
+    struct PendingClose {
+        int fd;
+        int pendingOps;
+    };
+
+    /*
+     * 分发一个完成事件
+     *
+     * @param userData: 请求的user_data
+     * @param res: 请求结果
+     * @param flags: 完成事件标志
+     */
+    void dispatch(quint64 userData, int res, quint32 flags);
+
+    /*
+     * 检查内核是否支持multishot recv，5.19内核支持缓冲区环但不支持multishot recv
+     *
+     * @return bool: true:支持 false:不支持
+     */
+    bool probeRecvMultishot();
+
+    /*
+     * 释放io_uring实例及映射的内存
+     */
+    void release();
+
+    int ringFd;
+    int eventFd;
+
+    // 提交队列
+    void *sqRing;
+    size_t sqRingSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    // 已准备的请求尾部，提交时写入sqTail
+    unsigned sqeTail;
+
+    // 完成队列
+    void *cqRing;
+    size_t cqRingSize;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    // 接收缓冲区环
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    char *bufBase;
+    unsigned short bufTail;
+    // 未被内核使用的缓冲区数
+    int freeBuffers;
+
+    quint64 nextId;
+    QHash<quint64, DbusUringHandler *> handlers;
+    QHash<quint64, Orphan> orphans;
+    QHash<quint64, PendingClose> pendingCloses;
+    // 等待接收缓冲区的连接
+    QList<quint64> starved;
+    // 是否已安排在事件循环中提交
+    bool isSubmitScheduled;
+    // 是否正在分发完成事件，分发结束后统一提交
+    bool isProcessing;
+    QScopedPointer<QSocketNotifier> notifier;
+};
+
+#endif
+#endif
@@ -11,57 +11,35 @@
 #include <QJsonObject>
 #include <QJsonParseError>
 #include <QJsonValue>
-#include <QRegExp>
 
 /*
- * 判断是否为符合规则的表达式
- *
- * @param expression: 表达式
- *
- * @return bool: true: 是 false:否
- */
-bool DbusFilter::isRegularExp(const QString &expression)
-{
-    return expression.endsWith("*") || expression.endsWith("+") || expression.endsWith("?");
-}
-
-/*
- * 判断输入字符串是否匹配指定规则
- *
- * @param src: 输入表达式
- * @param reg: 正则表达式
- *
- * @return bool: true: 是 false:否
- */
-bool DbusFilter::isMatchRegExp(const QString &src, const QString &reg)
-{
-    const QRegExp regx(reg);
-    return src.contains(regx);
-}
-
-/*
- * 判断输入数据是否匹配指定规则列表
+ * 判断dbus消息是否匹配规则列表
  *
- * @param data: 输入表达式
- * @param filterList: 规则列表
+ * @param name: 消息名称
+ * @param path: 消息路径
+ * @param interface: 消息interface
  *
  * @return bool: true: 是 false:否
  */
-bool DbusFilter::isMatchFilter(const QString &data, const QStringList &filterList)
+bool DbusFilter::isMessageMatch(const QString &name, const QString &path, const QString &interface) const
 {
-    bool isFound = false;
-    for (const QString &item : filterList) {
-        if (item == data || (isRegularExp(item) && isMatchRegExp(data, item))) {
-            isFound = true;
-            break;
-        }
+    if (name.isEmpty() && path.isEmpty() && interface.isEmpty()) {
+        return false;
     }
-
-    return isFound;
+    if (!name.isEmpty() && !nameMatcher.isMatch(name)) {
+        return false;
+    }
+    if (!path.isEmpty() && !pathTree.isMatch(path) && !pathMatcher.isMatch(path)) {
+        return false;
+    }
+    if (!interface.isEmpty() && !interfaceMatcher.isMatch(interface)) {
+        return false;
+    }
+    return true;
 }
 
 /*
- * 判断dbus消息是否匹配规则列表
+ * 判断dbus消息报文头视图中的字段是否匹配规则列表
  *
  * @param name: 消息名称
  * @param path: 消息路径
@@ -69,18 +47,19 @@ bool DbusFilter::isMatchFilter(const QString &data, const QStringList &filterLis
  *
  * @return bool: true: 是 false:否
  */
-bool DbusFilter::isMessageMatch(const QString &name, const QString &path, const QString &interface)
+bool DbusFilter::isMessageMatch(const QLatin1String &name, const QLatin1String &path,
+                                const QLatin1String &interface) const
 {
     if (name.isEmpty() && path.isEmpty() && interface.isEmpty()) {
         return false;
     }
-    if (!name.isEmpty() && !isMatchFilter(name, nameFilter)) {
+    if (!name.isEmpty() && !nameMatcher.isMatch(name)) {
         return false;
     }
-    if (!path.isEmpty() && !isMatchFilter(path, pathFilter)) {
+    if (!path.isEmpty() && !pathTree.isMatch(path) && !pathMatcher.isMatch(path)) {
         return false;
     }
-    if (!interface.isEmpty() && !isMatchFilter(interface, interfaceFilter)) {
+    if (!interface.isEmpty() && !interfaceMatcher.isMatch(interface)) {
         return false;
     }
     return true;
@@ -93,10 +72,11 @@ bool DbusFilter::isMessageMatch(const QString &name, const QString &path, const
  */
 void DbusFilter::addNameFilter(const QString &name)
 {
-    if (nameFilter.contains(name)) {
+    if (!nameMatcher.addRule(name)) {
         return;
     }
     nameFilter.append(name);
+    ruleGeneration++;
 }
 
 /*
@@ -106,10 +86,12 @@ void DbusFilter::addNameFilter(const QString &name)
  */
 void DbusFilter::addPathFilter(const QString &path)
 {
-    if (pathFilter.contains(path)) {
+    bool isAdded = DbusPathTree::isTreeRule(path) ? pathTree.addRule(path) : pathMatcher.addRule(path);
+    if (!isAdded) {
         return;
     }
     pathFilter.append(path);
+    ruleGeneration++;
 }
 
 /*
@@ -119,10 +101,11 @@ void DbusFilter::addPathFilter(const QString &path)
  */
 void DbusFilter::addInterfaceFilter(const QString &interface)
 {
-    if (interfaceFilter.contains(interface)) {
+    if (!interfaceMatcher.addRule(interface)) {
         return;
     }
     interfaceFilter.append(interface);
+    ruleGeneration++;
 }
 
 /*
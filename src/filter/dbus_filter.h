@@ -8,9 +8,13 @@
 #define LINGLONG_DBUS_PROXY_SRC_FILTER_DBUS_FILTER_H
 
 #include <QDebug>
+#include <QLatin1String>
 #include <QObject>
 #include <QStringList>
 
+#include "dbus_matcher.h"
+#include "dbus_path_tree.h"
+
 class DbusFilter : public QObject
 {
     Q_OBJECT
@@ -21,38 +25,30 @@ private:
     QStringList pathFilter;
     QStringList interfaceFilter;
 
-    /*
-     * 判断是否为符合规则的表达式
-     *
-     * @param expression: 表达式
-     *
-     * @return bool: true: 是 false:否
-     */
-    bool isRegularExp(const QString &expression);
+    // 添加规则时编译好的匹配器
+    DbusRuleMatcher nameMatcher;
+    DbusRuleMatcher pathMatcher;
+    DbusRuleMatcher interfaceMatcher;
+    // 层级路径规则，无法按层级表示的路径规则放在pathMatcher中
+    DbusPathTree pathTree;
 
-    /*
-     * 判断输入字符串是否匹配指定规则
-     *
-     * @param src: 输入表达式
-     * @param reg: 正则表达式
-     *
-     * @return bool: true: 是 false:否
-     */
-    bool isMatchRegExp(const QString &src, const QString &reg);
+    // 规则版本，每添加一条规则加1，用于使匹配结果缓存失效
+    quint64 ruleGeneration = 0;
 
+public:
     /*
-     * 判断输入数据是否匹配指定规则列表
+     * 判断dbus消息是否匹配规则列表
      *
-     * @param data: 输入表达式
-     * @param filterList: 规则列表
+     * @param name: 消息名称
+     * @param path: 消息路径
+     * @param interface: 消息interface
      *
      * @return bool: true: 是 false:否
      */
-    bool isMatchFilter(const QString &data, const QStringList &filterList);
+    bool isMessageMatch(const QString &name, const QString &path, const QString &interface) const;
 
-public:
     /*
-     * 判断dbus消息是否匹配规则列表
+     * 判断dbus消息报文头视图中的字段是否匹配规则列表
      *
      * @param name: 消息名称
      * @param path: 消息路径
@@ -60,7 +56,7 @@ public:
      *
      * @return bool: true: 是 false:否
      */
-    bool isMessageMatch(const QString &name, const QString &path, const QString &interface);
+    bool isMessageMatch(const QLatin1String &name, const QLatin1String &path, const QLatin1String &interface) const;
 
     /*
      * 添加消息名称匹配规则
@@ -83,6 +79,13 @@ public:
      */
     void addInterfaceFilter(const QString &interface);
 
+    /*
+     * 获取规则版本，规则变化后之前缓存的匹配结果失效
+     *
+     * @return quint64: 规则版本
+     */
+    quint64 generation() const { return ruleGeneration; }
+
     /*
      * dump dbus消息过滤规则
      *
@@ -0,0 +1,232 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_matcher.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <QDebug>
+
+// 正则匹配时在栈上转换的最大输入长度，dbus name及interface不超过255字节
+static const int kInlineSubjectSize = 256;
+
+/*
+ * FNV-1a 哈希
+ *
+ * @param data: 输入数据地址
+ * @param size: 输入数据长度
+ *
+ * @return quint32: 哈希值
+ */
+static quint32 hashBytes(const char *data, int size)
+{
+    quint32 hash = 2166136261u;
+    for (int i = 0; i < size; i++) {
+        hash ^= static_cast<uchar>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * 判断规则中是否包含正则元字符，"."按普通字符处理
+ *
+ * @param rule: 匹配规则
+ *
+ * @return bool: true: 是 false:否
+ */
+static bool hasRegExpChar(const QString &rule)
+{
+    static const QString metaChars = "*+?[](){}|^$\\";
+    for (const QChar &c : rule) {
+        if (metaChars.contains(c)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+DbusRuleMatcher::DbusRuleMatcher()
+{
+    // 根节点
+    TrieNode root;
+    root.isPrefixEnd = false;
+    trie.append(root);
+}
+
+/*
+ * 添加并编译一条匹配规则
+ *
+ * @param rule: 匹配规则
+ *
+ * @return bool: true:添加成功 false:规则已存在或不是合法的正则表达式
+ */
+bool DbusRuleMatcher::addRule(const QString &rule)
+{
+    if (rules.contains(rule)) {
+        return false;
+    }
+
+    if (rule.endsWith("*")) {
+        QString stem = rule.left(rule.size() - 1);
+        // 单独的"*"不是合法的正则表达式，不作为匹配所有字符串的前缀规则
+        if (!stem.isEmpty() && !hasRegExpChar(stem)) {
+            // "name.*" 同时匹配name本身
+            if (stem.endsWith(".")) {
+                addExact(stem.left(stem.size() - 1).toUtf8());
+            }
+            addPrefix(stem.toUtf8());
+            rules.insert(rule);
+            return true;
+        }
+    } else if (!hasRegExpChar(rule)) {
+        addExact(rule.toUtf8());
+        rules.insert(rule);
+        return true;
+    }
+    if (!addRegExp(rule)) {
+        return false;
+    }
+    rules.insert(rule);
+    return true;
+}
+
+void DbusRuleMatcher::addExact(const QByteArray &rule)
+{
+    exactRules.append(rule);
+    // 负载因子不超过0.5，扩容时重建哈希表
+    if (exactRules.size() * 2 > exactSlots.size()) {
+        int capacity = qMax(16, exactSlots.size() * 2);
+        while (exactRules.size() * 2 > capacity) {
+            capacity *= 2;
+        }
+        exactSlots.fill(-1, capacity);
+        for (int i = 0; i < exactRules.size(); i++) {
+            const QByteArray &item = exactRules.at(i);
+            quint32 pos = hashBytes(item.constData(), item.size()) & (capacity - 1);
+            while (exactSlots.at(pos) != -1) {
+                pos = (pos + 1) & (capacity - 1);
+            }
+            exactSlots[pos] = i;
+        }
+        return;
+    }
+    quint32 mask = exactSlots.size() - 1;
+    quint32 pos = hashBytes(rule.constData(), rule.size()) & mask;
+    while (exactSlots.at(pos) != -1) {
+        pos = (pos + 1) & mask;
+    }
+    exactSlots[pos] = exactRules.size() - 1;
+}
+
+void DbusRuleMatcher::addPrefix(const QByteArray &prefix)
+{
+    int node = 0;
+    for (char c : prefix) {
+        const QVector<char> &labels = trie.at(node).labels;
+        auto it = std::lower_bound(labels.constBegin(), labels.constEnd(), c);
+        int index = it - labels.constBegin();
+        if (it != labels.constEnd() && *it == c) {
+            node = trie.at(node).children.at(index);
+            continue;
+        }
+        TrieNode child;
+        child.isPrefixEnd = false;
+        trie.append(child);
+        int childIndex = trie.size() - 1;
+        trie[node].labels.insert(index, c);
+        trie[node].children.insert(index, childIndex);
+        node = childIndex;
+    }
+    trie[node].isPrefixEnd = true;
+}
+
+bool DbusRuleMatcher::addRegExp(const QString &rule)
+{
+    if (!QRegularExpression(rule).isValid()) {
+        qWarning() << "invalid filter rule:" << rule;
+        return false;
+    }
+    regExpRules.append(rule);
+    // 所有正则规则合并为一个锚定的正则表达式，只在添加规则时编译
+    regExp.setPattern(QString("\\A(?:%1)\\z").arg(regExpRules.join(")|(?:")));
+    regExp.optimize();
+    return true;
+}
+
+bool DbusRuleMatcher::isExactMatch(const char *data, int size) const
+{
+    if (exactSlots.isEmpty()) {
+        return false;
+    }
+    quint32 mask = exactSlots.size() - 1;
+    quint32 pos = hashBytes(data, size) & mask;
+    int index;
+    while ((index = exactSlots.at(pos)) != -1) {
+        const QByteArray &item = exactRules.at(index);
+        if (item.size() == size && memcmp(item.constData(), data, size) == 0) {
+            return true;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return false;
+}
+
+bool DbusRuleMatcher::isPrefixMatch(const char *data, int size) const
+{
+    int node = 0;
+    for (int i = 0;; i++) {
+        const TrieNode &current = trie.at(node);
+        if (current.isPrefixEnd) {
+            return true;
+        }
+        if (i == size) {
+            return false;
+        }
+        auto it = std::lower_bound(current.labels.constBegin(), current.labels.constEnd(), data[i]);
+        if (it == current.labels.constEnd() || *it != data[i]) {
+            return false;
+        }
+        node = current.children.at(it - current.labels.constBegin());
+    }
+}
+
+/*
+ * 判断输入字符串是否匹配任一规则
+ *
+ * @param data: 输入字符串地址
+ * @param size: 输入字符串长度
+ *
+ * @return bool: true: 是 false:否
+ */
+bool DbusRuleMatcher::isMatch(const char *data, int size) const
+{
+    if (isExactMatch(data, size) || isPrefixMatch(data, size)) {
+        return true;
+    }
+    if (regExpRules.isEmpty()) {
+        return false;
+    }
+    return isRegExpMatch(data, size);
+}
+
+bool DbusRuleMatcher::isRegExpMatch(const char *data, int size) const
+{
+    // dbus name、path及interface只含ASCII字符，直接在栈上转换，不为每次匹配分配QString
+    QChar subject[kInlineSubjectSize];
+    if (size <= kInlineSubjectSize) {
+        int i = 0;
+        for (; i < size && static_cast<uchar>(data[i]) < 0x80; i++) {
+            subject[i] = QLatin1Char(data[i]);
+        }
+        if (i == size) {
+            return regExp.match(QString::fromRawData(subject, size)).hasMatch();
+        }
+    }
+    return regExp.match(QString::fromUtf8(data, size)).hasMatch();
+}
@@ -0,0 +1,96 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_FILTER_DBUS_MATCHER_H
+#define LINGLONG_DBUS_PROXY_SRC_FILTER_DBUS_MATCHER_H
+
+#include <QByteArray>
+#include <QLatin1String>
+#include <QRegularExpression>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/*
+ * 编译后的规则匹配器
+ *
+ * 规则在添加时编译，匹配时整串锚定:
+ * 普通规则精确匹配，存放在哈希表中；
+ * "prefix*" 匹配以prefix开头的字符串，"name.*" 同时匹配name本身，存放在前缀树中；
+ * 其余以"+"或"?"结尾、或包含正则元字符的规则合并为一个正则表达式。
+ * 匹配耗时只与输入长度有关，与规则数量无关
+ */
+class DbusRuleMatcher
+{
+public:
+    DbusRuleMatcher();
+
+    /*
+     * 添加并编译一条匹配规则
+     *
+     * @param rule: 匹配规则
+     *
+     * @return bool: true:添加成功 false:规则已存在或不是合法的正则表达式
+     */
+    bool addRule(const QString &rule);
+
+    /*
+     * 判断输入字符串是否匹配任一规则
+     *
+     * @param data: 输入字符串地址
+     * @param size: 输入字符串长度
+     *
+     * @return bool: true: 是 false:否
+     */
+    bool isMatch(const char *data, int size) const;
+
+    bool isMatch(const QLatin1String &data) const { return isMatch(data.data(), data.size()); }
+
+    bool isMatch(const QString &data) const
+    {
+        const QByteArray utf8 = data.toUtf8();
+        return isMatch(utf8.constData(), utf8.size());
+    }
+
+    /*
+     * 获取规则数量
+     *
+     * @return int: 规则数量
+     */
+    int ruleCount() const { return rules.size(); }
+
+private:
+    // 前缀树节点，子节点按字节升序排列
+    struct TrieNode {
+        QVector<char> labels;
+        QVector<int> children;
+        // 从根节点到该节点的路径是某条前缀规则
+        bool isPrefixEnd;
+    };
+
+    void addExact(const QByteArray &rule);
+    void addPrefix(const QByteArray &prefix);
+    bool addRegExp(const QString &rule);
+
+    bool isExactMatch(const char *data, int size) const;
+    bool isPrefixMatch(const char *data, int size) const;
+    bool isRegExpMatch(const char *data, int size) const;
+
+    // 已添加的规则，用于去重
+    QSet<QString> rules;
+
+    // 精确匹配规则的开放寻址哈希表，slot中保存exactRules下标，-1表示空
+    QVector<QByteArray> exactRules;
+    QVector<int> exactSlots;
+
+    QVector<TrieNode> trie;
+
+    // 其它正则规则合并后的锚定正则
+    QStringList regExpRules;
+    QRegularExpression regExp;
+};
+#endif
@@ -0,0 +1,177 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_path_tree.h"
+
+#include <string.h>
+
+#include <QStringList>
+
+/*
+ * 判断路径中的一级名称是否不含正则元字符
+ *
+ * @param name: 路径中的一级名称
+ *
+ * @return bool: true: 是 false:否
+ */
+static bool isPlainName(const QString &name)
+{
+    static const QString metaChars = "*+?[](){}|^$\\";
+    for (const QChar &c : name) {
+        if (metaChars.contains(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+DbusPathTree::DbusPathTree()
+{
+    // 根节点 "/"
+    PathNode root;
+    root.flags = 0;
+    nodes.append(root);
+}
+
+/*
+ * 判断规则是否可以用路径树表示
+ * 不以"/"开头或含空的一级名称(结尾的"/"、连续的"/")的规则不是合法路径，仍按正则规则处理
+ *
+ * @param rule: 路径规则
+ *
+ * @return bool: true: 是 false:否
+ */
+bool DbusPathTree::isTreeRule(const QString &rule)
+{
+    if (!rule.startsWith("/")) {
+        return false;
+    }
+    if (rule.size() == 1) {
+        return true;
+    }
+    QStringList names = rule.mid(1).split("/");
+    for (int i = 0; i < names.size(); i++) {
+        if (names.at(i).isEmpty()) {
+            return false;
+        }
+        // 通配符只能作为最后一级
+        if (i == names.size() - 1 && (names.at(i) == "*" || names.at(i) == "+")) {
+            break;
+        }
+        if (!isPlainName(names.at(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int DbusPathTree::findChild(int node, const char *name, int size, bool *found) const
+{
+    const QVector<QByteArray> &names = nodes.at(node).names;
+    int low = 0;
+    int high = names.size();
+    while (low < high) {
+        int mid = (low + high) / 2;
+        const QByteArray &item = names.at(mid);
+        int ret = memcmp(item.constData(), name, qMin(item.size(), size));
+        if (ret == 0) {
+            ret = item.size() - size;
+        }
+        if (ret == 0) {
+            *found = true;
+            return mid;
+        }
+        if (ret < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *found = false;
+    return low;
+}
+
+/*
+ * 添加路径规则，调用前需要通过isTreeRule检查
+ *
+ * @param rule: 路径规则
+ *
+ * @return bool: true:添加成功 false:规则已存在
+ */
+bool DbusPathTree::addRule(const QString &rule)
+{
+    QStringList names = rule.split("/", QString::SkipEmptyParts);
+    int flag = Exact;
+    if (!names.isEmpty() && names.last() == "*") {
+        flag = Subtree;
+        names.removeLast();
+    } else if (!names.isEmpty() && names.last() == "+") {
+        flag = Children;
+        names.removeLast();
+    }
+
+    int node = 0;
+    for (const QString &name : names) {
+        const QByteArray utf8 = name.toUtf8();
+        bool found = false;
+        int index = findChild(node, utf8.constData(), utf8.size(), &found);
+        if (found) {
+            node = nodes.at(node).children.at(index);
+            continue;
+        }
+        PathNode child;
+        child.flags = 0;
+        nodes.append(child);
+        int childIndex = nodes.size() - 1;
+        nodes[node].names.insert(index, utf8);
+        nodes[node].children.insert(index, childIndex);
+        node = childIndex;
+    }
+
+    if (nodes.at(node).flags & flag) {
+        return false;
+    }
+    nodes[node].flags |= flag;
+    return true;
+}
+
+/*
+ * 判断路径是否匹配任一规则
+ *
+ * @param path: 路径地址
+ * @param size: 路径长度
+ *
+ * @return bool: true: 是 false:否
+ */
+bool DbusPathTree::isMatch(const char *path, int size) const
+{
+    if (size <= 0 || path[0] != '/') {
+        return false;
+    }
+
+    int node = 0;
+    int pos = 1;
+    while (pos < size) {
+        const char *name = path + pos;
+        const char *end = static_cast<const char *>(memchr(name, '/', size - pos));
+        int nameSize = end ? end - name : size - pos;
+        pos += nameSize + 1;
+        if (nameSize == 0) {
+            continue;
+        }
+        // 当前节点的规则覆盖其下所有路径
+        if (nodes.at(node).flags & (Subtree | Children)) {
+            return true;
+        }
+        bool found = false;
+        int index = findChild(node, name, nameSize, &found);
+        if (!found) {
+            return false;
+        }
+        node = nodes.at(node).children.at(index);
+    }
+    return (nodes.at(node).flags & (Exact | Subtree)) != 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_FILTER_DBUS_PATH_TREE_H
+#define LINGLONG_DBUS_PROXY_SRC_FILTER_DBUS_PATH_TREE_H
+
+#include <QByteArray>
+#include <QLatin1String>
+#include <QString>
+#include <QVector>
+
+/*
+ * 按dbus object path层级组织的路径规则树
+ *
+ * 每个节点对应路径中的一级，相同前缀的规则共用节点:
+ * "/a/b" 只匹配/a/b；
+ * "/a/b/*" 匹配/a/b及其下所有路径；
+ * "/a/b/+" 只匹配/a/b下的子路径，不匹配/a/b本身。
+ * 判断一个路径只需要从根节点向下查找一次
+ */
+class DbusPathTree
+{
+public:
+    DbusPathTree();
+
+    /*
+     * 判断规则是否可以用路径树表示
+     * 不以"/"开头或含空的一级名称(结尾的"/"、连续的"/")的规则不是合法路径，仍按正则规则处理
+     *
+     * @param rule: 路径规则
+     *
+     * @return bool: true: 是 false:否
+     */
+    static bool isTreeRule(const QString &rule);
+
+    /*
+     * 添加路径规则，调用前需要通过isTreeRule检查
+     *
+     * @param rule: 路径规则
+     *
+     * @return bool: true:添加成功 false:规则已存在
+     */
+    bool addRule(const QString &rule);
+
+    /*
+     * 判断路径是否匹配任一规则
+     *
+     * @param path: 路径地址
+     * @param size: 路径长度
+     *
+     * @return bool: true: 是 false:否
+     */
+    bool isMatch(const char *path, int size) const;
+
+    bool isMatch(const QLatin1String &path) const { return isMatch(path.data(), path.size()); }
+
+    bool isMatch(const QString &path) const
+    {
+        const QByteArray utf8 = path.toUtf8();
+        return isMatch(utf8.constData(), utf8.size());
+    }
+
+private:
+    enum MatchFlag {
+        // 匹配节点本身
+        Exact = 0x1,
+        // 匹配节点及其下所有路径
+        Subtree = 0x2,
+        // 只匹配节点下的路径
+        Children = 0x4
+    };
+
+    // 路径树节点，子节点按名称升序排列
+    struct PathNode {
+        QVector<QByteArray> names;
+        QVector<int> children;
+        int flags;
+    };
+
+    /*
+     * 查找子节点
+     *
+     * @param node: 父节点下标
+     * @param name: 子节点名称地址
+     * @param size: 子节点名称长度
+     * @param found: 是否找到
+     *
+     * @return int: 找到时为子节点在父节点中的下标，否则为插入位置
+     */
+    int findChild(int node, const char *name, int size, bool *found) const;
+
+    QVector<PathNode> nodes;
+};
+#endif
@@ -0,0 +1,173 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_verdict_cache.h"
+
+#include <string.h>
+
+DbusVerdictCache::DbusVerdictCache(int capacity)
+    : entries(qMax(capacity, 1))
+    , clockHand(0)
+    , usedCount(0)
+    , ruleGeneration(0)
+    , hitCount(0)
+    , missCount(0)
+{
+    clear();
+    index.reserve(entries.size());
+}
+
+/*
+ * 对key的四个字段计算FNV-1a哈希，字段之间以'\0'分隔
+ */
+quint32 DbusVerdictCache::hashKey(const QLatin1String &destination, const QLatin1String &path,
+                                  const QLatin1String &interface, const QLatin1String &member)
+{
+    const QLatin1String *fields[] = {&destination, &path, &interface, &member};
+    quint32 hash = 2166136261u;
+    for (const QLatin1String *field : fields) {
+        const char *data = field->data();
+        for (int i = 0; i < field->size(); i++) {
+            hash ^= static_cast<uchar>(data[i]);
+            hash *= 16777619u;
+        }
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool DbusVerdictCache::isKeyEqual(const Entry &entry, const QLatin1String &destination, const QLatin1String &path,
+                                  const QLatin1String &interface, const QLatin1String &member)
+{
+    const QLatin1String *fields[] = {&destination, &path, &interface, &member};
+    const char *pos = entry.key.constData();
+    const char *end = pos + entry.key.size();
+    for (const QLatin1String *field : fields) {
+        int size = field->size();
+        if (end - pos < size + 1) {
+            return false;
+        }
+        if (size > 0 && memcmp(pos, field->data(), size) != 0) {
+            return false;
+        }
+        pos += size;
+        if (*pos != '\0') {
+            return false;
+        }
+        pos++;
+    }
+    return pos == end;
+}
+
+/*
+ * 检查规则版本，版本变化时清空缓存
+ *
+ * @param generation: 当前过滤规则版本
+ */
+void DbusVerdictCache::checkGeneration(quint64 generation)
+{
+    if (generation != ruleGeneration) {
+        clear();
+        ruleGeneration = generation;
+    }
+}
+
+/*
+ * 查找缓存的匹配结果
+ *
+ * @param generation: 当前过滤规则版本
+ * @param destination: 消息destination
+ * @param path: 消息路径
+ * @param interface: 消息interface
+ * @param member: 消息member
+ * @param verdict: 缓存的匹配结果
+ *
+ * @return bool: true:命中 false:未命中
+ */
+bool DbusVerdictCache::lookup(quint64 generation, const QLatin1String &destination, const QLatin1String &path,
+                              const QLatin1String &interface, const QLatin1String &member, bool *verdict)
+{
+    checkGeneration(generation);
+    auto it = index.constFind(hashKey(destination, path, interface, member));
+    if (it != index.constEnd()) {
+        Entry &entry = entries[it.value()];
+        if (isKeyEqual(entry, destination, path, interface, member)) {
+            entry.referenced = true;
+            *verdict = entry.verdict;
+            hitCount++;
+            return true;
+        }
+    }
+    missCount++;
+    return false;
+}
+
+/*
+ * 缓存匹配结果
+ *
+ * @param generation: 当前过滤规则版本
+ * @param destination: 消息destination
+ * @param path: 消息路径
+ * @param interface: 消息interface
+ * @param member: 消息member
+ * @param verdict: 匹配结果
+ */
+void DbusVerdictCache::insert(quint64 generation, const QLatin1String &destination, const QLatin1String &path,
+                              const QLatin1String &interface, const QLatin1String &member, bool verdict)
+{
+    checkGeneration(generation);
+    quint32 hash = hashKey(destination, path, interface, member);
+    int slot;
+    auto it = index.constFind(hash);
+    if (it != index.constEnd()) {
+        // 哈希冲突时覆盖原有条目
+        slot = it.value();
+    } else if (usedCount < entries.size()) {
+        slot = usedCount++;
+        index.insert(hash, slot);
+    } else {
+        // CLOCK淘汰: 跳过并清除最近访问过的条目，淘汰第一个未被访问的条目
+        while (entries.at(clockHand).referenced) {
+            entries[clockHand].referenced = false;
+            clockHand = (clockHand + 1) % entries.size();
+        }
+        slot = clockHand;
+        clockHand = (clockHand + 1) % entries.size();
+        index.remove(entries.at(slot).hash);
+        index.insert(hash, slot);
+    }
+
+    Entry &entry = entries[slot];
+    entry.hash = hash;
+    // 复用条目原有的key缓存
+    entry.key.resize(destination.size() + path.size() + interface.size() + member.size() + 4);
+    char *pos = entry.key.data();
+    const QLatin1String *fields[] = {&destination, &path, &interface, &member};
+    for (const QLatin1String *field : fields) {
+        if (field->size() > 0) {
+            memcpy(pos, field->data(), field->size());
+        }
+        pos += field->size();
+        *pos++ = '\0';
+    }
+    entry.verdict = verdict;
+    entry.referenced = false;
+}
+
+/*
+ * 清空缓存
+ */
+void DbusVerdictCache::clear()
+{
+    for (Entry &entry : entries) {
+        entry.hash = 0;
+        entry.verdict = false;
+        entry.referenced = false;
+    }
+    index.clear();
+    clockHand = 0;
+    usedCount = 0;
+}
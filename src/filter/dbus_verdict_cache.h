@@ -0,0 +1,95 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_FILTER_DBUS_VERDICT_CACHE_H
+#define LINGLONG_DBUS_PROXY_SRC_FILTER_DBUS_VERDICT_CACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QLatin1String>
+#include <QVector>
+
+/*
+ * 过滤规则匹配结果缓存
+ *
+ * 以(destination, path, interface, member)为key，直接对报文中的字段计算哈希，
+ * 命中时不需要构造QString。容量固定，满后按CLOCK算法淘汰。
+ * 规则变化时过滤器的generation随之变化，缓存整体失效
+ */
+class DbusVerdictCache
+{
+public:
+    explicit DbusVerdictCache(int capacity = 1024);
+
+    /*
+     * 查找缓存的匹配结果
+     *
+     * @param generation: 当前过滤规则版本
+     * @param destination: 消息destination
+     * @param path: 消息路径
+     * @param interface: 消息interface
+     * @param member: 消息member
+     * @param verdict: 缓存的匹配结果
+     *
+     * @return bool: true:命中 false:未命中
+     */
+    bool lookup(quint64 generation, const QLatin1String &destination, const QLatin1String &path,
+                const QLatin1String &interface, const QLatin1String &member, bool *verdict);
+
+    /*
+     * 缓存匹配结果
+     *
+     * @param generation: 当前过滤规则版本
+     * @param destination: 消息destination
+     * @param path: 消息路径
+     * @param interface: 消息interface
+     * @param member: 消息member
+     * @param verdict: 匹配结果
+     */
+    void insert(quint64 generation, const QLatin1String &destination, const QLatin1String &path,
+                const QLatin1String &interface, const QLatin1String &member, bool verdict);
+
+    /*
+     * 清空缓存
+     */
+    void clear();
+
+    int capacity() const { return entries.size(); }
+    quint64 hits() const { return hitCount; }
+    quint64 misses() const { return missCount; }
+
+private:
+    struct Entry {
+        quint32 hash;
+        // 四个字段依次以'\0'分隔保存
+        QByteArray key;
+        bool verdict;
+        // CLOCK访问标记
+        bool referenced;
+    };
+
+    static quint32 hashKey(const QLatin1String &destination, const QLatin1String &path,
+                           const QLatin1String &interface, const QLatin1String &member);
+    static bool isKeyEqual(const Entry &entry, const QLatin1String &destination, const QLatin1String &path,
+                           const QLatin1String &interface, const QLatin1String &member);
+
+    /*
+     * 检查规则版本，版本变化时清空缓存
+     *
+     * @param generation: 当前过滤规则版本
+     */
+    void checkGeneration(quint64 generation);
+
+    QVector<Entry> entries;
+    // 哈希值与entries下标的对应关系
+    QHash<quint32, int> index;
+    int clockHand;
+    int usedCount;
+    quint64 ruleGeneration;
+    quint64 hitCount;
+    quint64 missCount;
+};
+#endif
@@ -70,6 +70,8 @@ int main(int argc, char *argv[])
 
     QString config = "";
     server.filter.dumpConfig(config);
+    // 收到SIGUSR1时清空权限申请结果缓存
+    server.startListenControlSignal();
     server.startListenBoxClient(socketPath);
     return app.exec();
 }
\ No newline at end of file
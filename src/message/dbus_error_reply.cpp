@@ -0,0 +1,115 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_error_reply.h"
+
+#include <string.h>
+
+#include <QtEndian>
+
+#include "message/dbus_message.h"
+
+// 报文头中serial、字段数组长度及reply_serial的偏移
+static const int kSerialOffset = 8;
+static const int kFieldsLengthOffset = 12;
+static const int kReplySerialOffset = 20;
+// 字段数组的起始偏移
+static const int kFieldsOffset = 16;
+
+/*
+ * 按小端序追加4字节无符号整形
+ *
+ * @param out: 输出缓存
+ * @param value: 整形值
+ */
+static void appendUint32(QByteArray *out, quint32 value)
+{
+    char data[4];
+    qToLittleEndian(value, reinterpret_cast<uchar *>(data));
+    out->append(data, sizeof(data));
+}
+
+/*
+ * 追加0字节使长度按指定字节数对齐
+ *
+ * @param out: 输出缓存
+ * @param align: 对齐字节数
+ */
+static void appendPadding(QByteArray *out, int align)
+{
+    while (out->size() % align != 0) {
+        out->append('\0');
+    }
+}
+
+/*
+ * 追加一个字符串类型的报文头字段
+ *
+ * @param out: 输出缓存
+ * @param field: 字段类型
+ * @param value: 字段值
+ */
+static void appendStringField(QByteArray *out, DBusMessageHeaderField field, const QByteArray &value)
+{
+    appendPadding(out, 8);
+    out->append(static_cast<char>(field));
+    out->append("\x01s\x00", 3);
+    appendUint32(out, value.size());
+    out->append(value.constData(), value.size() + 1);
+}
+
+DbusErrorReply::DbusErrorReply(const QString &errorName, const QString &errorMessage)
+{
+    QByteArray message = errorMessage.toUtf8();
+    appendUint32(&body, message.size());
+    body.append(message.constData(), message.size() + 1);
+
+    // 错误回复不需要回复，与dbus_message_new_error一致
+    prefix.append("l\x03\x01\x01", 4);
+    appendUint32(&prefix, body.size());
+    appendUint32(&prefix, 0);
+    appendUint32(&prefix, 0);
+    // reply_serial为第一个字段，偏移固定
+    prefix.append(static_cast<char>(DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_REPLY_SERIAL));
+    prefix.append("\x01u\x00", 3);
+    appendUint32(&prefix, 0);
+    appendStringField(&prefix, DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_ERROR_NAME, errorName.toLatin1());
+    appendPadding(&prefix, 8);
+    prefix.append(static_cast<char>(DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_SIGNATURE));
+    prefix.append("\x01g\x00\x01s\x00", 6);
+}
+
+const QByteArray &DbusErrorReply::build(quint32 serial, quint32 replySerial, const QString &destination)
+{
+    int destinationSize = destination.size();
+    // 最大长度: 固定部分、destination字段及两处对齐
+    buffer.resize(prefix.size() + 8 + 8 + destinationSize + 1 + 8 + body.size());
+    char *data = buffer.data();
+    memcpy(data, prefix.constData(), prefix.size());
+    int offset = prefix.size();
+    if (destinationSize > 0) {
+        quint32 aligned = alignBy8(offset);
+        memset(data + offset, 0, aligned - offset);
+        offset = aligned;
+        data[offset] = static_cast<char>(DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_DESTINATION);
+        memcpy(data + offset + 1, "\x01s\x00", 3);
+        qToLittleEndian<quint32>(destinationSize, reinterpret_cast<uchar *>(data + offset + 4));
+        offset += 8;
+        // unique name只包含ASCII字符
+        for (int i = 0; i < destinationSize; i++) {
+            data[offset++] = destination.at(i).toLatin1();
+        }
+        data[offset++] = '\0';
+    }
+    qToLittleEndian<quint32>(serial, reinterpret_cast<uchar *>(data + kSerialOffset));
+    qToLittleEndian<quint32>(offset - kFieldsOffset, reinterpret_cast<uchar *>(data + kFieldsLengthOffset));
+    qToLittleEndian<quint32>(replySerial, reinterpret_cast<uchar *>(data + kReplySerialOffset));
+    quint32 bodyOffset = alignBy8(offset);
+    memset(data + offset, 0, bodyOffset - offset);
+    memcpy(data + bodyOffset, body.constData(), body.size());
+    buffer.resize(bodyOffset + body.size());
+    return buffer;
+}
@@ -0,0 +1,47 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_MESSAGE_DBUS_ERROR_REPLY_H
+#define LINGLONG_DBUS_PROXY_SRC_MESSAGE_DBUS_ERROR_REPLY_H
+
+#include <QByteArray>
+#include <QString>
+
+/*
+ * 预先编码的dbus错误回复
+ *
+ * 构造时按小端序编码错误名、签名及错误消息，生成回复时只填入serial、reply_serial
+ * 及destination，不经过libdbus，缓存可复用，一个线程使用一个对象
+ */
+class DbusErrorReply
+{
+public:
+    /*
+     * @param errorName: 错误名
+     * @param errorMessage: 错误消息
+     */
+    DbusErrorReply(const QString &errorName, const QString &errorMessage);
+
+    /*
+     * 生成错误回复
+     *
+     * @param serial: 回复消息的serial
+     * @param replySerial: 被回复消息的serial
+     * @param destination: 接收方unique name，为空时不填写
+     *
+     * @return QByteArray: 完整的dbus消息，下次调用build前有效
+     */
+    const QByteArray &build(quint32 serial, quint32 replySerial, const QString &destination);
+
+private:
+    // 报文头固定部分，包含destination之前的所有字段
+    QByteArray prefix;
+    // 消息body，只有错误信息一个字符串参数，位于报文头对齐之后，本身不需要填充
+    QByteArray body;
+    // 生成回复使用的缓存
+    QByteArray buffer;
+};
+#endif
@@ -0,0 +1,265 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_framer.h"
+
+#include <string.h>
+
+#include <QDebug>
+
+#include "dbus_message.h"
+
+// 握手阶段单行最大长度，与libdbus认证行长度上限一致
+static const int kMaxAuthLineLength = 16384;
+// dbus协议规定的报文最大长度 128MiB
+static const quint32 kMaxMessageLength = 134217728;
+// dbus协议规定的数组最大长度 64MiB
+static const quint32 kMaxArrayLength = 67108864;
+// 报文头固定部分长度
+static const int kFixedHeaderLength = 16;
+// 缓存为空时保留的最大容量，超过时释放，避免一条大消息之后连接一直占用同样大小的内存
+static const int kMaxIdleBufferSize = 128 * 1024;
+
+DbusFramer::DbusFramer(Phase phase)
+    : state(phase)
+    , head(0)
+    , tail(0)
+    , passThrough(0)
+{
+}
+
+/*
+ * 获取缓存尾部可写入的空间，已返回的分帧结果随之失效
+ *
+ * @param size: 需要写入的字节数
+ *
+ * @return char*: 可写入地址
+ */
+char *DbusFramer::reserve(int size)
+{
+    // 已处理的数据全部丢弃，复用缓存头部
+    if (head == tail) {
+        head = 0;
+        tail = 0;
+        if (buffer.size() > kMaxIdleBufferSize) {
+            buffer = QByteArray();
+        }
+    }
+    if (tail + size > buffer.size()) {
+        // 将未处理的数据移动到缓存头部
+        if (head > 0) {
+            memmove(buffer.data(), buffer.constData() + head, tail - head);
+            tail -= head;
+            head = 0;
+        }
+        if (tail + size > buffer.size()) {
+            buffer.resize(qMax(buffer.size() * 2, tail + size));
+        }
+    }
+    return buffer.data() + tail;
+}
+
+/*
+ * 确认写入reserve返回空间中的字节数
+ *
+ * @param size: 实际写入的字节数
+ */
+void DbusFramer::commit(int size)
+{
+    tail += size;
+}
+
+/*
+ * 追加数据到缓存
+ *
+ * @param data: 数据地址
+ * @param size: 数据长度
+ */
+void DbusFramer::append(const char *data, int size)
+{
+    memcpy(reserve(size), data, size);
+    commit(size);
+}
+
+/*
+ * 从缓存中取出下一帧完整的消息
+ *
+ * @param frame: 分帧结果
+ *
+ * @return bool: true:取到完整消息 false:数据不足或出错
+ */
+bool DbusFramer::next(DbusFrame *frame)
+{
+    switch (state) {
+    case Phase::Auth:
+        return nextAuthLine(frame);
+    case Phase::Binary:
+        return passThrough > 0 ? nextPassThrough(frame) : nextMessage(frame);
+    default:
+        return false;
+    }
+}
+
+bool DbusFramer::nextAuthLine(DbusFrame *frame)
+{
+    const char *begin = buffer.constData() + head;
+    int pending = tail - head;
+    // 握手消息以"\r\n"结尾，不完整的行等待后续数据
+    const char *lineEnd = static_cast<const char *>(memchr(begin, '\n', pending));
+    if (!lineEnd) {
+        if (pending > kMaxAuthLineLength) {
+            qCritical() << "auth line too long, size:" << pending;
+            state = Phase::Error;
+        }
+        return false;
+    }
+
+    int size = lineEnd - begin + 1;
+    frame->data = begin;
+    frame->size = size;
+    frame->isAuth = true;
+    frame->isPartial = false;
+    head += size;
+
+    // 客户端连接后首先发送的credentials字节与第一行认证消息一起转发
+    const char *line = begin;
+    if (size > 0 && *line == '\0') {
+        line++;
+        size--;
+    }
+    if (size == 7 && memcmp(line, "BEGIN\r\n", 7) == 0) {
+        state = Phase::Binary;
+    }
+    return true;
+}
+
+/*
+ * 根据报文头固定部分计算消息长度，长度不合法时进入Error阶段
+ *
+ * @param begin: 消息起始地址，至少包含报文头固定部分
+ * @param headerLen: 报文头长度，包含对齐
+ * @param msgLen: 消息总长度
+ *
+ * @return bool: true:成功 false:数据不符合协议
+ */
+bool DbusFramer::messageLength(const char *begin, quint32 *headerLen, quint32 *msgLen)
+{
+    bool bigEndian;
+    if (begin[0] == 'B') {
+        bigEndian = true;
+    } else if (begin[0] == 'l') {
+        bigEndian = false;
+    } else {
+        qCritical() << "invalid dbus msg endianness:" << QByteArray(begin, 1).toHex();
+        state = Phase::Error;
+        return false;
+    }
+
+    // Length in bytes of the message body
+    quint32 bodyLen = readUint32(begin + 4, bigEndian);
+    // A UINT32 giving the length of the array data in bytes
+    quint32 arrayLen = readUint32(begin + 12, bigEndian);
+    if (arrayLen > kMaxArrayLength || bodyLen > kMaxMessageLength) {
+        qCritical() << "invalid dbus msg length, array:" << arrayLen << ", body:" << bodyLen;
+        state = Phase::Error;
+        return false;
+    }
+    *headerLen = alignBy8(kFixedHeaderLength + arrayLen);
+    *msgLen = *headerLen + bodyLen;
+    if (*msgLen > kMaxMessageLength) {
+        qCritical() << "dbus msg exceeds maximum length:" << *msgLen;
+        state = Phase::Error;
+        return false;
+    }
+    return true;
+}
+
+bool DbusFramer::nextMessage(DbusFrame *frame)
+{
+    const char *begin = buffer.constData() + head;
+    int pending = tail - head;
+    if (pending < kFixedHeaderLength) {
+        return false;
+    }
+
+    quint32 headerLen;
+    quint32 msgLen;
+    if (!messageLength(begin, &headerLen, &msgLen)) {
+        return false;
+    }
+    if ((quint32)pending < msgLen) {
+        return false;
+    }
+
+    frame->data = begin;
+    frame->size = msgLen;
+    frame->isAuth = false;
+    frame->isPartial = false;
+    head += msgLen;
+    return true;
+}
+
+bool DbusFramer::nextPassThrough(DbusFrame *frame)
+{
+    int pending = tail - head;
+    if (pending == 0) {
+        return false;
+    }
+    int size = static_cast<int>(qMin<qint64>(pending, passThrough));
+    frame->data = buffer.constData() + head;
+    frame->size = size;
+    frame->isAuth = false;
+    frame->isPartial = true;
+    head += size;
+    passThrough -= size;
+    return true;
+}
+
+/*
+ * 缓存中只有一条不完整的消息且其报文头已完整时，获取该消息已收到的部分，不取出
+ *
+ * @param frame: 报文头及已收到的部分消息体
+ * @param minSize: 消息总长度不小于该值时才返回
+ *
+ * @return bool: true:有满足条件的消息 false:没有
+ */
+bool DbusFramer::peekPartial(DbusFrame *frame, int minSize)
+{
+    const char *begin = buffer.constData() + head;
+    int pending = tail - head;
+    if (state != Phase::Binary || passThrough > 0 || pending < kFixedHeaderLength) {
+        return false;
+    }
+    quint32 headerLen;
+    quint32 msgLen;
+    if (!messageLength(begin, &headerLen, &msgLen)) {
+        return false;
+    }
+    if ((quint32)pending < headerLen || (quint32)pending >= msgLen || msgLen < (quint32)minSize) {
+        return false;
+    }
+    frame->data = begin;
+    frame->size = pending;
+    frame->isAuth = false;
+    frame->isPartial = true;
+    return true;
+}
+
+/*
+ * 取出peekPartial返回的部分消息，消息剩余的字节开始透传
+ */
+void DbusFramer::startPassThrough()
+{
+    quint32 headerLen;
+    quint32 msgLen;
+    int pending = tail - head;
+    if (pending < kFixedHeaderLength || !messageLength(buffer.constData() + head, &headerLen, &msgLen)
+        || (quint32)pending >= msgLen) {
+        return;
+    }
+    passThrough = msgLen - pending;
+    head = tail;
+}
@@ -0,0 +1,168 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_MESSAGE_DBUS_FRAMER_H
+#define LINGLONG_DBUS_PROXY_SRC_MESSAGE_DBUS_FRAMER_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+// 分帧结果，data指向分帧器内部缓存，下一次reserve/append前有效
+struct DbusFrame {
+    const char *data;
+    int size;
+    // 握手阶段的文本行
+    bool isAuth;
+    // 透传中的部分消息体，不是完整的消息
+    bool isPartial;
+
+    /*
+     * 不拷贝数据，将分帧结果包装为QByteArray
+     *
+     * @return QByteArray: 引用分帧器缓存的字节数组
+     */
+    QByteArray toByteArray() const { return QByteArray::fromRawData(data, size); }
+};
+
+/*
+ * 单个连接方向的流式dbus报文分帧器
+ *
+ * 每次读取的数据追加到可复用的缓存中，不完整的报文保留在缓存中等待后续数据，
+ * 握手阶段按"\r\n"分行，收到BEGIN后切换为按dbus报文头长度分帧。
+ * 报文头已完整的大消息可以透传：调用方取走已收到的部分后，剩余的消息体不再组帧，
+ * 由next逐段取出或由调用方在分帧器之外转发
+ */
+class DbusFramer
+{
+public:
+    enum class Phase {
+        // 握手阶段 按行分帧
+        Auth,
+        // 握手完成 按dbus报文分帧
+        Binary,
+        // 数据不符合协议 连接需要断开
+        Error
+    };
+
+    explicit DbusFramer(Phase phase = Phase::Auth);
+
+    /*
+     * 获取缓存尾部可写入的空间，已返回的分帧结果随之失效
+     *
+     * @param size: 需要写入的字节数
+     *
+     * @return char*: 可写入地址
+     */
+    char *reserve(int size);
+
+    /*
+     * 确认写入reserve返回空间中的字节数
+     *
+     * @param size: 实际写入的字节数
+     */
+    void commit(int size);
+
+    /*
+     * 追加数据到缓存
+     *
+     * @param data: 数据地址
+     * @param size: 数据长度
+     */
+    void append(const char *data, int size);
+
+    /*
+     * 从缓存中取出下一帧完整的消息
+     *
+     * @param frame: 分帧结果
+     *
+     * @return bool: true:取到完整消息 false:数据不足或出错
+     */
+    bool next(DbusFrame *frame);
+
+    /*
+     * 缓存中只有一条不完整的消息且其报文头已完整时，获取该消息已收到的部分，不取出
+     *
+     * @param frame: 报文头及已收到的部分消息体
+     * @param minSize: 消息总长度不小于该值时才返回
+     *
+     * @return bool: true:有满足条件的消息 false:没有
+     */
+    bool peekPartial(DbusFrame *frame, int minSize);
+
+    /*
+     * 取出peekPartial返回的部分消息，消息剩余的字节开始透传
+     */
+    void startPassThrough();
+
+    /*
+     * 获取当前消息还需透传的字节数
+     *
+     * @return qint64: 字节数
+     */
+    qint64 passThroughBytes() const { return passThrough; }
+
+    /*
+     * 记录在分帧器之外转发的透传字节，这些字节不会进入缓存
+     *
+     * @param size: 字节数
+     */
+    void skip(qint64 size) { passThrough -= qMin(size, passThrough); }
+
+    /*
+     * 设置分帧阶段，代理转发客户端BEGIN后用于切换dbus-daemon方向的分帧器
+     *
+     * @param phase: 分帧阶段
+     */
+    void setPhase(Phase phase) { state = phase; }
+
+    Phase phase() const { return state; }
+
+    /*
+     * 获取缓存中尚未组成完整消息的字节数
+     *
+     * @return int: 字节数
+     */
+    int pendingBytes() const { return tail - head; }
+
+    /*
+     * 获取缓存中尚未组成完整消息的数据
+     *
+     * @return const char*: 数据地址
+     */
+    const char *pendingData() const { return buffer.constData() + head; }
+
+    /*
+     * 获取缓存当前的容量
+     *
+     * @return int: 字节数
+     */
+    int capacity() const { return buffer.size(); }
+
+private:
+    bool nextAuthLine(DbusFrame *frame);
+    bool nextMessage(DbusFrame *frame);
+    bool nextPassThrough(DbusFrame *frame);
+
+    /*
+     * 根据报文头固定部分计算消息长度，长度不合法时进入Error阶段
+     *
+     * @param begin: 消息起始地址，至少包含报文头固定部分
+     * @param headerLen: 报文头长度，包含对齐
+     * @param msgLen: 消息总长度
+     *
+     * @return bool: true:成功 false:数据不符合协议
+     */
+    bool messageLength(const char *begin, quint32 *headerLen, quint32 *msgLen);
+
+    Phase state;
+    // 可复用缓存 [head, tail) 为未处理的数据
+    QByteArray buffer;
+    int head;
+    int tail;
+    // 当前消息还需透传的字节数
+    qint64 passThrough;
+};
+#endif
@@ -6,7 +6,12 @@
 
 #include "dbus_message.h"
 
+#include <string.h>
+
 #include <QDebug>
+#include <QtEndian>
+
+#include "dbus_framer.h"
 
 /*
  * 根据大小端将字节数组转化为整形
@@ -36,6 +41,21 @@ int byteAraryToInt(const QByteArray &arr, bool isBigEndian)
     return ret;
 }
 
+/*
+ * 根据大小端读取报文中4字节无符号整形，调用方保证data之后至少有4字节
+ *
+ * @param data: 报文数据地址
+ * @param isBigEndian: 是否为大端序
+ *
+ * @return quint32: 读取结果
+ */
+quint32 readUint32(const char *data, bool isBigEndian)
+{
+    quint32 val;
+    memcpy(&val, data, sizeof(val));
+    return isBigEndian ? qFromBigEndian(val) : qFromLittleEndian(val);
+}
+
 /*
  * 根据偏移量获取8字节对齐结果
  *
@@ -61,143 +81,225 @@ quint32 alignBy4(quint32 offset)
 }
 
 /*
- * 从报文中获取指定偏移量的字符数据
+ * 从报文中获取指定偏移量4字节对齐的整形(类型u)
  *
- * @param buffer: 报文字节数组
- * @param header: 报文header
+ * @param data: 报文数据地址
+ * @param bigEndian: 是否为大端序
  * @param offset: 偏移量开始地址
  * @param endOffset: 偏移量结束地址
+ * @param out: 整形结果
  *
- * @return char*: 计算结果
+ * @return bool: true:成功 false:越界
  */
-char *getString(const QByteArray &buffer, Header *header, quint32 *offset, quint32 endOffset)
+static bool getUint32(const char *data, bool bigEndian, quint32 *offset, quint32 endOffset, quint32 *out)
 {
-    quint8 len;
-    char *str;
-
     *offset = alignBy4(*offset);
-    if (*offset + 4 >= endOffset) {
-        return nullptr;
+    if (*offset > endOffset || endOffset - *offset < 4) {
+        return false;
     }
-
-    auto val = buffer.mid(*offset, 4);
-    len = byteAraryToInt(val, header->bigEndian);
+    *out = readUint32(data + *offset, bigEndian);
     *offset += 4;
+    return true;
+}
 
-    if ((*offset) + len + 1 > endOffset) {
-        return nullptr;
+/*
+ * 从报文中获取指定偏移量的字符串(类型s/o)，结果指向报文数据
+ *
+ * @param data: 报文数据地址
+ * @param bigEndian: 是否为大端序
+ * @param offset: 偏移量开始地址
+ * @param endOffset: 偏移量结束地址
+ * @param out: 字符串结果
+ *
+ * @return bool: true:成功 false:越界或格式错误
+ */
+bool getString(const char *data, bool bigEndian, quint32 *offset, quint32 endOffset, QLatin1String *out)
+{
+    quint32 len = 0;
+    if (!getUint32(data, bigEndian, offset, endOffset, &len)) {
+        return false;
     }
-
-    if (buffer[(*offset) + len] != '\x0') {
-        return nullptr;
+    // 字符串之后必须有'\0'结尾
+    if (len >= endOffset - *offset) {
+        return false;
+    }
+    if (data[*offset + len] != '\x0') {
+        return false;
     }
 
-    auto dataArray = buffer.mid(*offset, len);
-    str = dataArray.data();
+    *out = QLatin1String(data + *offset, len);
     *offset += len + 1;
-
-    return str;
+    return true;
 }
 
 /*
- * 从报文中获取dbus消息域签名信息
+ * 从报文中获取指定偏移量的签名(类型g)，结果指向报文数据
  *
- * @param buffer: 报文字节数组
+ * @param data: 报文数据地址
  * @param offset: 偏移量开始地址
  * @param endOffset: 偏移量结束地址
+ * @param out: 签名结果
  *
- * @return char*: 签名结果
+ * @return bool: true:成功 false:越界或格式错误
  */
-char *getSignature(const QByteArray &buffer, quint32 *offset, quint32 endOffset)
+bool getSignature(const char *data, quint32 *offset, quint32 endOffset, QLatin1String *out)
 {
-    quint8 len;
-    char *str;
-
     if (*offset >= endOffset) {
-        return nullptr;
+        return false;
     }
 
-    len = buffer[*offset];
+    quint32 len = static_cast<uchar>(data[*offset]);
     (*offset)++;
 
-    if ((*offset) + len + 1 > endOffset) {
-        return nullptr;
+    if (len >= endOffset - *offset) {
+        return false;
     }
 
-    if (buffer[(*offset) + len] != '\x0') {
-        return nullptr;
+    if (data[*offset + len] != '\x0') {
+        return false;
     }
 
-    auto val = buffer.mid(*offset, len);
-    str = val.data();
+    *out = QLatin1String(data + *offset, len);
     *offset += len + 1;
+    return true;
+}
 
-    return str;
+/*
+ * 判断报文头字段签名是否为指定的单个类型
+ *
+ * @param signature: 报文头字段签名
+ * @param type: dbus类型
+ *
+ * @return bool: true:是 false:否
+ */
+static bool isSignature(const QLatin1String &signature, char type)
+{
+    return signature.size() == 1 && signature.data()[0] == type;
 }
 
 /*
- * 从报文中解析dbus消息报文头
+ * 跳过未知的报文头字段，只支持基本类型
  *
- * @param buffer: 报文字节数组
- * @param header: 偏移量开始地址
+ * @param data: 报文数据地址
+ * @param bigEndian: 是否为大端序
+ * @param signature: 字段签名
+ * @param offset: 偏移量开始地址
+ * @param endOffset: 偏移量结束地址
  *
- * @return bool: true:解析成功，false:失败
+ * @return bool: true:成功 false:越界或不支持的类型
  */
-bool parseHeader(const QByteArray &buffer, Header *header)
+static bool skipHeaderField(const char *data, bool bigEndian, const QLatin1String &signature, quint32 *offset,
+                            quint32 endOffset)
+{
+    if (signature.size() != 1) {
+        return false;
+    }
+
+    quint32 intVal = 0;
+    QLatin1String strVal;
+    switch (signature.data()[0]) {
+    case 'y':
+        if (*offset >= endOffset) {
+            return false;
+        }
+        (*offset)++;
+        return true;
+    case 'n':
+    case 'q':
+        *offset = (*offset + 1) & ~1u;
+        if (*offset > endOffset || endOffset - *offset < 2) {
+            return false;
+        }
+        *offset += 2;
+        return true;
+    case 'b':
+    case 'i':
+    case 'u':
+    case 'h':
+        return getUint32(data, bigEndian, offset, endOffset, &intVal);
+    case 'x':
+    case 't':
+    case 'd':
+        *offset = alignBy8(*offset);
+        if (*offset > endOffset || endOffset - *offset < 8) {
+            return false;
+        }
+        *offset += 8;
+        return true;
+    case 's':
+    case 'o':
+        return getString(data, bigEndian, offset, endOffset, &strVal);
+    case 'g':
+        return getSignature(data, offset, endOffset, &strVal);
+    default:
+        return false;
+    }
+}
+
+/*
+ * 从报文中解析dbus消息报文头视图，只读取报文头数组，不拷贝数据也不访问消息body
+ *
+ * @param data: 报文数据地址，至少包含完整的报文头数组
+ * @param size: 报文数据长度
+ * @param header: dbus消息报文头视图
+ *
+ * @return bool: true:解析成功 false:失败
+ */
+bool parseHeaderView(const char *data, int size, HeaderView *header)
 {
-    // fix 可以使用libdbus api替换
-    quint32 arrayLen = 0;
-    quint32 headerLen = 0;
-    quint32 offset = 0;
-    quint32 endOffset = 0;
-    quint8 headerType = 0;
-
-    if (buffer.size() < 16) {
+    if (size < 16) {
         return false;
     }
 
     // Major protocol version of the sending application.
-    if (buffer[3] != '\x1') {
+    if (data[3] != '\x1') {
         return false;
     }
 
-    if (buffer[0] == 'B') {
+    if (data[0] == 'B') {
         header->bigEndian = true;
-    } else if (buffer[0] == 'l') {
+    } else if (data[0] == 'l') {
         header->bigEndian = false;
     } else {
         return false;
     }
 
     // Message type 1 2 3 4 分别表示METHOD_CALL METHOD_RETURN ERROR SIGNAL
-    header->type = buffer[1];
+    header->type = data[1];
     // NO_REPLY_EXPECTED  NO_AUTO_START currently receive 0
-    header->flags = buffer[2];
+    header->flags = data[2];
     // Length in bytes of the message body
-    auto lengthArray = buffer.mid(4, 4);
-    header->length = byteAraryToInt(lengthArray, header->bigEndian);
+    header->length = readUint32(data + 4, header->bigEndian);
     // The serial of this message, used as a cookie by the sender to identify the reply corresponding to this request.
-    auto serialArray = buffer.mid(8, 4);
-    header->serial = byteAraryToInt(serialArray, header->bigEndian);
-    qDebug() << QString("parse_header msg header type:%1,flags:%2,length:%3,serial:%4")
-                    .arg(header->type)
-                    .arg(header->flags)
-                    .arg(header->length)
-                    .arg(header->serial);
+    header->serial = readUint32(data + 8, header->bigEndian);
     if (header->serial == 0) {
         return false;
     }
 
-    auto arrLen = buffer.mid(12, 4);
-    arrayLen = byteAraryToInt(arrLen, header->bigEndian);
-
-    headerLen = alignBy8(12 + 4 + arrayLen);
-    if (headerLen > (quint32)buffer.size()) {
+    // 先检查数组长度再计算对齐，避免溢出
+    quint32 arrayLen = readUint32(data + 12, header->bigEndian);
+    if (arrayLen > (quint32)size - 16) {
+        return false;
+    }
+    header->headerLength = alignBy8(12 + 4 + arrayLen);
+    if (header->headerLength > (quint32)size) {
         return false;
     }
 
-    offset = 12 + 4;
-    endOffset = offset + arrayLen;
+    header->path = QLatin1String();
+    header->interface = QLatin1String();
+    header->member = QLatin1String();
+    header->errorName = QLatin1String();
+    header->destination = QLatin1String();
+    header->sender = QLatin1String();
+    header->signature = QLatin1String();
+    header->hasReplySerial = false;
+    header->replySerial = 0;
+    header->unixFds = 0;
+
+    quint32 offset = 12 + 4;
+    quint32 endOffset = offset + arrayLen;
+    bool bigEndian = header->bigEndian;
 
     while (offset < endOffset) {
         // Structs must be 8 byte aligned
@@ -206,13 +308,9 @@ bool parseHeader(const QByteArray &buffer, Header *header)
             return false;
         }
 
-        headerType = buffer[offset++];
-        if (offset >= endOffset) {
-            return false;
-        }
-
-        const char *signature = getSignature(buffer, &offset, endOffset);
-        if (signature == NULL) {
+        quint8 headerType = data[offset++];
+        QLatin1String signature;
+        if (!getSignature(data, &offset, endOffset, &signature)) {
             return false;
         }
         switch (headerType) {
@@ -220,117 +318,80 @@ bool parseHeader(const QByteArray &buffer, Header *header)
             return false;
         }
         case (int)DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_PATH: {
-            if (strcmp(signature, "o") != 0) {
-                return false;
-            }
-            header->path = getString(buffer, header, &offset, endOffset);
-            if (header->path == NULL || header->path.isEmpty()) {
+            if (!isSignature(signature, 'o') || !getString(data, bigEndian, &offset, endOffset, &header->path)
+                || header->path.isEmpty()) {
                 return false;
             }
             break;
         }
         case (int)DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_INTERFACE: {
-            if (strcmp(signature, "s") != 0) {
-                return false;
-            }
-            header->interface = getString(buffer, header, &offset, endOffset);
-            if (header->interface == NULL || header->interface.isEmpty()) {
+            if (!isSignature(signature, 's') || !getString(data, bigEndian, &offset, endOffset, &header->interface)
+                || header->interface.isEmpty()) {
                 return false;
             }
             break;
         }
         case (int)DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_MEMBER: {
-            if (strcmp(signature, "s") != 0) {
-                return false;
-            }
-            header->member = getString(buffer, header, &offset, endOffset);
-            if (header->member == NULL || header->member.isEmpty()) {
+            if (!isSignature(signature, 's') || !getString(data, bigEndian, &offset, endOffset, &header->member)
+                || header->member.isEmpty()) {
                 return false;
             }
             break;
         }
         case (int)DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_ERROR_NAME: {
-            if (strcmp(signature, "s") != 0) {
-                return false;
-            }
-            header->errorName = getString(buffer, header, &offset, endOffset);
-            if (header->errorName == NULL || header->errorName.isEmpty()) {
+            if (!isSignature(signature, 's') || !getString(data, bigEndian, &offset, endOffset, &header->errorName)
+                || header->errorName.isEmpty()) {
                 return false;
             }
             break;
         }
         case (int)DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_REPLY_SERIAL: {
-            if (offset + 4 > endOffset) {
+            if (!isSignature(signature, 'u')
+                || !getUint32(data, bigEndian, &offset, endOffset, &header->replySerial)) {
                 return false;
             }
-
             header->hasReplySerial = true;
-            // replySerialPos = offset;
-            auto val = buffer.mid(offset, 4);
-            header->replySerial = byteAraryToInt(val, header->bigEndian);
-            offset += 4;
             break;
         }
         case (int)DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_DESTINATION: {
-            if (strcmp(signature, "s") != 0) {
-                return false;
-            }
-            header->destination = getString(buffer, header, &offset, endOffset);
-            if (header->destination == NULL || header->destination.isEmpty()) {
+            if (!isSignature(signature, 's') || !getString(data, bigEndian, &offset, endOffset, &header->destination)
+                || header->destination.isEmpty()) {
                 return false;
             }
             break;
         }
-
         case (int)DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_SENDER: {
-            if (strcmp(signature, "s") != 0) {
-                return false;
-            }
-            header->sender = getString(buffer, header, &offset, endOffset);
-            if (header->sender == NULL || header->sender.isEmpty()) {
+            if (!isSignature(signature, 's') || !getString(data, bigEndian, &offset, endOffset, &header->sender)
+                || header->sender.isEmpty()) {
                 return false;
             }
             break;
         }
-
         case (int)DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_SIGNATURE: {
-            if (strcmp(signature, "g") != 0) {
-                return false;
-            }
-            header->signature = getSignature(buffer, &offset, endOffset);
-            if (header->signature == NULL || header->signature.isEmpty()) {
+            if (!isSignature(signature, 'g') || !getSignature(data, &offset, endOffset, &header->signature)
+                || header->signature.isEmpty()) {
                 return false;
             }
             break;
         }
-
         case (int)DBusMessageHeaderField::DBUS_MESSAGE_HEADER_FIELD_NUM_UNIX_FDS: {
-            if (offset + 4 > endOffset) {
+            if (!isSignature(signature, 'u') || !getUint32(data, bigEndian, &offset, endOffset, &header->unixFds)) {
                 return false;
             }
-            auto fdsVal = buffer.mid(offset, 4);
-            header->unixFds = byteAraryToInt(fdsVal, header->bigEndian);
-            offset += 4;
             break;
         }
         default:
-            return false;
+            // 协议要求忽略未知的报文头字段
+            if (!skipHeaderField(data, bigEndian, signature, &offset, endOffset)) {
+                return false;
+            }
+            break;
         }
     }
-    qDebug()
-        << QString(
-               "parseHeader msg serial:%1, reply_serial:%2, hasReplySerial:%3, destination:%4, path:%5, interface:%6, member:%7")
-               .arg(header->serial)
-               .arg(header->replySerial)
-               .arg(header->hasReplySerial)
-               .arg(header->destination)
-               .arg(header->path)
-               .arg(header->interface)
-               .arg(header->member);
 
     switch (header->type) {
     case (int)MessageType::METHOD_CALL:
-        if (header->path == NULL || header->member == NULL) {
+        if (header->path.isEmpty() || header->member.isEmpty()) {
             return false;
         }
         break;
@@ -342,16 +403,17 @@ bool parseHeader(const QByteArray &buffer, Header *header)
         break;
 
     case (int)MessageType::ERROR:
-        if (header->errorName == NULL || !header->hasReplySerial) {
+        if (header->errorName.isEmpty() || !header->hasReplySerial) {
             return false;
         }
         break;
 
     case (int)MessageType::SIGNAL:
-        if (header->path == NULL || header->interface == NULL || header->member == NULL) {
+        if (header->path.isEmpty() || header->interface.isEmpty() || header->member.isEmpty()) {
             return false;
         }
-        if (header->path == "/org/freedesktop/DBus/Local" || header->interface == "org.freedesktop.DBus.Local") {
+        if (header->path == QLatin1String("/org/freedesktop/DBus/Local")
+            || header->interface == QLatin1String("org.freedesktop.DBus.Local")) {
             return false;
         }
         break;
@@ -362,6 +424,49 @@ bool parseHeader(const QByteArray &buffer, Header *header)
     return true;
 }
 
+/*
+ * 从报文中解析dbus消息报文头
+ *
+ * @param buffer: 报文字节数组
+ * @param header: 偏移量开始地址
+ *
+ * @return bool: true:解析成功，false:失败
+ */
+bool parseHeader(const QByteArray &buffer, Header *header)
+{
+    HeaderView view;
+    if (!parseHeaderView(buffer.constData(), buffer.size(), &view)) {
+        return false;
+    }
+
+    header->bigEndian = view.bigEndian;
+    header->type = view.type;
+    header->flags = view.flags;
+    header->length = view.length;
+    header->serial = view.serial;
+    header->path = view.path;
+    header->interface = view.interface;
+    header->member = view.member;
+    header->errorName = view.errorName;
+    header->destination = view.destination;
+    header->sender = view.sender;
+    header->signature = view.signature;
+    header->hasReplySerial = view.hasReplySerial;
+    header->replySerial = view.replySerial;
+    header->unixFds = view.unixFds;
+    qDebug()
+        << QString(
+               "parseHeader msg serial:%1, reply_serial:%2, hasReplySerial:%3, destination:%4, path:%5, interface:%6, member:%7")
+               .arg(header->serial)
+               .arg(header->replySerial)
+               .arg(header->hasReplySerial)
+               .arg(header->destination)
+               .arg(header->path)
+               .arg(header->interface)
+               .arg(header->member);
+    return true;
+}
+
 /*
  * 从报文中解析dbus消息报文头
  *
@@ -406,50 +511,27 @@ bool parseDBusMsg(const QByteArray &byteArray, Header *header)
 }
 
 /*
- * 将报文数组分隔成符合dbus协议标准的dbus消息
+ * 将报文数组分隔成符合dbus协议标准的dbus消息，连接上的流式数据使用DbusFramer分帧
  *
  * @param buffer: 报文字节数组
  * @param out: dbus消息List
  */
 void splitDBusMsg(const QByteArray &buffer, QList<QByteArray> &out)
 {
-    if (buffer.startsWith("BEGIN")) {
-        out.push_back(buffer.left(7));
-        out.push_back(buffer.mid(7));
-        return;
-    }
-
-    // 握手消息
-    if (buffer[0] != 'B' && buffer[0] != 'l') {
-        out.push_back(buffer);
+    if (buffer.isEmpty()) {
         return;
     }
 
-    if (buffer.size() < 16) {
-        out.push_back(buffer);
-        return;
+    // 握手消息按行分隔，BEGIN之后按dbus消息分隔，dbus消息第二个字节为消息类型1~4
+    bool isBinary = buffer.size() > 1 && (buffer[0] == 'B' || buffer[0] == 'l') && buffer[1] >= 1 && buffer[1] <= 4;
+    DbusFramer framer(isBinary ? DbusFramer::Phase::Binary : DbusFramer::Phase::Auth);
+    framer.append(buffer.constData(), buffer.size());
+    DbusFrame frame;
+    while (framer.next(&frame)) {
+        out.push_back(QByteArray(frame.data, frame.size));
     }
-
-    bool bigEndian;
-    if (buffer[0] == 'B') {
-        bigEndian = true;
-    } else {
-        bigEndian = false;
+    // 剩余不完整的数据原样返回
+    if (framer.pendingBytes() > 0) {
+        out.push_back(QByteArray(framer.pendingData(), framer.pendingBytes()));
     }
-
-    QByteArray tmp = buffer;
-    while (true) {
-        // Length in bytes of the message body
-        auto bodyLenArray = tmp.mid(4, 4);
-        auto bodyLen = byteAraryToInt(bodyLenArray, bigEndian);
-        // A UINT32 giving the length of the array data in bytes
-        auto arrLen = tmp.mid(12, 4);
-        int arrayLen = byteAraryToInt(arrLen, bigEndian);
-        int headerLen = alignBy8(12 + 4 + arrayLen);
-        out.push_back(tmp.left(bodyLen + headerLen));
-        if (bodyLen + headerLen >= tmp.size()) {
-            break;
-        }
-        tmp = tmp.mid(bodyLen + headerLen);
-    }
-}
\ No newline at end of file
+}
@@ -9,6 +9,7 @@
 
 #include <dbus/dbus.h>
 
+#include <QLatin1String>
 #include <QString>
 #include <QtGlobal>
 
@@ -31,6 +32,27 @@ typedef struct {
     quint32 unixFds;
 } Header;
 
+// 不拷贝数据的消息报文头视图，字符串字段直接指向报文数据，仅在报文数据有效期间可用
+typedef struct {
+    bool bigEndian;
+    uchar type;
+    uchar flags;
+    quint32 length;
+    quint32 serial;
+    // 8字节对齐后的报文头长度，即消息body的偏移量
+    quint32 headerLength;
+    QLatin1String path;
+    QLatin1String interface;
+    QLatin1String member;
+    QLatin1String errorName;
+    QLatin1String destination;
+    QLatin1String sender;
+    QLatin1String signature;
+    bool hasReplySerial;
+    quint32 replySerial;
+    quint32 unixFds;
+} HeaderView;
+
 enum class MessageType {
     INVALID,
     METHOD_CALL,
@@ -62,6 +84,16 @@ enum class DBusMessageHeaderField {
  */
 int byteAraryToInt(const QByteArray &arr, bool isBigEndian);
 
+/*
+ * 根据大小端读取报文中4字节无符号整形，调用方保证data之后至少有4字节
+ *
+ * @param data: 报文数据地址
+ * @param isBigEndian: 是否为大端序
+ *
+ * @return quint32: 读取结果
+ */
+quint32 readUint32(const char *data, bool isBigEndian);
+
 /*
  * 根据偏移量获取8字节对齐结果
  *
@@ -81,27 +113,40 @@ quint32 alignBy8(quint32 offset);
 quint32 alignBy4(quint32 offset);
 
 /*
- * 从报文中获取指定偏移量的字符数据
+ * 从报文中获取指定偏移量的字符串(类型s/o)，结果指向报文数据
  *
- * @param buffer: 报文字节数组
- * @param header: 报文header
+ * @param data: 报文数据地址
+ * @param bigEndian: 是否为大端序
  * @param offset: 偏移量开始地址
  * @param endOffset: 偏移量结束地址
+ * @param out: 字符串结果
  *
- * @return char*: 计算结果
+ * @return bool: true:成功 false:越界或格式错误
  */
-char *getString(const QByteArray &buffer, Header *header, quint32 *offset, quint32 endOffset);
+bool getString(const char *data, bool bigEndian, quint32 *offset, quint32 endOffset, QLatin1String *out);
 
 /*
- * 从报文中获取dbus消息域签名信息
+ * 从报文中获取指定偏移量的签名(类型g)，结果指向报文数据
  *
- * @param buffer: 报文字节数组
+ * @param data: 报文数据地址
  * @param offset: 偏移量开始地址
  * @param endOffset: 偏移量结束地址
+ * @param out: 签名结果
  *
- * @return char*: 签名结果
+ * @return bool: true:成功 false:越界或格式错误
+ */
+bool getSignature(const char *data, quint32 *offset, quint32 endOffset, QLatin1String *out);
+
+/*
+ * 从报文中解析dbus消息报文头视图，只读取报文头数组，不拷贝数据也不访问消息body
+ *
+ * @param data: 报文数据地址，至少包含完整的报文头数组
+ * @param size: 报文数据长度
+ * @param header: dbus消息报文头视图
+ *
+ * @return bool: true:解析成功 false:失败
  */
-char *getSignature(const QByteArray &buffer, quint32 *offset, quint32 endOffset);
+bool parseHeaderView(const char *data, int size, HeaderView *header);
 
 /*
  * 从报文中解析dbus消息报文头
@@ -124,7 +169,7 @@ bool parseHeader(const QByteArray &buffer, Header *header);
 bool parseDBusMsg(const QByteArray &byteArray, Header *header);
 
 /*
- * 将报文数组分隔成符合dbus协议标准的dbus消息
+ * 将报文数组分隔成符合dbus协议标准的dbus消息，连接上的流式数据使用DbusFramer分帧
  *
  * @param buffer: 报文字节数组
  * @param out: dbus消息List
@@ -0,0 +1,63 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_permission_cache.h"
+
+DbusPermissionCache::DbusPermissionCache(qint64 ttl)
+    : timeout(ttl)
+{
+    clock.start();
+}
+
+/*
+ * 查找缓存的申请结果
+ *
+ * @param appId: 应用appId
+ * @param id: 权限id
+ * @param result: 缓存的申请结果
+ *
+ * @return bool: true:命中 false:未命中或已过期
+ */
+bool DbusPermissionCache::lookup(const QString &appId, const QString &id, int *result)
+{
+    QMutexLocker locker(&mutex);
+    auto it = entries.find(qMakePair(appId, id));
+    if (it == entries.end()) {
+        return false;
+    }
+    if (clock.elapsed() >= it.value().expireTime) {
+        entries.erase(it);
+        return false;
+    }
+    *result = it.value().result;
+    return true;
+}
+
+/*
+ * 缓存申请结果
+ *
+ * @param appId: 应用appId
+ * @param id: 权限id
+ * @param result: 申请结果
+ */
+void DbusPermissionCache::insert(const QString &appId, const QString &id, int result)
+{
+    if (timeout <= 0) {
+        return;
+    }
+    QMutexLocker locker(&mutex);
+    Entry entry = {result, clock.elapsed() + timeout};
+    entries.insert(qMakePair(appId, id), entry);
+}
+
+/*
+ * 清空缓存
+ */
+void DbusPermissionCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    entries.clear();
+}
@@ -0,0 +1,75 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PERMISSION_DBUS_PERMISSION_CACHE_H
+#define LINGLONG_DBUS_PROXY_SRC_PERMISSION_DBUS_PERMISSION_CACHE_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+
+/*
+ * 权限申请结果缓存
+ *
+ * 以(appId, 权限id)为key缓存授权模块返回的结果，超过有效期后重新向授权模块申请。
+ * 用户在权限管理中修改选择后向代理发送SIGUSR1，由DbusProxy::startListenControlSignal监听并清空缓存。
+ * 所有工作线程共用一个缓存，各接口可以在不同线程中调用
+ */
+class DbusPermissionCache
+{
+public:
+    /*
+     * @param ttl: 缓存有效期，单位毫秒，小于等于0时不缓存
+     */
+    explicit DbusPermissionCache(qint64 ttl);
+
+    /*
+     * 查找缓存的申请结果
+     *
+     * @param appId: 应用appId
+     * @param id: 权限id
+     * @param result: 缓存的申请结果
+     *
+     * @return bool: true:命中 false:未命中或已过期
+     */
+    bool lookup(const QString &appId, const QString &id, int *result);
+
+    /*
+     * 缓存申请结果
+     *
+     * @param appId: 应用appId
+     * @param id: 权限id
+     * @param result: 申请结果
+     */
+    void insert(const QString &appId, const QString &id, int result);
+
+    /*
+     * 清空缓存
+     */
+    void clear();
+
+    qint64 ttl() const { return timeout; }
+    int size() const
+    {
+        QMutexLocker locker(&mutex);
+        return entries.size();
+    }
+
+private:
+    struct Entry {
+        int result;
+        // 过期时间，相对于clock启动时刻的毫秒数
+        qint64 expireTime;
+    };
+
+    qint64 timeout;
+    QElapsedTimer clock;
+    mutable QMutex mutex;
+    QHash<QPair<QString, QString>, Entry> entries;
+};
+#endif
@@ -0,0 +1,202 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_permission_map.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include <QMetaObject>
+
+// 未配置权限的dbus信息最多缓存条数
+static const int kMaxMisses = 4096;
+
+DbusPermissionMap::DbusPermissionMap(const QString &path, QObject *parent)
+    : QObject(parent)
+    , configPath(path)
+    , isLoaded(false)
+    , index(new PermissionIndex())
+{
+    connect(&watcher, SIGNAL(fileChanged(QString)), this, SLOT(onFileChanged(QString)));
+    connect(&watcher, SIGNAL(directoryChanged(QString)), this, SLOT(onFileChanged(QString)));
+}
+
+/*
+ * 通过dbus信息获取权限id
+ *
+ * @param name: dbus name
+ * @param path: dbus path
+ * @param ifce: dbus ifce
+ *
+ * @return QString: 权限id，未配置时为空
+ */
+QString DbusPermissionMap::permissionId(const QString &name, const QString &path, const QString &ifce)
+{
+    QByteArray nameData = name.toLatin1();
+    QByteArray pathData = path.toLatin1();
+    QByteArray ifceData = ifce.toLatin1();
+    return permissionId(QLatin1String(nameData), QLatin1String(pathData), QLatin1String(ifceData));
+}
+
+/*
+ * 通过dbus消息报文头中的信息获取权限id，查询过程不分配内存
+ *
+ * @param name: dbus name
+ * @param path: dbus path
+ * @param ifce: dbus ifce
+ *
+ * @return QString: 权限id，未配置时为空
+ */
+QString DbusPermissionMap::permissionId(QLatin1String name, QLatin1String path, QLatin1String ifce)
+{
+    QMutexLocker locker(&mutex);
+    if (!isLoaded) {
+        isLoaded = true;
+        // 在其它线程中查询时由创建映射表的线程添加监听
+        QMetaObject::invokeMethod(this, "watch", Qt::AutoConnection);
+        QSharedPointer<const PermissionIndex> newIndex = parseConfig();
+        if (newIndex) {
+            index = newIndex;
+        }
+    }
+
+    uint hash = permissionKeyHash(name, path, ifce);
+    for (auto it = misses.constFind(hash); it != misses.constEnd() && it.key() == hash; ++it) {
+        if (it.value().isEqual(name, path, ifce)) {
+            return QString();
+        }
+    }
+    const QString *id = find(*index, name, path, ifce);
+    if (id) {
+        return *id;
+    }
+
+    if (misses.size() >= kMaxMisses) {
+        misses.clear();
+    }
+    PermissionKey key = {QByteArray(name.data(), name.size()), QByteArray(path.data(), path.size()),
+                         QByteArray(ifce.data(), ifce.size())};
+    misses.insert(hash, key);
+    qWarning() << "permission id not found "
+               << QString("name:%1,path:%2,interface:%3").arg(QString(name)).arg(QString(path)).arg(QString(ifce));
+    return QString();
+}
+
+/*
+ * 重新加载配置文件，失败时保留原有索引
+ *
+ * @return bool: true:成功 false:失败
+ */
+bool DbusPermissionMap::load()
+{
+    QSharedPointer<const PermissionIndex> newIndex = parseConfig();
+    if (!newIndex) {
+        return false;
+    }
+    // 新索引建立完成后整体替换
+    QMutexLocker locker(&mutex);
+    index = newIndex;
+    misses.clear();
+    return true;
+}
+
+/*
+ * 解析配置文件
+ *
+ * @return PermissionIndex: 新建立的索引，失败时为空
+ */
+QSharedPointer<const DbusPermissionMap::PermissionIndex> DbusPermissionMap::parseConfig()
+{
+    QFile cfgFile(configPath);
+    if (!cfgFile.open(QIODevice::ReadOnly)) {
+        qCritical() << "load permission config err" << cfgFile.errorString();
+        return QSharedPointer<const PermissionIndex>();
+    }
+    QByteArray content = cfgFile.readAll();
+    cfgFile.close();
+    QJsonParseError parseJsonErr;
+    QJsonDocument document = QJsonDocument::fromJson(content, &parseJsonErr);
+    if (QJsonParseError::NoError != parseJsonErr.error) {
+        qCritical() << "load permission config parse config file err";
+        return QSharedPointer<const PermissionIndex>();
+    }
+
+    QSharedPointer<PermissionIndex> newIndex(new PermissionIndex());
+    QJsonObject dataObject = document.object();
+    for (const auto &key : dataObject.keys()) {
+        auto dbusObject = dataObject.value(key);
+        if (!dbusObject.isArray()) {
+            continue;
+        }
+        QJsonArray dbusArray = dbusObject.toArray();
+        for (int i = 0; i < dbusArray.size(); i++) {
+            QJsonObject item = dbusArray.at(i).toObject();
+            PermissionKey permissionKey = {item.value("name").toString().toLatin1(),
+                                           item.value("path").toString().toLatin1(),
+                                           item.value("ifce").toString().toLatin1()};
+            QLatin1String name(permissionKey.name);
+            QLatin1String path(permissionKey.path);
+            QLatin1String ifce(permissionKey.ifce);
+            // 相同的dbus信息配置在多个权限下时按权限id顺序取第一个
+            if (!find(*newIndex, name, path, ifce)) {
+                newIndex->insert(permissionKeyHash(name, path, ifce), qMakePair(permissionKey, key));
+            }
+        }
+    }
+
+    qInfo() << "load permission config:" << configPath << ", size:" << newIndex->size();
+    return newIndex;
+}
+
+/*
+ * 在索引中查找dbus信息对应的权限id
+ *
+ * @param index: 权限索引
+ * @param name: dbus name
+ * @param path: dbus path
+ * @param ifce: dbus ifce
+ *
+ * @return QString: 权限id，未找到时为空指针
+ */
+const QString *DbusPermissionMap::find(const PermissionIndex &index, QLatin1String name, QLatin1String path,
+                                       QLatin1String ifce)
+{
+    uint hash = permissionKeyHash(name, path, ifce);
+    for (auto it = index.constFind(hash); it != index.constEnd() && it.key() == hash; ++it) {
+        if (it.value().first.isEqual(name, path, ifce)) {
+            return &it.value().second;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * 监听配置文件及其所在目录，文件被替换后重新监听
+ */
+void DbusPermissionMap::watch()
+{
+    QFileInfo info(configPath);
+    if (!watcher.directories().contains(info.absolutePath()) && !watcher.addPath(info.absolutePath())) {
+        qWarning() << "watch permission config dir failed:" << info.absolutePath();
+    }
+    if (info.exists() && !watcher.files().contains(configPath)) {
+        watcher.addPath(configPath);
+    }
+}
+
+void DbusPermissionMap::onFileChanged(const QString &path)
+{
+    qDebug() << "permission config changed:" << path;
+    // 文件被替换时原有监听失效
+    watch();
+    if (QFileInfo::exists(configPath)) {
+        load();
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PERMISSION_DBUS_PERMISSION_MAP_H
+#define LINGLONG_DBUS_PROXY_SRC_PERMISSION_DBUS_PERMISSION_MAP_H
+
+#include <QByteArray>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QLatin1String>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QSharedPointer>
+#include <QString>
+
+// 权限映射表的key，dbus name、path、interface只包含ASCII字符，按Latin-1保存，查询时不需要转换为QString
+struct PermissionKey {
+    QByteArray name;
+    QByteArray path;
+    QByteArray ifce;
+
+    bool isEqual(QLatin1String otherName, QLatin1String otherPath, QLatin1String otherIfce) const
+    {
+        return QLatin1String(name) == otherName && QLatin1String(path) == otherPath
+               && QLatin1String(ifce) == otherIfce;
+    }
+};
+
+inline uint permissionKeyHash(QLatin1String name, QLatin1String path, QLatin1String ifce)
+{
+    return qHash(name) ^ qHash(path, 1) ^ qHash(ifce, 2);
+}
+
+/*
+ * dbus信息到权限id的映射表
+ *
+ * 配置文件只在首次查询时加载一次，建立(name, path, ifce)到权限id的哈希索引，
+ * 之后通过QFileSystemWatcher(Linux上基于inotify)监听文件变化，重新加载成功后整体替换索引。
+ * 可以在多个线程中查询，文件监听在创建映射表的线程中处理
+ */
+class DbusPermissionMap : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DbusPermissionMap(const QString &path, QObject *parent = nullptr);
+
+    /*
+     * 通过dbus信息获取权限id
+     *
+     * @param name: dbus name
+     * @param path: dbus path
+     * @param ifce: dbus ifce
+     *
+     * @return QString: 权限id，未配置时为空
+     */
+    QString permissionId(const QString &name, const QString &path, const QString &ifce);
+
+    /*
+     * 通过dbus消息报文头中的信息获取权限id，查询过程不分配内存
+     *
+     * @param name: dbus name
+     * @param path: dbus path
+     * @param ifce: dbus ifce
+     *
+     * @return QString: 权限id，未配置时为空
+     */
+    QString permissionId(QLatin1String name, QLatin1String path, QLatin1String ifce);
+
+    /*
+     * 重新加载配置文件，失败时保留原有索引
+     *
+     * @return bool: true:成功 false:失败
+     */
+    bool load();
+
+private slots:
+    void onFileChanged(const QString &path);
+
+    /*
+     * 监听配置文件及其所在目录，文件被替换后重新监听
+     */
+    void watch();
+
+private:
+    // 以permissionKeyHash为key，哈希冲突的条目逐个比较
+    typedef QMultiHash<uint, QPair<PermissionKey, QString>> PermissionIndex;
+
+    /*
+     * 在索引中查找dbus信息对应的权限id
+     *
+     * @param index: 权限索引
+     * @param name: dbus name
+     * @param path: dbus path
+     * @param ifce: dbus ifce
+     *
+     * @return QString: 权限id，未找到时为空指针
+     */
+    static const QString *find(const PermissionIndex &index, QLatin1String name, QLatin1String path,
+                               QLatin1String ifce);
+
+    /*
+     * 解析配置文件
+     *
+     * @return PermissionIndex: 新建立的索引，失败时为空
+     */
+    QSharedPointer<const PermissionIndex> parseConfig();
+
+    QString configPath;
+    QFileSystemWatcher watcher;
+    // 保护isLoaded、index及misses
+    QMutex mutex;
+    bool isLoaded;
+    QSharedPointer<const PermissionIndex> index;
+    // 未配置权限的dbus信息，以permissionKeyHash为key
+    QMultiHash<uint, PermissionKey> misses;
+};
+#endif
@@ -0,0 +1,103 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_buffer_pool.h"
+
+// 各级缓存的容量
+static const int kSizeClasses[] = {256, 1024, 4096, 16384};
+// 每一级最多保留的空闲缓存数
+static const int kMaxFreeBuffers = 4;
+
+DbusBufferPool::DbusBufferPool()
+    : allocationCount(0)
+{
+}
+
+/*
+ * 获取容量对应的级别
+ *
+ * @param size: 容量
+ *
+ * @return int: 级别，超过最大一级时为-1
+ */
+int DbusBufferPool::sizeClass(int size)
+{
+    for (int i = 0; i < kSizeClassCount; i++) {
+        if (size <= kSizeClasses[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * 申请一块长度为0的缓存
+ *
+ * @param size: 需要的容量
+ *
+ * @return QByteArray: 容量不小于size的缓存
+ */
+QByteArray DbusBufferPool::acquire(int size)
+{
+    QByteArray buffer;
+    int index = sizeClass(size);
+    if (index >= 0 && !freeBuffers[index].isEmpty()) {
+        // 交换而不是拷贝，不增加引用计数
+        buffer.swap(freeBuffers[index].last());
+        freeBuffers[index].removeLast();
+        return buffer;
+    }
+    // reserve后缓存长度变为0时保留容量
+    buffer.reserve(index >= 0 ? kSizeClasses[index] : size);
+    allocationCount++;
+    return buffer;
+}
+
+/*
+ * 归还缓存，被其它对象引用或容量不属于任何一级的缓存直接释放
+ *
+ * @param buffer: 归还的缓存，归还后为空
+ */
+void DbusBufferPool::release(QByteArray *buffer)
+{
+    // 按实际容量归入不超过该容量的最大一级
+    int index = -1;
+    for (int i = 0; i < kSizeClassCount && kSizeClasses[i] <= buffer->capacity(); i++) {
+        index = i;
+    }
+    if (index < 0 || buffer->capacity() > kSizeClasses[kSizeClassCount - 1] || !buffer->isDetached()
+        || freeBuffers[index].size() >= kMaxFreeBuffers) {
+        *buffer = QByteArray();
+        return;
+    }
+    buffer->resize(0);
+    freeBuffers[index].append(QByteArray());
+    freeBuffers[index].last().swap(*buffer);
+}
+
+/*
+ * 释放所有空闲缓存
+ */
+void DbusBufferPool::clear()
+{
+    for (int i = 0; i < kSizeClassCount; i++) {
+        freeBuffers[i].clear();
+    }
+}
+
+/*
+ * 获取空闲缓存数
+ *
+ * @return int: 空闲缓存数
+ */
+int DbusBufferPool::freeCount() const
+{
+    int count = 0;
+    for (int i = 0; i < kSizeClassCount; i++) {
+        count += freeBuffers[i].size();
+    }
+    return count;
+}
@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_BUFFER_POOL_H
+#define LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_BUFFER_POOL_H
+
+#include <QByteArray>
+#include <QVector>
+
+/*
+ * 单个连接的报文缓存池
+ *
+ * 按容量分为256B/1KiB/4KiB/16KiB四级，大部分dbus消息不超过1KiB。
+ * 归还的缓存保留容量，下次申请同级缓存时直接复用，不再分配内存；
+ * 超过最大一级的缓存不复用，连接释放时缓存池随之整体释放。
+ * 只在连接所属的线程中使用
+ */
+class DbusBufferPool
+{
+public:
+    DbusBufferPool();
+
+    /*
+     * 申请一块长度为0的缓存
+     *
+     * @param size: 需要的容量
+     *
+     * @return QByteArray: 容量不小于size的缓存
+     */
+    QByteArray acquire(int size);
+
+    /*
+     * 归还缓存，被其它对象引用或容量不属于任何一级的缓存直接释放
+     *
+     * @param buffer: 归还的缓存，归还后为空
+     */
+    void release(QByteArray *buffer);
+
+    /*
+     * 释放所有空闲缓存
+     */
+    void clear();
+
+    /*
+     * 获取空闲缓存数
+     *
+     * @return int: 空闲缓存数
+     */
+    int freeCount() const;
+
+    // 因没有空闲缓存而分配内存的次数
+    quint64 allocations() const { return allocationCount; }
+
+private:
+    /*
+     * 获取容量对应的级别
+     *
+     * @param size: 容量
+     *
+     * @return int: 级别，超过最大一级时为-1
+     */
+    static int sizeClass(int size);
+
+    static const int kSizeClassCount = 4;
+    QVector<QByteArray> freeBuffers[kSizeClassCount];
+    quint64 allocationCount;
+};
+#endif
@@ -0,0 +1,136 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_CONNECTION_PAIR_H
+#define LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_CONNECTION_PAIR_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+
+#include "engine/dbus_endpoint.h"
+#include "message/dbus_framer.h"
+#include "proxy/dbus_buffer_pool.h"
+#include "proxy/dbus_policy_stage.h"
+#include "proxy/dbus_session.h"
+#include "proxy/dbus_write_batch.h"
+
+/*
+ * 客户端连接及代理与dbus-daemon的连接组成的一对连接
+ *
+ * 两端socket的context都直接指向该对象，读写事件中不需要查表，与该对连接相关的状态都保存在这里
+ */
+struct DbusConnectionPair {
+    /*
+     * @param client: 客户端连接
+     * @param daemon: 代理与dbus-daemon的连接
+     */
+    DbusConnectionPair(DbusEndpoint *client, DbusEndpoint *daemon)
+        : boxClient(client)
+        , proxyClient(daemon)
+        , isDaemonConnected(false)
+        , hasEarlyData(false)
+        , isClientPaused(false)
+        , isDaemonPaused(false)
+        , clientFramer(DbusFramer::Phase::Auth)
+        , daemonFramer(DbusFramer::Phase::Auth)
+        , isStreamBroken(false)
+        , heldUnsubmitted(0)
+        , clientMessages(0)
+        , daemonMessages(0)
+    {
+    }
+
+    /*
+     * 读取指定socket是否已暂停
+     *
+     * @param socket: 该对连接中的一端
+     *
+     * @return bool: true:已暂停 false:未暂停
+     */
+    bool isPaused(const DbusEndpoint *socket) const
+    {
+        return socket == boxClient ? isClientPaused : isDaemonPaused;
+    }
+
+    /*
+     * 暂停或恢复读取指定socket
+     *
+     * @param socket: 该对连接中的一端
+     * @param paused: true:暂停 false:恢复
+     *
+     * @return bool: 之前是否已暂停
+     */
+    bool setPaused(const DbusEndpoint *socket, bool paused)
+    {
+        bool &flag = socket == boxClient ? isClientPaused : isDaemonPaused;
+        bool old = flag;
+        flag = paused;
+        return old;
+    }
+
+    /*
+     * 暂停读取的socket是否可以恢复读取
+     * 客户端的消息转发给dbus-daemon，被拒绝时由代理向客户端回复错误，两个目标都不超过低水位才恢复读取客户端；
+     * dbus-daemon的消息只写入客户端
+     *
+     * @param socket: 该对连接中的一端
+     * @param lowWatermark: 恢复读取的低水位
+     *
+     * @return bool: true:可以恢复 false:继续暂停
+     */
+    bool canResume(const DbusEndpoint *socket, qint64 lowWatermark) const
+    {
+        if (boxClient->bytesToWrite() > lowWatermark) {
+            return false;
+        }
+        return socket != boxClient || proxyClient->bytesToWrite() <= lowWatermark;
+    }
+
+    /*
+     * 等待队列中已交给策略线程且还未处理的消息数
+     *
+     * @return int: 判定结果未返回及已返回未处理的消息数
+     */
+    int policySubmitted() const { return policyTickets.size() + policyVerdicts.size(); }
+
+    DbusEndpoint *boxClient;
+    DbusEndpoint *proxyClient;
+    // 代理是否已连接上dbus-daemon
+    bool isDaemonConnected;
+    // 开始连接dbus-daemon的时间，用于连接超时检查
+    QElapsedTimer connectTime;
+    // 连接dbus-daemon期间客户端发来的数据缓存在clientFramer中，连接完成后处理
+    bool hasEarlyData;
+    // 因对端待写数据过多而暂停读取
+    bool isClientPaused;
+    bool isDaemonPaused;
+    // 两个方向的分帧器，均从握手阶段开始
+    DbusFramer clientFramer;
+    DbusFramer daemonFramer;
+    // 两个方向每次读取的转发集合，清空后保留空间，不在每次读取时重新分配
+    DbusWriteBatch clientBatch;
+    DbusWriteBatch daemonBatch;
+    // 需要拷贝的报文(未发送完的数据、等待权限申请结果的消息)使用的缓存，随连接对一起释放
+    DbusBufferPool bufferPool;
+    // 消息需要的文件描述符不足，之后的消息无法对应文件描述符，不再转发并断开连接
+    bool isStreamBroken;
+    // 等待权限申请结果或策略线程判定的客户端消息，队首为等待结果的消息
+    QList<QByteArray> holdQueue;
+    // 等待队列由三段组成：队首起未交给策略线程的消息，到达队首时在I/O线程中判定；
+    // 按顺序交给策略线程的消息；通道已满时未能提交的消息，之前的消息处理完后同样在I/O线程中判定
+    int heldUnsubmitted;
+    // 已提交消息中判定结果未返回的提交编号，按提交顺序
+    QList<quint64> policyTickets;
+    // 已返回但对应消息还未到达队首的判定结果，按提交顺序
+    QList<DbusPolicyVerdict> policyVerdicts;
+    // 握手进度、协商特性及unique name
+    DbusSession session;
+    // 两个方向转发的消息数
+    quint64 clientMessages;
+    quint64 daemonMessages;
+};
+#endif
@@ -0,0 +1,124 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_policy_stage.h"
+
+#include "proxy/dbus_proxy.h"
+
+DbusPolicyStage::DbusPolicyStage(const DbusFilter *rules, bool isIntercepting,
+                                 const QSharedPointer<DbusPermissionMap> &permissionMap,
+                                 const QSharedPointer<DbusPermissionCache> &permissionCache, const QString &appId,
+                                 QObject *parent)
+    : QThread(parent)
+    , rules(rules)
+    , isIntercepting(isIntercepting)
+    , permissionMap(permissionMap)
+    , permissionCache(permissionCache)
+    , appId(appId)
+    , isStopping(false)
+{
+}
+
+DbusPolicyStage::~DbusPolicyStage()
+{
+    stop();
+}
+
+/*
+ * 通知策略线程退出并等待，未处理的请求不再判定
+ */
+void DbusPolicyStage::stop()
+{
+    isStopping.store(true);
+    wakeup.release();
+    wait();
+}
+
+/*
+ * 为I/O线程中的代理创建通道，只能在策略线程启动前调用
+ *
+ * @param proxy: I/O线程中的代理
+ * @param capacity: 通道队列容量
+ *
+ * @return DbusPolicyLane: 新通道，归调用方所有
+ */
+DbusPolicyLane *DbusPolicyStage::addLane(DbusProxy *proxy, int capacity)
+{
+    DbusPolicyLane *lane = new DbusPolicyLane(this, proxy, capacity);
+    lanes.append(lane);
+    return lane;
+}
+
+/*
+ * 提交一条消息，只能在通道所属的I/O线程调用
+ *
+ * @param lane: 通道
+ * @param request: 请求，提交成功后不再使用
+ *
+ * @return bool: true:已提交 false:通道已满，请求保持不变
+ */
+bool DbusPolicyStage::submit(DbusPolicyLane *lane, DbusPolicyRequest *request)
+{
+    // 判定结果未取回的请求也占用容量，保证判定结果队列不会满
+    if (lane->isFull() || !lane->requests.push(std::move(*request))) {
+        return false;
+    }
+    lane->inflight++;
+    wakeup.release();
+    return true;
+}
+
+/*
+ * 判定一条消息
+ *
+ * @param request: 请求，其中的消息引用移入判定结果
+ * @param verdict: 判定结果
+ */
+void DbusPolicyStage::evaluate(DbusPolicyRequest *request, DbusPolicyVerdict *verdict)
+{
+    const HeaderView &header = request->header;
+    verdict->pair = request->pair;
+    verdict->ticket = request->ticket;
+    verdict->header = header;
+    verdict->generation = rules->generation();
+    verdict->isMatch = rules->isMessageMatch(header.destination, header.path, header.interface);
+    verdict->permissionId = QString();
+    verdict->hasResult = false;
+    verdict->result = -1;
+    if (verdict->isMatch && isIntercepting) {
+        verdict->permissionId = permissionMap->permissionId(header.destination, header.path, header.interface);
+        verdict->hasResult = !verdict->permissionId.isEmpty()
+            && permissionCache->lookup(appId, verdict->permissionId, &verdict->result);
+    }
+    qSwap(verdict->message, request->message);
+}
+
+void DbusPolicyStage::run()
+{
+    DbusPolicyRequest request;
+    DbusPolicyVerdict verdict;
+    while (true) {
+        // 一次唤醒处理所有已提交的请求，合并之后的唤醒计数
+        wakeup.acquire();
+        wakeup.tryAcquire(wakeup.available());
+        if (isStopping.load()) {
+            return;
+        }
+        for (DbusPolicyLane *lane : lanes) {
+            bool hasVerdict = false;
+            while (lane->requests.pop(&request)) {
+                evaluate(&request, &verdict);
+                // 未取回的请求数不超过容量，判定结果队列不会满
+                lane->verdicts.push(std::move(verdict));
+                hasVerdict = true;
+            }
+            // 只在没有安排处理时通知I/O线程，之后返回的判定结果在同一次处理中取出
+            if (hasVerdict && !lane->isNotifyScheduled.exchange(true)) {
+                QMetaObject::invokeMethod(lane->proxy, "onPolicyVerdicts", Qt::QueuedConnection);
+            }
+        }
+    }
+}
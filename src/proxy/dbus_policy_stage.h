@@ -0,0 +1,174 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_POLICY_STAGE_H
+#define LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_POLICY_STAGE_H
+
+#include <atomic>
+
+#include <QByteArray>
+#include <QList>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThread>
+
+#include "filter/dbus_filter.h"
+#include "message/dbus_message.h"
+#include "permission/dbus_permission_cache.h"
+#include "permission/dbus_permission_map.h"
+#include "proxy/dbus_spsc_queue.h"
+
+class DbusPolicyStage;
+class DbusProxy;
+struct DbusConnectionPair;
+
+// I/O线程交给策略线程判定的一条客户端消息
+struct DbusPolicyRequest {
+    // 消息所属的连接对，只用于返回给I/O线程，策略线程不访问
+    DbusConnectionPair *pair;
+    // 提交编号，判定返回时用于确认连接对仍在等待该判定
+    quint64 ticket;
+    // 等待队列中消息的共享拷贝，保证报文头视图引用的数据有效
+    QByteArray message;
+    HeaderView header;
+};
+
+// 策略线程返回给I/O线程的判定结果
+struct DbusPolicyVerdict {
+    DbusConnectionPair *pair;
+    quint64 ticket;
+    // 请求中的消息引用随判定结果带回，由I/O线程释放，策略线程不再持有
+    QByteArray message;
+    HeaderView header;
+    // 判定时过滤规则的版本
+    quint64 generation;
+    // 是否匹配过滤规则
+    bool isMatch;
+    // 匹配且开启拦截时消息对应的权限id，为空表示未配置权限
+    QString permissionId;
+    // 权限申请结果缓存中是否已有结果及其值
+    bool hasResult;
+    int result;
+};
+
+/*
+ * 一个I/O线程与策略线程之间的一对单生产者单消费者队列
+ *
+ * 由I/O线程中的代理所有，代理需要在策略线程退出后再释放
+ */
+struct DbusPolicyLane {
+    /*
+     * @param stage: 处理该通道的策略线程
+     * @param proxy: I/O线程中的代理，判定结果通过其onPolicyVerdicts处理
+     * @param capacity: 两个队列的容量
+     */
+    DbusPolicyLane(DbusPolicyStage *stage, DbusProxy *proxy, int capacity)
+        : stage(stage)
+        , proxy(proxy)
+        , requests(capacity)
+        , verdicts(capacity)
+        , isNotifyScheduled(false)
+        , inflight(0)
+    {
+    }
+
+    /*
+     * 未取回的请求是否已达到队列容量，此时不能再提交，只能在I/O线程调用
+     *
+     * @return bool: true:已满 false:可以提交
+     */
+    bool isFull() const { return inflight >= requests.capacity(); }
+
+    // 队列的读写位置按缓存行对齐，C++11的new不保证扩展对齐
+    static void *operator new(size_t size) { return qMallocAligned(size, alignof(DbusPolicyLane)); }
+    static void operator delete(void *ptr) { qFreeAligned(ptr); }
+
+    DbusPolicyStage *stage;
+    DbusProxy *proxy;
+    // I/O线程 -> 策略线程
+    DbusSpscQueue<DbusPolicyRequest> requests;
+    // 策略线程 -> I/O线程
+    DbusSpscQueue<DbusPolicyVerdict> verdicts;
+    // 是否已安排I/O线程处理判定结果
+    std::atomic<bool> isNotifyScheduled;
+    // 已提交但判定结果未取回的请求数，只在I/O线程访问，不超过队列容量，判定结果队列不会满
+    int inflight;
+};
+
+/*
+ * 策略线程
+ *
+ * I/O线程只负责socket读写及分帧，过滤规则匹配及权限查询较慢的消息通过各自的通道交给策略线程，
+ * 判定结果再通过通道返回，判定期间I/O线程继续处理其它连接。一个策略线程可以服务多个I/O线程
+ */
+class DbusPolicyStage : public QThread
+{
+    Q_OBJECT
+
+public:
+    /*
+     * @param rules: 过滤规则，策略线程启动后只读
+     * @param isIntercepting: 匹配过滤规则的消息是否需要查询权限
+     * @param permissionMap: dbus信息到权限id的映射表
+     * @param permissionCache: 权限申请结果缓存
+     * @param appId: 应用appId
+     * @param parent: 父对象
+     */
+    DbusPolicyStage(const DbusFilter *rules, bool isIntercepting,
+                    const QSharedPointer<DbusPermissionMap> &permissionMap,
+                    const QSharedPointer<DbusPermissionCache> &permissionCache, const QString &appId,
+                    QObject *parent = nullptr);
+    ~DbusPolicyStage() override;
+
+    /*
+     * 通知策略线程退出并等待，未处理的请求不再判定
+     */
+    void stop();
+
+    /*
+     * 为I/O线程中的代理创建通道，只能在策略线程启动前调用
+     *
+     * @param proxy: I/O线程中的代理
+     * @param capacity: 通道队列容量
+     *
+     * @return DbusPolicyLane: 新通道，归调用方所有
+     */
+    DbusPolicyLane *addLane(DbusProxy *proxy, int capacity);
+
+    /*
+     * 提交一条消息，只能在通道所属的I/O线程调用
+     *
+     * @param lane: 通道
+     * @param request: 请求，提交成功后不再使用
+     *
+     * @return bool: true:已提交 false:通道已满，请求保持不变
+     */
+    bool submit(DbusPolicyLane *lane, DbusPolicyRequest *request);
+
+    /*
+     * 判定一条消息
+     *
+     * @param request: 请求，其中的消息引用移入判定结果
+     * @param verdict: 判定结果
+     */
+    void evaluate(DbusPolicyRequest *request, DbusPolicyVerdict *verdict);
+
+protected:
+    void run() override;
+
+private:
+    const DbusFilter *rules;
+    bool isIntercepting;
+    QSharedPointer<DbusPermissionMap> permissionMap;
+    QSharedPointer<DbusPermissionCache> permissionCache;
+    QString appId;
+    // 服务的通道，启动后不再变化
+    QList<DbusPolicyLane *> lanes;
+    // 提交请求或退出时唤醒
+    QSemaphore wakeup;
+    std::atomic<bool> isStopping;
+};
+#endif
@@ -6,19 +6,91 @@
 
 #include "dbus_proxy.h"
 
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <QDBusConnection>
-#include <QDBusInterface>
-#include <QDBusReply>
+#include <QDBusMessage>
+#include <QDBusPendingReply>
 #include <QFileInfo>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QJsonArray>
+#include <QLoggingCategory>
+#include <QThread>
 
-DbusProxy::DbusProxy()
-    : serverProxy(new QLocalServer())
+#include "proxy/dbus_proxy_worker.h"
+
+// 每次从socket读取的最大字节数，读入分帧器的可复用缓存
+static const int kReadSize = 64 * 1024;
+// 每个工作线程待接管客户端连接的队列容量
+static const int kPendingClientsSize = 256;
+// 每个代理与策略线程之间通道的队列容量，未取回的判定超过容量时在I/O线程中直接判定
+static const int kPolicyLaneSize = 256;
+// 连接dbus-daemon的超时时间及检查间隔，单位毫秒
+static const int kConnectTimeout = 3000;
+static const int kConnectCheckInterval = 1000;
+// 客户端断开后发送剩余数据给dbus-daemon的最长时间，单位毫秒
+static const int kCloseTimeout = 3000;
+// 连接dbus-daemon期间最多缓存的客户端数据，超出部分留在socket中
+static const int kMaxEarlyDataSize = 64 * 1024;
+// 代理拒绝握手命令时的回复
+static const char kAuthError[] = "ERROR\r\n";
+
+// 逐条消息的转发日志默认关闭，qDebug即使被过滤也会为每条日志分配内存
+// 可通过QT_LOGGING_RULES="linglong.dbus.proxy.message.debug=true"开启
+Q_LOGGING_CATEGORY(messageLog, "linglong.dbus.proxy.message", QtInfoMsg)
+
+DbusProxy::DbusProxy(DbusProxy *owner)
+    : verdictCache(qEnvironmentVariableIntValue("DBUS_PROXY_VERDICT_CACHE_SIZE") > 0
+                       ? qEnvironmentVariableIntValue("DBUS_PROXY_VERDICT_CACHE_SIZE")
+                       : 1024)
+    , owner(owner)
+    , rules(owner ? &owner->filter : &filter)
+    , engine(DbusEngine::create(qgetenv("DBUS_PROXY_ENGINE")))
+    , serverProxy(owner ? nullptr : engine->createListener())
+    , daemonPath(owner ? owner->daemonPath : QString())
+    , appId(owner ? owner->appId : QString())
+    , isIntercepting(qEnvironmentVariableIsSet("DBUS_PROXY_INTERCEPT"))
+    , permissionMap(owner ? owner->permissionMap
+                          : QSharedPointer<DbusPermissionMap>(
+                              new DbusPermissionMap("/usr/share/permission/policy/linglong/dbus_map_config")))
+    , permissionCache(owner ? owner->permissionCache
+                            : QSharedPointer<DbusPermissionCache>(new DbusPermissionCache(
+                                (qEnvironmentVariableIsSet("DBUS_PROXY_PERMISSION_TTL")
+                                     ? qEnvironmentVariableIntValue("DBUS_PROXY_PERMISSION_TTL")
+                                     : 30)
+                                * 1000)))
+    , highWatermark(qEnvironmentVariableIntValue("DBUS_PROXY_HIGH_WATERMARK") > 0
+                        ? qEnvironmentVariableIntValue("DBUS_PROXY_HIGH_WATERMARK")
+                        : 4 * 1024 * 1024)
+    , lowWatermark(qEnvironmentVariableIntValue("DBUS_PROXY_LOW_WATERMARK") > 0
+                       ? qMin<qint64>(qEnvironmentVariableIntValue("DBUS_PROXY_LOW_WATERMARK"), highWatermark)
+                       : highWatermark / 4)
+    , spliceThreshold(qEnvironmentVariableIsSet("DBUS_PROXY_SPLICE_THRESHOLD")
+                          ? qEnvironmentVariableIntValue("DBUS_PROXY_SPLICE_THRESHOLD")
+                          : 64 * 1024)
+    , workerCount(qEnvironmentVariableIsSet("DBUS_PROXY_WORKERS") ? qEnvironmentVariableIntValue("DBUS_PROXY_WORKERS")
+                                                                  : QThread::idealThreadCount())
+    , nextWorker(0)
+    , pendingClients(kPendingClientsSize)
+    , isAdoptScheduled(false)
+    , policyThreads(qEnvironmentVariableIntValue("DBUS_PROXY_POLICY_THREADS"))
+    , nextPolicyStage(0)
+    , nextPolicyTicket(1)
+    , heldMessages(0)
+    , heldMessagesPeak(0)
+    , writeBacklogPeak(0)
+    , accessDenied("org.freedesktop.DBus.Error.AccessDenied",
+                   "org.freedesktop.DBus.Error.AccessDenied, please config permission first!")
 {
+    qInfo() << "dbus proxy engine:" << engine->name();
+    connectTimer.setInterval(kConnectCheckInterval);
+    connect(&connectTimer, SIGNAL(timeout()), this, SLOT(onConnectTimeout()));
+    // 工作线程中的代理只处理分配来的连接，权限状态由主线程中的代理维护
+    if (owner) {
+        policyLane.reset(owner->attachPolicyLane(this));
+        return;
+    }
     connect(serverProxy.get(), SIGNAL(newConnection()), this, SLOT(onNewConnection()));
 }
 
@@ -27,13 +99,26 @@ DbusProxy::~DbusProxy()
     if (serverProxy) {
         serverProxy->close();
     }
+    // 策略线程先退出，不再通知各代理；通道归各代理所有，工作线程退出后再释放策略线程
+    for (DbusPolicyStage *stage : policyStages) {
+        stage->stop();
+    }
+    // 工作线程中的代理共用当前代理的过滤规则，需要先于当前代理退出
+    qDeleteAll(workers);
+    workers.clear();
+    qDeleteAll(policyStages);
+    policyStages.clear();
 
-    for (const auto &client : relations.keys()) {
-        if (relations[client]) {
-            delete relations[client];
-            client->close();
-        }
+    for (DbusConnectionPair *pair : pairs) {
+        // 析构过程中不再处理连接断开的回调
+        pair->boxClient->disconnect(this);
+        pair->proxyClient->disconnect(this);
+        delete pair->proxyClient;
+        pair->boxClient->disconnectFromServer();
+        delete pair->boxClient;
+        delete pair;
     }
+    pairs.clear();
 }
 
 /*
@@ -45,15 +130,16 @@ DbusProxy::~DbusProxy()
  */
 bool DbusProxy::startListenBoxClient(const QString &socketPath)
 {
-    if (socketPath.isEmpty()) {
+    if (socketPath.isEmpty() || !serverProxy) {
         qCritical() << "socketPath not exist";
         return false;
     }
-    QLocalServer::removeServer(socketPath);
-    serverProxy->setSocketOptions(QLocalServer::UserAccessOption);
+    createPolicyStages();
+    startWorkers();
+    startPolicyStages();
     bool ret = serverProxy->listen(socketPath);
     if (!ret) {
-        qCritical() << "listen box dbus client error";
+        qCritical() << "listen box dbus client error:" << serverProxy->errorString();
         return false;
     }
     qDebug() << "startListenBoxClient ret:" << ret;
@@ -68,7 +154,7 @@ bool DbusProxy::startListenBoxClient(const QString &socketPath)
  *
  * @return bool: true:成功 其它:失败
  */
-bool DbusProxy::startConnectDbusDaemon(QLocalSocket *localProxy, const QString &daemonPath)
+bool DbusProxy::startConnectDbusDaemon(DbusEndpoint *localProxy, const QString &daemonPath)
 {
     if (daemonPath.isEmpty()) {
         qCritical() << "daemonPath is empty";
@@ -76,255 +162,1204 @@ bool DbusProxy::startConnectDbusDaemon(QLocalSocket *localProxy, const QString &
     }
     // bind clientProxy to dbus daemon
     connect(localProxy, SIGNAL(connected()), this, SLOT(onConnectedServer()));
+    connect(localProxy, SIGNAL(connectFailed()), this, SLOT(onConnectFailedServer()));
     connect(localProxy, SIGNAL(disconnected()), this, SLOT(onDisconnectedServer()));
     connect(localProxy, SIGNAL(readyRead()), this, SLOT(onReadyReadServer()));
+    connect(localProxy, SIGNAL(bytesWritten(qint64)), this, SLOT(onBytesWritten()));
     qDebug() << "proxy client:" << localProxy << " start connect dbus-daemon...";
+    // 不等待连接完成，dbus-daemon接受连接较慢时不阻塞其它客户端，连接结果可能在返回前同步回调
     localProxy->connectToServer(daemonPath);
-    // 等待代理连接dbus-daemon
-    if (!localProxy->waitForConnected(3000)) {
-        qCritical() << "connect dbus-daemon error, msg:" << localProxy->errorString();
+    return true;
+}
+
+/*
+ * 启动工作线程
+ */
+void DbusProxy::startWorkers()
+{
+    if (workerCount <= 1 || !workers.isEmpty()) {
+        return;
+    }
+    for (int i = 0; i < workerCount; i++) {
+        DbusProxyWorker *worker = new DbusProxyWorker(this);
+        worker->startWorker();
+        workers.append(worker);
+    }
+    qInfo() << "dbus proxy workers:" << workers.size();
+}
+
+/*
+ * 创建策略线程，需要在工作线程之前创建，工作线程中的代理创建时从中分配通道
+ */
+void DbusProxy::createPolicyStages()
+{
+    if (policyThreads <= 0 || !policyStages.isEmpty()) {
+        return;
+    }
+    for (int i = 0; i < policyThreads; i++) {
+        policyStages.append(new DbusPolicyStage(rules, isIntercepting, permissionMap, permissionCache, appId));
+    }
+}
+
+/*
+ * 启动策略线程，没有工作线程时当前代理处理连接，先为自己分配通道
+ */
+void DbusProxy::startPolicyStages()
+{
+    if (policyStages.isEmpty() || policyStages.first()->isRunning()) {
+        return;
+    }
+    if (workers.isEmpty()) {
+        policyLane.reset(attachPolicyLane(this));
+    }
+    for (DbusPolicyStage *stage : policyStages) {
+        stage->start();
+    }
+    qInfo() << "dbus proxy policy threads:" << policyStages.size();
+}
+
+/*
+ * 为处理连接的代理分配策略线程通道，依次分配给各策略线程，只能在策略线程启动前调用
+ *
+ * @param proxy: 处理连接的代理
+ *
+ * @return DbusPolicyLane: 新通道，归proxy所有，未配置策略线程时为空
+ */
+DbusPolicyLane *DbusProxy::attachPolicyLane(DbusProxy *proxy)
+{
+    if (policyStages.isEmpty()) {
+        return nullptr;
+    }
+    DbusPolicyStage *stage = policyStages[nextPolicyStage];
+    nextPolicyStage = (nextPolicyStage + 1) % policyStages.size();
+    return stage->addLane(proxy, kPolicyLaneSize);
+}
+
+/*
+ * 将等待队列中的消息交给策略线程判定，判定结果按提交顺序在onPolicyVerdicts中处理
+ *
+ * @param pair: 连接对
+ * @param message: 等待队列中的消息
+ *
+ * @return bool: true:已提交 false:通道已满
+ */
+bool DbusProxy::submitPolicy(DbusConnectionPair *pair, const QByteArray &message)
+{
+    quint64 ticket = nextPolicyTicket;
+    DbusPolicyRequest request;
+    request.pair = pair;
+    request.ticket = ticket;
+    request.message = message;
+    request.header.unixFds = 0;
+    parseHeaderView(request.message.constData(), request.message.size(), &request.header);
+    if (!policyLane->stage->submit(policyLane.data(), &request)) {
         return false;
     }
-    qDebug() << "startConnectDbusDaemon done";
+    nextPolicyTicket++;
+    pair->policyTickets.append(ticket);
     return true;
 }
 
+void DbusProxy::onPolicyVerdicts()
+{
+    // 先清除标记再取出，处理期间返回的判定结果会重新安排
+    policyLane->isNotifyScheduled.store(false);
+    DbusPolicyVerdict verdict;
+    while (policyLane->verdicts.pop(&verdict)) {
+        policyLane->inflight--;
+        DbusConnectionPair *pair = verdict.pair;
+        // 连接已断开时丢弃，连接对的地址可能已被新连接复用，需同时比较提交编号
+        if (!pairs.contains(pair) || pair->policyTickets.isEmpty() || pair->policyTickets.first() != verdict.ticket) {
+            verdict.message = QByteArray();
+            continue;
+        }
+        pair->policyTickets.removeFirst();
+        verdictCache.insert(verdict.generation, verdict.header.destination, verdict.header.path,
+                            verdict.header.interface, verdict.header.member, verdict.isMatch);
+        // 消息仍由等待队列持有，先释放判定结果中的引用，转发后缓存可以回到缓存池
+        verdict.message = QByteArray();
+        resumeClient(pair->boxClient, nullptr, &verdict);
+    }
+}
+
 void DbusProxy::onNewConnection()
 {
-    QLocalSocket *client = serverProxy->nextPendingConnection();
+    if (workers.isEmpty()) {
+        DbusEndpoint *client = serverProxy->nextPendingConnection();
+        if (client) {
+            addClient(client);
+        }
+        return;
+    }
+    int fd = serverProxy->nextPendingDescriptor();
+    if (fd < 0) {
+        return;
+    }
+    // 依次分配给各工作线程，客户端及其与dbus-daemon的连接之后只在该线程中处理
+    DbusProxyWorker *worker = workers[nextWorker];
+    nextWorker = (nextWorker + 1) % workers.size();
+    if (!worker->dispatch(fd)) {
+        qCritical() << "dispatch client to worker failed, pending clients:" << worker->pendingClients();
+        ::close(fd);
+        return;
+    }
+    qDebug() << "onNewConnection dispatch client:" << fd << " to worker:" << worker;
+}
+
+/*
+ * 将其它线程接受的客户端连接加入待接管队列，只能在接受连接的线程中调用
+ *
+ * @param fd: 客户端socket，成功后归当前代理所有
+ *
+ * @return bool: true:成功 false:队列已满
+ */
+bool DbusProxy::dispatchClient(int fd)
+{
+    if (!pendingClients.push(fd)) {
+        return false;
+    }
+    // 只在没有安排处理时唤醒工作线程，之后加入的连接在同一次处理中接管
+    if (!isAdoptScheduled.exchange(true)) {
+        QMetaObject::invokeMethod(this, "onPendingClients", Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void DbusProxy::onPendingClients()
+{
+    // 先清除标记再取出，处理期间加入的连接会重新安排
+    isAdoptScheduled.store(false);
+    int fd = -1;
+    while (pendingClients.pop(&fd)) {
+        adoptClient(fd);
+    }
+}
+
+/*
+ * 接管其它线程接受的客户端连接
+ *
+ * @param fd: 客户端socket
+ */
+void DbusProxy::adoptClient(int fd)
+{
+    DbusEndpoint *client = engine->adoptEndpoint(fd);
+    if (!client->isConnected()) {
+        qCritical() << "adopt client failed:" << client->errorString();
+        delete client;
+        return;
+    }
+    addClient(client);
+}
+
+/*
+ * 为新的客户端连接建立与dbus-daemon的连接
+ *
+ * @param client: 客户端
+ */
+void DbusProxy::addClient(DbusEndpoint *client)
+{
     qDebug() << "onNewConnection called, client:" << client;
     connect(client, SIGNAL(readyRead()), this, SLOT(onReadyReadClient()));
     connect(client, SIGNAL(disconnected()), this, SLOT(onDisconnectedClient()));
+    connect(client, SIGNAL(bytesWritten(qint64)), this, SLOT(onBytesWritten()));
+
+    DbusEndpoint *proxyClient = engine->createEndpoint();
+    // 连接过程中可能同步触发connected回调，需要先关联连接对
+    DbusConnectionPair *pair = new DbusConnectionPair(client, proxyClient);
+    pairs.insert(pair);
+    client->setContext(pair);
+    proxyClient->setContext(pair);
+    pair->session.canPassDescriptors = client->canPassDescriptors() && proxyClient->canPassDescriptors();
+    pair->connectTime.start();
+    connectingPairs.insert(pair);
+    if (!connectTimer.isActive()) {
+        connectTimer.start();
+    }
+    qDebug() << "onNewConnection create: " << client << "<===>" << proxyClient << " relation";
+    if (!startConnectDbusDaemon(proxyClient, daemonPath)) {
+        client->disconnectFromServer();
+    }
+}
 
-    QLocalSocket *proxyClient = new QLocalSocket();
-    bool ret = startConnectDbusDaemon(proxyClient, daemonPath);
-    relations.insert(client, proxyClient);
-    qDebug() << "onNewConnection create: " << client << "<===>" << proxyClient << " relation, ret:" << ret;
+/*
+ * 通过dde权限管理器异步向用户申请权限，申请结果在onPermissionReply中处理
+ * 工作线程中的代理交给owner申请，结果在onOwnerPermissionReply中处理
+ *
+ * @param boxClient: 等待申请结果的客户端
+ * @param appId: 应用appId
+ * @param id: 申请的应用权限ID
+ */
+void DbusProxy::requestPermission(DbusEndpoint *boxClient, const QString &appId, const QString &id)
+{
+    // 同一应用的多个连接可能分配到不同的工作线程，由owner统一申请，相同的申请同一时间只有一个
+    if (owner) {
+        QList<DbusEndpoint *> &clients = forwardedPermissions[qMakePair(appId, id)];
+        clients.append(boxClient);
+        if (clients.size() == 1) {
+            QMetaObject::invokeMethod(owner, "onWorkerPermissionRequest", Qt::QueuedConnection,
+                                      Q_ARG(QObject *, this), Q_ARG(QString, appId), Q_ARG(QString, id));
+        }
+        return;
+    }
+    QDBusPendingCallWatcher *watcher = startPermissionRequest(appId, id);
+    pendingPermissions[watcher].clients.append(boxClient);
 }
 
-int DbusProxy::requestPermission(const QString &appId, const QString &id)
+/*
+ * 开始一次权限申请，相同的权限申请未返回时只返回该申请，不重复申请
+ *
+ * @param appId: 应用appId
+ * @param id: 申请的应用权限ID
+ *
+ * @return QDBusPendingCallWatcher: 未返回的权限申请
+ */
+QDBusPendingCallWatcher *DbusProxy::startPermissionRequest(const QString &appId, const QString &id)
 {
-    if (id.isEmpty()) {
-        qCritical() << "id is empty";
-        return -1;
+    QPair<QString, QString> key = qMakePair(appId, id);
+    QDBusPendingCallWatcher *watcher = inflightPermissions.value(key);
+    if (watcher) {
+        qDebug() << appId << " requestPermission id:" << id << " in flight";
+        return watcher;
     }
-    QDBusInterface interface("org.desktopspec.permission", "/org/desktopspec/permission", "org.desktopspec.permission",
-                             QDBusConnection::sessionBus());
-    QDBusPendingReply<QString> reply = interface.call("Request", appId, "linglong", id);
-    reply.waitForFinished();
+
+    // 不使用QDBusInterface，避免构造时同步introspect
+    QDBusMessage msg = QDBusMessage::createMethodCall("org.desktopspec.permission", "/org/desktopspec/permission",
+                                                      "org.desktopspec.permission", "Request");
+    msg << appId << "linglong" << id;
+    watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(msg), this);
+    PendingPermission pending;
+    pending.appId = appId;
+    pending.id = id;
+    pendingPermissions.insert(watcher, pending);
+    inflightPermissions.insert(key, watcher);
+    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher *)), this,
+            SLOT(onPermissionReply(QDBusPendingCallWatcher *)));
+    qDebug() << appId << " requestPermission id:" << id << " start";
+    return watcher;
+}
+
+void DbusProxy::onWorkerPermissionRequest(QObject *worker, const QString &appId, const QString &id)
+{
+    QDBusPendingCallWatcher *watcher = startPermissionRequest(appId, id);
+    pendingPermissions[watcher].workers.append(worker);
+}
+
+void DbusProxy::onOwnerPermissionReply(const QString &appId, const QString &id, int result)
+{
+    // 等待期间断开的客户端已从列表中移除
+    QList<DbusEndpoint *> clients = forwardedPermissions.take(qMakePair(appId, id));
+    PermissionDecision decision = {id, result};
+    for (DbusEndpoint *client : clients) {
+        resumeClient(client, &decision, nullptr);
+    }
+}
+
+/*
+ * 通知用户权限已被禁用，不等待弹窗结果
+ *
+ * @param appId: 应用appId
+ * @param id: 申请的应用权限ID
+ */
+void DbusProxy::showDisablePermissionDialog(const QString &appId, const QString &id)
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall("org.desktopspec.permission", "/org/desktopspec/permission",
+                                                      "org.desktopspec.permission", "ShowDisablePermissionDialog");
+    msg << appId << "linglong" << id;
+    QDBusConnection::sessionBus().asyncCall(msg);
+}
+
+void DbusProxy::onPermissionReply(QDBusPendingCallWatcher *watcher)
+{
+    watcher->deleteLater();
+    if (!pendingPermissions.contains(watcher)) {
+        return;
+    }
+    PendingPermission pending = pendingPermissions.take(watcher);
+    inflightPermissions.remove(qMakePair(pending.appId, pending.id));
+    QDBusPendingReply<QString> reply = *watcher;
     int ret = -1;
     if (reply.isValid()) {
         ret = reply.value().toInt();
         // DDE 查询到用户上次弹窗选择结果是拒绝则返回1
         if (1 == ret) {
-            QDBusPendingReply<void> dialogReply = interface.call("ShowDisablePermissionDialog", appId, "linglong", id);
-            dialogReply.waitForFinished();
+            showDisablePermissionDialog(pending.appId, pending.id);
         }
     } else {
         if ("org.desktopspec.permission.SystemLevelRestrictions" == reply.error().name()) {
-            QDBusPendingReply<void> dialogReply = interface.call("ShowDisablePermissionDialog", appId, "linglong", id);
-            dialogReply.waitForFinished();
+            showDisablePermissionDialog(pending.appId, pending.id);
         }
-        qCritical() << appId << " requestPermission err:" << reply.error();
+        qCritical() << pending.appId << " requestPermission err:" << reply.error();
+    }
+    qDebug() << pending.appId << " requestPermission id:" << pending.id << ",ret:" << ret;
+
+    // 只缓存允许的结果，拒绝时仍由授权模块提示用户
+    if (ret == Allow) {
+        permissionCache->insert(pending.appId, pending.id, ret);
+    }
+    // 所有等待该申请的客户端使用同一个结果
+    PermissionDecision decision = {pending.id, ret};
+    for (DbusEndpoint *client : pending.clients) {
+        resumeClient(client, &decision, nullptr);
+    }
+    for (QObject *worker : pending.workers) {
+        QMetaObject::invokeMethod(worker, "onOwnerPermissionReply", Qt::QueuedConnection,
+                                  Q_ARG(QString, pending.appId), Q_ARG(QString, pending.id), Q_ARG(int, ret));
     }
-    qDebug() << appId << " requestPermission id:" << id << ",ret:" << ret;
-    return ret;
 }
 
-QString DbusProxy::getPermissionId(const QString &name, const QString &path, const QString &ifce)
-{
-    const QString cfgPath = "/usr/share/permission/policy/linglong/dbus_map_config";
-    QFile cfgFile(cfgPath);
-    if (!cfgFile.open(QIODevice::ReadOnly)) {
-        qCritical() << "getPermissionId err" << cfgFile.errorString();
-        return "";
-    }
-    QString qValue = cfgFile.readAll();
-    cfgFile.close();
-    QJsonParseError parseJsonErr;
-    QJsonDocument document = QJsonDocument::fromJson(qValue.toUtf8(), &parseJsonErr);
-    if (QJsonParseError::NoError != parseJsonErr.error) {
-        qCritical() << "getPermissionId parse config file err";
-        return "";
-    }
-
-    QJsonObject dataObject = document.object();
-    // 根据dbus信息查找权限id
-    for (const auto &key : dataObject.keys()) {
-        auto dbusObject = dataObject.value(key);
-        if (dbusObject.isArray()) {
-            QJsonArray dbusArray = dbusObject.toArray();
-            for (int i = 0; i < dbusArray.size(); i++) {
-                QJsonObject item = dbusArray.at(i).toObject();
-                if (name == item.value("name").toString() && path == item.value("path").toString()
-                    && ifce == item.value("ifce").toString()) {
-                    return key;
-                }
+/*
+ * 客户端消息加入等待队列，使用策略线程时按顺序交给策略线程判定
+ *
+ * @param pair: 客户端所属的一对连接
+ * @param data: dbus消息数据，拷贝到连接对缓存池的缓存中
+ * @param size: 消息长度
+ * @param canSubmit: 是否可以交给策略线程，等待权限申请结果的消息为false
+ */
+void DbusProxy::holdMessage(DbusConnectionPair *pair, const char *data, int size, bool canSubmit)
+{
+    QByteArray item = pair->bufferPool.acquire(size);
+    item.append(data, size);
+    pair->holdQueue.append(item);
+    heldMessages++;
+    heldMessagesPeak = qMax(heldMessagesPeak, heldMessages);
+    // 判定结果按提交顺序返回，之前的消息都已提交或在队首等待时才能提交，等待期间后续消息的判定同时进行
+    int submitted = pair->policySubmitted();
+    if (canSubmit && policyLane && pair->heldUnsubmitted + submitted == pair->holdQueue.size() - 1
+        && submitPolicy(pair, item)) {
+        return;
+    }
+    if (submitted == 0) {
+        pair->heldUnsubmitted++;
+    }
+}
+
+/*
+ * 收到权限申请结果或策略线程判定后继续处理客户端等待队列中的消息
+ *
+ * @param boxClient: 客户端
+ * @param decision: 权限申请结果，队列中申请相同权限的消息均使用该结果，可以为空
+ * @param verdict: 策略线程对队首消息的判定结果，可以为空
+ */
+void DbusProxy::resumeClient(DbusEndpoint *boxClient, const PermissionDecision *decision,
+                             const DbusPolicyVerdict *verdict)
+{
+    // 转发过程中客户端可能断开连接，每次处理前重新查找所属的连接对
+    DbusConnectionPair *pair = pairOf(boxClient);
+    // 对应的消息之前还有等待权限申请结果的消息时先保存判定结果
+    if (pair && verdict && (pair->heldUnsubmitted > 0 || !pair->policyVerdicts.isEmpty())) {
+        pair->policyVerdicts.append(*verdict);
+        verdict = nullptr;
+    }
+    DbusPolicyVerdict saved;
+    while (pair && !pair->holdQueue.isEmpty()) {
+        // 已提交的消息都处理完后，通道已满时未能提交的消息同样在当前线程判定
+        if (!verdict && pair->policySubmitted() == 0) {
+            pair->heldUnsubmitted = pair->holdQueue.size();
+        }
+        bool isSubmitted = pair->heldUnsubmitted == 0;
+        if (isSubmitted && !verdict) {
+            // 队首消息的判定结果还未返回
+            if (pair->policyVerdicts.isEmpty()) {
+                return;
+            }
+            saved = pair->policyVerdicts.takeFirst();
+            verdict = &saved;
+        }
+        QByteArray item = pair->holdQueue.first();
+        // 后续消息需要申请其它权限时保留在队首，收到结果后在当前线程判定
+        if (!handleClientMessage(boxClient, item.constData(), item.size(), decision, verdict, nullptr)) {
+            if (isSubmitted) {
+                pair->heldUnsubmitted = 1;
             }
+            return;
+        }
+        // 判定结果只对应队首消息
+        verdict = nullptr;
+        pair = pairOf(boxClient);
+        if (pair) {
+            pair->holdQueue.removeFirst();
+            if (!isSubmitted) {
+                pair->heldUnsubmitted--;
+            }
+            heldMessages--;
+            pair->bufferPool.release(&item);
+        }
+        if (pair && pair->isStreamBroken) {
+            qCritical() << boxClient << " file descriptors do not match messages, disconnect";
+            boxClient->disconnectFromServer();
+            return;
         }
     }
-    qWarning() << "permission id not found " << QString("name:%1,path:%2,interface:%3").arg(name).arg(path).arg(ifce);
-    return "";
 }
 
-void DbusProxy::onReadyReadClient()
+// 控制信号处理函数与事件循环之间的通知管道
+static int controlFds[2] = {-1, -1};
+
+static void handleControlSignal(int)
 {
-    // box client socket address
-    QLocalSocket *boxClient = static_cast<QLocalSocket *>(sender());
-    qDebug() << boxClient << "onReadyReadClient called";
-
-    if (boxClient) {
-        // 查找客户端对应的代理
-        QLocalSocket *proxyClient = nullptr;
-        if (relations.contains(boxClient)) {
-            proxyClient = relations[boxClient];
-        } else {
-            qCritical() << "boxClient:" << boxClient << " related proxyClient not found";
+    char c = 1;
+    ssize_t ret = ::write(controlFds[0], &c, sizeof(c));
+    Q_UNUSED(ret);
+}
+
+/*
+ * 监听本地控制信号，收到SIGUSR1时清空权限申请结果缓存
+ *
+ * @return bool: true:成功 其它:失败
+ */
+bool DbusProxy::startListenControlSignal()
+{
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, controlFds) != 0) {
+        qCritical() << "create control socketpair failed";
+        return false;
+    }
+    // 信号处理函数中只能调用异步信号安全的函数，实际处理放到事件循环中
+    controlNotifier.reset(new QSocketNotifier(controlFds[1], QSocketNotifier::Read));
+    connect(controlNotifier.get(), SIGNAL(activated(int)), this, SLOT(onControlSignal()));
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleControlSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &action, nullptr) != 0) {
+        qCritical() << "install control signal handler failed";
+        return false;
+    }
+    return true;
+}
+
+void DbusProxy::onControlSignal()
+{
+    char buf[64];
+    while (::read(controlFds[1], buf, sizeof(buf)) > 0) {
+    }
+    qDebug() << "receive control signal, clear permission cache, size:" << permissionCache->size();
+    permissionCache->clear();
+}
+
+QString DbusProxy::getPermissionId(QLatin1String name, QLatin1String path, QLatin1String ifce)
+{
+    return permissionMap->permissionId(name, path, ifce);
+}
+
+/*
+ * 将socket中可读的数据读入分帧器缓存
+ *
+ * @param socket: 读取数据的socket
+ * @param framer: socket对应的分帧器
+ *
+ * @return bool: true:读到数据 false:无数据或读取失败
+ */
+bool DbusProxy::readToFramer(DbusEndpoint *socket, DbusFramer *framer)
+{
+    qint64 readSize = socket->read(framer->reserve(kReadSize), kReadSize);
+    if (readSize <= 0) {
+        return false;
+    }
+    framer->commit(readSize);
+    return true;
+}
+
+/*
+ * 判断客户端消息是否匹配过滤规则，优先使用缓存的匹配结果
+ *
+ * @param header: dbus消息报文头视图
+ *
+ * @return bool: true: 是 false:否
+ */
+bool DbusProxy::isMessageMatch(const HeaderView &header)
+{
+    bool isMatch = false;
+    if (verdictCache.lookup(rules->generation(), header.destination, header.path, header.interface, header.member,
+                            &isMatch)) {
+        return isMatch;
+    }
+    isMatch = rules->isMessageMatch(header.destination, header.path, header.interface);
+    verdictCache.insert(rules->generation(), header.destination, header.path, header.interface, header.member,
+                        isMatch);
+    return isMatch;
+}
+
+/*
+ * 将数据写入目标socket，写入不阻塞，由事件循环异步发送
+ * 目标socket待写数据超过高水位时暂停读取来源socket
+ *
+ * @param source: 数据来源socket
+ * @param target: 目标socket
+ * @param data: 待写数据
+ * @param fds: 随数据发送的文件描述符，由目标socket负责关闭
+ */
+void DbusProxy::writeToPeer(DbusEndpoint *source, DbusEndpoint *target, const QByteArray &data,
+                            const QVector<int> &fds)
+{
+    if (fds.isEmpty()) {
+        target->write(data);
+    } else {
+        target->writeWithDescriptors(data, fds);
+    }
+    writeBacklogPeak = qMax(writeBacklogPeak, target->bytesToWrite());
+    DbusConnectionPair *pair = pairOf(source);
+    if (pair && target->bytesToWrite() > highWatermark && !pair->setPaused(source, true)) {
+        qDebug() << target << " bytes to write:" << target->bytesToWrite() << " over high watermark, pause reading"
+                 << source;
+    }
+}
+
+/*
+ * 发送一次读取中需要转发的所有报文
+ * 目标socket允许直接写入且没有待写数据时直接通过sendmsg发送，未发送完的部分交给socket写缓存
+ *
+ * @param source: 数据来源socket
+ * @param target: 目标socket
+ * @param batch: 需要转发的报文集合
+ */
+void DbusProxy::flushToPeer(DbusEndpoint *source, DbusEndpoint *target, DbusWriteBatch *batch)
+{
+    if (batch->isEmpty()) {
+        return;
+    }
+    DbusConnectionPair *pair = pairOf(source);
+    QByteArray remainder = pair ? pair->bufferPool.acquire(batch->size()) : QByteArray();
+    // socket写缓存中有数据时直接发送会打乱报文顺序
+    if (target->canWriteDirectly() && target->bytesToWrite() == 0 && target->isConnected()) {
+        batch->writeTo(target->socketDescriptor(), &remainder);
+    } else {
+        batch->copyTo(&remainder);
+    }
+    qCDebug(messageLog) << target << " flush messages:" << batch->count() << ", size:" << batch->size()
+             << ", remainder:" << remainder.size() << ", syscalls:" << batch->syscalls();
+    if (!remainder.isEmpty()) {
+        writeToPeer(source, target, remainder);
+    }
+    // 目标socket已拷贝数据，缓存归还后供下次复用
+    if (pair) {
+        pair->bufferPool.release(&remainder);
+    }
+    batch->clear();
+}
+
+/*
+ * 转发附带文件描述符的消息，文件描述符从来源socket已收到的文件描述符中按顺序取出
+ *
+ * @param source: 数据来源socket
+ * @param target: 目标socket
+ * @param data: 一条完整的dbus消息
+ * @param size: 消息长度
+ * @param count: 消息报文头中的unix_fds
+ * @param batch: 本次读取的转发集合，之前的消息需要先发送
+ *
+ * @return bool: true:已转发 false:收到的文件描述符不足，消息未转发，连接需要断开
+ */
+bool DbusProxy::forwardDescriptors(DbusEndpoint *source, DbusEndpoint *target, const char *data, int size,
+                                   quint32 count, DbusWriteBatch *batch)
+{
+    QVector<int> fds;
+    if (!source->takeDescriptors(count, &fds)) {
+        qCritical() << source << " msg needs file descriptors:" << count << ", received:" << source->pendingDescriptors();
+        return false;
+    }
+    if (batch) {
+        flushToPeer(source, target, batch);
+    }
+    // 目标socket写入时拷贝数据
+    writeToPeer(source, target, QByteArray::fromRawData(data, size), fds);
+    qCDebug(messageLog) << target << " forward msg with file descriptors:" << count << ", size:" << size;
+    return true;
+}
+
+/*
+ * 关闭被拦截消息附带的文件描述符
+ *
+ * @param source: 数据来源socket
+ * @param count: 消息报文头中的unix_fds
+ *
+ * @return bool: true:已关闭 false:收到的文件描述符不足，连接需要断开
+ */
+bool DbusProxy::dropDescriptors(DbusEndpoint *source, quint32 count)
+{
+    QVector<int> fds;
+    if (!source->takeDescriptors(count, &fds)) {
+        qCritical() << source << " msg needs file descriptors:" << count << ", received:" << source->pendingDescriptors();
+        return false;
+    }
+    for (int fd : fds) {
+        ::close(fd);
+    }
+    return true;
+}
+
+/*
+ * 来源和目标之间能否通过splice转发
+ *
+ * @param source: 数据来源socket
+ * @param target: 目标socket
+ *
+ * @return bool: true:能 false:不能
+ */
+bool DbusProxy::canSplice(DbusEndpoint *source, DbusEndpoint *target)
+{
+    // splice会丢弃随数据到达的文件描述符
+    DbusConnectionPair *pair = pairOf(source);
+    return spliceThreshold > 0 && splicePipe.isValid() && target && source->canReadDirectly()
+           && target->canWriteDirectly() && target->isConnected() && pair && !pair->session.isUnixFdEnabled();
+}
+
+/*
+ * 报文头完整且确定转发的消息开始透传：已收到的部分加入转发集合，剩余消息体到达后直接转发
+ *
+ * @param source: 数据来源socket
+ * @param target: 目标socket
+ * @param framer: 来源socket的分帧器
+ * @param batch: 本次读取的转发集合
+ *
+ * @return bool: true:已开始透传 false:不满足透传条件，消息完整后按原流程处理
+ */
+bool DbusProxy::startPassThrough(DbusEndpoint *source, DbusEndpoint *target, DbusFramer *framer,
+                                 DbusWriteBatch *batch)
+{
+    DbusFrame frame;
+    // 一次读取能收完的消息不透传，避免一条消息拆成多次发送
+    if (!target || !target->isConnected() || !framer->peekPartial(&frame, kReadSize)) {
+        return false;
+    }
+    HeaderView header;
+    // 文件描述符需要随完整的消息发送
+    if (!parseHeaderView(frame.data, frame.size, &header) || header.unixFds > 0) {
+        return false;
+    }
+    DbusConnectionPair *pair = pairOf(source);
+    if (!pair) {
+        return false;
+    }
+    if (source == pair->boxClient) {
+        // 客户端消息需要先确定可以转发，被拦截或等待权限申请的消息仍按完整消息处理
+        if (!pair->holdQueue.isEmpty() || !pair->isDaemonConnected || !isForwardable(header)) {
+            return false;
         }
-        // 代理未连接上dbus daemon，尝试重新连接dbus daemon一次
-        if (proxyClient && !connStatus.contains(proxyClient)) {
-            bool ret = startConnectDbusDaemon(proxyClient, daemonPath);
-            qDebug() << proxyClient << " start reconnect dbus-daemon ret:" << ret;
+    } else if (pair->session.uniqueName.isEmpty()) {
+        // unique name只需要报文头
+        readUniqueName(pair, frame.data, frame.size);
+    }
+    batch->append(frame.data, frame.size);
+    framer->startPassThrough();
+    qCDebug(messageLog) << source << " pass through msg to" << target << ", received:" << frame.size
+             << ", remaining:" << framer->passThroughBytes();
+    return true;
+}
+
+/*
+ * 透传中剩余的消息体较大时通过splice从来源socket转发到目标socket，数据不经过用户态
+ *
+ * @param source: 数据来源socket
+ * @param target: 目标socket
+ * @param framer: 来源socket的分帧器
+ */
+void DbusProxy::spliceToPeer(DbusEndpoint *source, DbusEndpoint *target, DbusFramer *framer)
+{
+    // 分帧器缓存中还有未转发的数据或目标有待写数据时直接转发会打乱顺序
+    if (framer->passThroughBytes() < spliceThreshold || framer->pendingBytes() > 0 || !canSplice(source, target)
+        || target->bytesToWrite() > 0) {
+        return;
+    }
+    QByteArray stalled;
+    qint64 size = splicePipe.transfer(source->socketDescriptor(), target->socketDescriptor(),
+                                      framer->passThroughBytes(), &stalled);
+    framer->skip(size);
+    qCDebug(messageLog) << source << " splice to" << target << ", size:" << size << ", stalled:" << stalled.size()
+             << ", remaining:" << framer->passThroughBytes();
+    if (!stalled.isEmpty()) {
+        writeToPeer(source, target, stalled);
+    }
+}
+
+/*
+ * 客户端消息是否无需等待即可转发，不发起权限申请
+ *
+ * @param header: dbus消息报文头视图
+ *
+ * @return bool: true:可以转发 false:需要按完整消息处理
+ */
+bool DbusProxy::isForwardable(const HeaderView &header)
+{
+    if (!isIntercepting) {
+        return true;
+    }
+    // 使用策略线程时只根据缓存的匹配结果透传，未命中的消息完整后交给策略线程
+    bool isMatch = true;
+    if (!policyLane) {
+        isMatch = isMessageMatch(header);
+    } else if (!verdictCache.lookup(rules->generation(), header.destination, header.path, header.interface,
+                                    header.member, &isMatch)) {
+        return false;
+    }
+    if (!isMatch) {
+        return true;
+    }
+    QString id = getPermissionId(header.destination, header.path, header.interface);
+    int ret = -1;
+    return !id.isEmpty() && permissionCache->lookup(appId, id, &ret) && ret == Allow;
+}
+
+void DbusProxy::onBytesWritten()
+{
+    DbusEndpoint *target = static_cast<DbusEndpoint *>(QObject::sender());
+    DbusConnectionPair *pair = pairOf(target);
+    if (!pair || (!pair->isClientPaused && !pair->isDaemonPaused) || target->bytesToWrite() > lowWatermark) {
+        return;
+    }
+    // 一端写缓存降下来时另一端可能仍然积压，只恢复写入目标都不超过低水位的一端
+    if (pair->isPaused(pair->boxClient) && pair->canResume(pair->boxClient, lowWatermark)) {
+        pair->setPaused(pair->boxClient, false);
+        qDebug() << target << " bytes to write under low watermark, resume reading" << pair->boxClient;
+        readClient(pair->boxClient);
+    }
+    // 恢复读取客户端的过程中连接可能已断开
+    pair = pairOf(target);
+    if (pair && pair->isPaused(pair->proxyClient) && pair->canResume(pair->proxyClient, lowWatermark)) {
+        pair->setPaused(pair->proxyClient, false);
+        qDebug() << target << " bytes to write under low watermark, resume reading" << pair->proxyClient;
+        readServer(pair->proxyClient);
+    }
+}
+
+/*
+ * 转发一行握手消息，记录握手进度，握手完成后dbus-daemon方向进入dbus消息阶段
+ *
+ * @param pair: 连接对
+ * @param source: 消息来源socket
+ * @param frame: 握手消息
+ * @param batch: 本次读取的转发集合
+ */
+void DbusProxy::relayAuthLine(DbusConnectionPair *pair, DbusEndpoint *source, const DbusFrame &frame,
+                              DbusWriteBatch *batch)
+{
+    int localReplies = 0;
+    if (source == pair->boxClient) {
+        if (pair->session.readClientLine(frame.data, frame.size)) {
+            batch->append(frame.data, frame.size);
         }
+        pair->clientMessages++;
+        // 之前的dbus-daemon回复都已转发时代理直接回复客户端
+        localReplies = pair->session.takeLocalReplies();
+        for (int i = 0; i < localReplies; i++) {
+            writeToPeer(pair->boxClient, pair->boxClient, QByteArray::fromRawData(kAuthError, sizeof(kAuthError) - 1));
+        }
+    } else {
+        pair->session.readDaemonLine(frame.data, frame.size);
+        pair->daemonMessages++;
+        batch->append(frame.data, frame.size);
+        localReplies = pair->session.takeLocalReplies();
+        for (int i = 0; i < localReplies; i++) {
+            batch->append(kAuthError, sizeof(kAuthError) - 1);
+        }
+    }
+    if (localReplies > 0) {
+        qDebug() << pair->boxClient << " reject NEGOTIATE_UNIX_FD, engine can not pass file descriptors";
+    }
+    // 客户端方向的分帧器收到BEGIN后已自行切换，dbus-daemon方向需等其回复完所有握手命令
+    if (pair->session.isRunning()) {
+        pair->daemonFramer.setPhase(DbusFramer::Phase::Binary);
+    }
+}
 
-        // 客户端在代理处理转发期间又发来了数据不会触发onReadyReadClient回调
-        while (boxClient->bytesAvailable() > 0) {
-            // dbus 消息会缓存 需要分割成一条一条的
-            QByteArray data = boxClient->readAll();
-            qDebug() << "Read Data From Client size:" << data.size();
-            qDebug() << "Read Data From Client:" << data;
-            QList<QByteArray> msgList;
-            // 分割缓存中的dbus消息
-            splitDBusMsg(data, msgList);
-            for (auto item : msgList) {
-                Header header;
-                bool isMatch = false;
-                if (!isDbusAuthMsg(item)) {
-                    if (!parseDBusMsg(item, &header)) {
-                        qWarning() << "onReadyReadClient parse an abnormal dbus msg, msg:" << item
-                                   << ", size:" << item.size();
-                    } else {
-                        // 判断是否满足过滤规则 当前实现由白名单改为黑名单
-                        isMatch = filter.isMessageMatch(header.destination, header.path, header.interface);
-                        qDebug() << "dbus msg serial:" << header.serial << ", reply_serial:" << header.replySerial
-                                 << ", sender:" << header.sender << ", destination:" << header.destination
-                                 << ", header.path:" << header.path
-                                 << ", header.interface:" << header.interface << ", header.member:" << header.member
-                                 << ", dbus msg match filter ret:" << isMatch;
-                    }
-                }
+/*
+ * 处理客户端发来的一条dbus消息，通过过滤及权限检查后转发给dbus-daemon，握手消息不经过这里
+ *
+ * @param boxClient: 客户端
+ * @param data: dbus消息数据，可以直接指向分帧器缓存
+ * @param size: 消息长度
+ * @param decision: 已获得的权限申请结果，为空时需要检查权限
+ * @param verdict: 策略线程对该消息的判定结果，为空时在当前线程或交给策略线程判定
+ * @param batch: 本次读取的转发集合，为空时直接写入
+ *
+ * @return bool: true:处理完成或已排队交给策略线程 false:需要等待权限申请结果
+ */
+bool DbusProxy::handleClientMessage(DbusEndpoint *boxClient, const char *data, int size,
+                                    const PermissionDecision *decision, const DbusPolicyVerdict *verdict,
+                                    DbusWriteBatch *batch)
+{
+    DbusConnectionPair *pair = pairOf(boxClient);
+    if (!pair) {
+        qCritical() << "boxClient:" << boxClient << " related proxyClient not found";
+        return true;
+    }
+    HeaderView header;
+    header.unixFds = 0;
+    bool isMatch = false;
+    // 只解析报文头，字段直接引用消息缓存
+    if (!parseHeaderView(data, size, &header)) {
+        qWarning() << "onReadyReadClient parse an abnormal dbus msg, msg:" << QByteArray::fromRawData(data, size)
+                   << ", size:" << size;
+    } else {
+        if (pair->session.uniqueName.isEmpty()) {
+            pair->session.readClientHeader(header);
+        }
+        // 判断是否满足过滤规则 当前实现由白名单改为黑名单
+        // 使用策略线程时，匹配结果缓存未命中的消息排队交给策略线程，I/O线程继续处理其它数据；
+        // 命中时权限查询同样只查表，在当前线程完成。等待队列中的消息到达队首时没有判定结果的，
+        // 说明提交时通道已满或在等待权限申请结果，在当前线程判定
+        if (verdict) {
+            isMatch = verdict->isMatch;
+        } else if (!policyLane || !pair->holdQueue.isEmpty() || policyLane->isFull()) {
+            isMatch = isMessageMatch(header);
+        } else if (!verdictCache.lookup(rules->generation(), header.destination, header.path, header.interface,
+                                        header.member, &isMatch)) {
+            holdMessage(pair, data, size, true);
+            return true;
+        }
+        qCDebug(messageLog) << "dbus msg serial:" << header.serial << ", reply_serial:" << header.replySerial
+                 << ", sender:" << header.sender << ", destination:" << header.destination
+                 << ", header.path:" << header.path << ", header.interface:" << header.interface
+                 << ", header.member:" << header.member << ", dbus msg match filter ret:" << isMatch;
+    }
 
-                // 握手信息不拦截
-                if (!isDbusAuthMsg(item) && isMatch) {
-                    // 未配置权限申请用户授权
-                    int result = Allow;
-                    if (!qgetenv("DBUS_PROXY_INTERCEPT").isNull()) {
-                        QString id = getPermissionId(header.destination, header.path, header.interface);
-                        result = requestPermission(appId, id);
-                    }
-                    // 记录应用通过dbus访问的宿主机资源
-                    if (result != Allow) {
-                        if (isNeedReply(&header)) {
-                            QByteArray reply = createFakeReplyMsg(
-                                data, header.serial + 1, boxClientAddr, "org.freedesktop.DBus.Error.AccessDenied",
-                                "org.freedesktop.DBus.Error.AccessDenied, please config permission first!");
-                            // 伪造 错误消息格式给客户端
-                            // 将消息发送方 header中的serial 填充到 reply_serial
-                            // 填写消息类型 flags(是否需要回复) 消息body 需要修改消息body长度
-                            // 生成一个惟一的序列号
-                            boxClient->write(reply);
-                            boxClient->waitForBytesWritten(1000);
-                            qDebug() << "reply size:" << reply.size();
-                            qDebug() << reply;
-                        }
-                        return;
-                    }
-                }
-                if (!connStatus.contains(proxyClient)) {
-                    qCritical() << proxyClient << " not connect to dbus-daemon";
-                    return;
-                }
-                proxyClient->write(item);
-                proxyClient->waitForBytesWritten(1000);
-                qDebug() << proxyClient << " send data to dbus-daemon done, msg:" << item << ", size:" << item.size();
-                // Fix 客户端在代理处理转发期间又发来了数据不会触发回调
-                // while (boxClient->bytesAvailable() > 0) {
-                //     QByteArray leftData = boxClient->readAll();
-                //     proxyClient->write(leftData);
-                //     proxyClient->waitForBytesWritten(1000);
-                //     qDebug() << boxClient << " onReadyReadClient data left:" << boxClient->bytesAvailable();
-                // }
+    if (isMatch) {
+        // 未配置权限申请用户授权
+        int ret = Allow;
+        if (isIntercepting) {
+            QString id = verdict ? verdict->permissionId
+                                 : getPermissionId(header.destination, header.path, header.interface);
+            if (id.isEmpty()) {
+                qCritical() << "id is empty";
+                ret = -1;
+            } else if (decision && decision->id == id) {
+                ret = decision->result;
+            } else if (verdict && verdict->hasResult) {
+                ret = verdict->result;
+            } else if (verdict || !permissionCache->lookup(appId, id, &ret)) {
+                requestPermission(boxClient, appId, id);
+                return false;
             }
         }
+        // 记录应用通过dbus访问的宿主机资源
+        if (ret != Allow) {
+            if (isNeedReply(&header)) {
+                // 伪造错误消息给客户端，将消息发送方header中的serial填充到reply_serial
+                const QByteArray &reply =
+                    accessDenied.build(header.serial + 1, header.serial, pair->session.uniqueName);
+                writeToPeer(boxClient, boxClient, reply);
+                qCDebug(messageLog) << boxClient << " access denied, reply size:" << reply.size();
+            }
+            if (header.unixFds > 0 && !dropDescriptors(boxClient, header.unixFds)) {
+                pair->isStreamBroken = true;
+            }
+            return true;
+        }
+    }
+
+    DbusEndpoint *proxyClient = pair->proxyClient;
+    if (!pair->isDaemonConnected) {
+        qCritical() << proxyClient << " not connect to dbus-daemon";
+        return true;
+    }
+    pair->clientMessages++;
+    if (header.unixFds > 0 && pair->session.isUnixFdEnabled()) {
+        // 缺少文件描述符的消息不转发，否则之后的消息会附带错误的文件描述符
+        if (!forwardDescriptors(boxClient, proxyClient, data, size, header.unixFds, batch)) {
+            pair->isStreamBroken = true;
+        }
+        return true;
+    }
+    if (batch) {
+        batch->append(data, size);
+    } else {
+        writeToPeer(boxClient, proxyClient, QByteArray::fromRawData(data, size));
+    }
+    qCDebug(messageLog) << proxyClient << " send data to dbus-daemon done, msg:" << QByteArray::fromRawData(data, size)
+                        << ", size:" << size;
+    return true;
+}
+
+void DbusProxy::onReadyReadClient()
+{
+    // box client socket address
+    DbusEndpoint *boxClient = static_cast<DbusEndpoint *>(sender());
+    qCDebug(messageLog) << boxClient << "onReadyReadClient called";
+    readClient(boxClient);
+}
+
+/*
+ * 读取客户端数据并转发给dbus-daemon
+ *
+ * @param boxClient: 客户端
+ */
+void DbusProxy::readClient(DbusEndpoint *boxClient)
+{
+    // 客户端对应的代理
+    DbusConnectionPair *pair = pairOf(boxClient);
+    if (!pair) {
+        qCritical() << "boxClient:" << boxClient << " related proxyClient not found";
+        return;
+    }
+    DbusEndpoint *proxyClient = pair->proxyClient;
+    DbusFramer &framer = pair->clientFramer;
+    // 代理还未连接上dbus-daemon，握手数据先缓存在分帧器中，连接完成后再处理
+    if (!pair->isDaemonConnected) {
+        while (framer.pendingBytes() < kMaxEarlyDataSize && readToFramer(boxClient, &framer)) {
+            pair->hasEarlyData = true;
+        }
+        return;
+    }
+
+    DbusWriteBatch &batch = pair->clientBatch;
+    bool hasEarlyData = pair->hasEarlyData;
+    pair->hasEarlyData = false;
+    // 客户端在代理处理转发期间又发来了数据不会触发onReadyReadClient回调
+    // dbus-daemon方向待写数据过多时暂停读取，待写数据降到低水位后继续
+    while (!pair->isClientPaused) {
+        spliceToPeer(boxClient, proxyClient, &framer);
+        if (pair->isClientPaused) {
+            break;
+        }
+        // 先处理连接dbus-daemon期间缓存的数据
+        if (!readToFramer(boxClient, &framer) && !hasEarlyData) {
+            break;
+        }
+        hasEarlyData = false;
+        qCDebug(messageLog) << "Read Data From Client, pending size:" << framer.pendingBytes();
+        // dbus 消息会缓存 需要分割成一条一条的，不完整的消息留在分帧器中等待后续数据
+        DbusFrame frame;
+        while (framer.next(&frame)) {
+            // 透传中的消息体已确定转发
+            if (frame.isPartial) {
+                batch.append(frame.data, frame.size);
+                continue;
+            }
+            // 握手消息按行直接转发，不解析报文头也不拦截
+            if (frame.isAuth) {
+                relayAuthLine(pair, boxClient, frame, &batch);
+                continue;
+            }
+            // 有消息在等待权限申请结果或判定结果时，后续消息依次排队以保证顺序
+            if (!pair->holdQueue.isEmpty()) {
+                holdMessage(pair, frame.data, frame.size, true);
+                continue;
+            }
+            if (!handleClientMessage(boxClient, frame.data, frame.size, nullptr, nullptr, &batch)) {
+                holdMessage(pair, frame.data, frame.size, false);
+            }
+            if (pair->isStreamBroken) {
+                break;
+            }
+        }
+        // 之前的消息照常发送，之后的数据丢弃
+        if (pair->isStreamBroken) {
+            flushToPeer(boxClient, proxyClient, &batch);
+            qCritical() << boxClient << " file descriptors do not match messages, disconnect";
+            boxClient->disconnectFromServer();
+            return;
+        }
+        // 本次读取的报文一次发送，需要在下次读取改动分帧器缓存之前完成
+        startPassThrough(boxClient, proxyClient, &framer, &batch);
+        flushToPeer(boxClient, proxyClient, &batch);
+        // 数据不符合dbus协议，无法继续分帧
+        if (framer.phase() == DbusFramer::Phase::Error) {
+            qCritical() << boxClient << " send an invalid dbus stream, disconnect";
+            boxClient->disconnectFromServer();
+            return;
+        }
     }
 }
 
 void DbusProxy::onDisconnectedClient()
 {
-    QLocalSocket *sender = static_cast<QLocalSocket *>(QObject::sender());
+    DbusEndpoint *sender = static_cast<DbusEndpoint *>(QObject::sender());
     if (sender) {
         sender->disconnectFromServer();
     }
     qDebug() << "onDisconnectedClient called, sender:" << sender;
-    QLocalSocket *proxyClient = relations[sender];
+    DbusConnectionPair *pair = pairOf(sender);
     // box 客户端断开连接时，断开代理与dbus daemon的连接
-    if (!proxyClient) {
+    if (!pair) {
         qCritical() << "onDisconnectedClient box client: " << sender << " related proxyClient not found";
         return;
     }
+    qDebug() << "verdict cache capacity:" << verdictCache.capacity() << ", hits:" << verdictCache.hits()
+             << ", misses:" << verdictCache.misses();
+    DbusEndpoint *proxyClient = pair->proxyClient;
+    // 两端socket都不再回调
+    sender->disconnect(this);
+    proxyClient->disconnect(this);
+    // 释放socket时立即关闭，发给dbus-daemon的待写数据发送完关闭后再释放，dbus-daemon不读取时超时释放
+    if (proxyClient->bytesToWrite() > 0) {
+        connect(proxyClient, SIGNAL(disconnected()), proxyClient, SLOT(deleteLater()));
+        QTimer::singleShot(kCloseTimeout, proxyClient, SLOT(deleteLater()));
+    } else {
+        proxyClient->deleteLater();
+    }
     proxyClient->disconnectFromServer();
-    relations.remove(sender);
-    proxyClient->deleteLater();
+    sender->setContext(nullptr);
+    proxyClient->setContext(nullptr);
+    pairs.remove(pair);
+    connectingPairs.remove(pair);
+    heldMessages -= pair->holdQueue.size();
+    qDebug() << sender << " messages to dbus-daemon:" << pair->clientMessages
+             << ", messages from dbus-daemon:" << pair->daemonMessages
+             << ", buffer pool allocations:" << pair->bufferPool.allocations();
+    qDebug() << "queue depth, pending clients:" << pendingClients.size() << "peak:" << pendingClients.peakSize()
+             << ", held messages:" << heldMessages << "peak:" << heldMessagesPeak
+             << ", permission requests:" << pendingPermissions.size() + forwardedPermissions.size()
+             << ", write backlog peak:" << writeBacklogPeak;
+    if (policyLane) {
+        qDebug() << "policy queue depth, requests:" << policyLane->requests.size()
+                 << "peak:" << policyLane->requests.peakSize() << ", verdicts:" << policyLane->verdicts.size()
+                 << "peak:" << policyLane->verdicts.peakSize() << ", in flight:" << policyLane->inflight;
+    }
+    delete pair;
+    // 未返回的权限申请不再处理该客户端的消息
+    for (auto it = pendingPermissions.begin(); it != pendingPermissions.end(); ++it) {
+        it.value().clients.removeAll(sender);
+    }
+    for (auto it = forwardedPermissions.begin(); it != forwardedPermissions.end(); ++it) {
+        it.value().removeAll(sender);
+    }
+    sender->deleteLater();
 }
 
 // dbus-daemon 服务端回调函数
 void DbusProxy::onConnectedServer()
 {
-    QLocalSocket *proxyClient = static_cast<QLocalSocket *>(QObject::sender());
+    DbusEndpoint *proxyClient = static_cast<DbusEndpoint *>(QObject::sender());
     qDebug() << proxyClient << " connected to dbus-daemon success";
-    connStatus.insert(proxyClient, true);
+    DbusConnectionPair *pair = pairOf(proxyClient);
+    if (!pair) {
+        return;
+    }
+    pair->isDaemonConnected = true;
+    connectingPairs.remove(pair);
+    qDebug() << proxyClient << " connect time:" << pair->connectTime.elapsed() << "ms";
+    // 转发连接期间客户端发来的数据
+    readClient(pair->boxClient);
 }
 
-void DbusProxy::onReadyReadServer()
+void DbusProxy::onConnectFailedServer()
 {
-    QLocalSocket *daemonClient = static_cast<QLocalSocket *>(QObject::sender());
-    // 查找代理对应的客户端
-    QLocalSocket *boxClient = nullptr;
-    for (const auto &client : relations.keys()) {
-        if (relations[client] == daemonClient) {
-            boxClient = client;
-            break;
+    DbusEndpoint *proxyClient = static_cast<DbusEndpoint *>(QObject::sender());
+    qCritical() << "connect dbus-daemon error, msg:" << proxyClient->errorString();
+    DbusConnectionPair *pair = pairOf(proxyClient);
+    if (!pair) {
+        return;
+    }
+    // 断开客户端后连接对随之释放
+    connectingPairs.remove(pair);
+    pair->boxClient->disconnectFromServer();
+}
+
+void DbusProxy::onConnectTimeout()
+{
+    QList<DbusConnectionPair *> expired;
+    for (DbusConnectionPair *pair : connectingPairs) {
+        if (pair->connectTime.hasExpired(kConnectTimeout)) {
+            expired.append(pair);
         }
     }
+    // 断开客户端时连接对从connectingPairs中移除，不能在遍历中处理
+    for (DbusConnectionPair *pair : expired) {
+        qCritical() << pair->proxyClient << " connect dbus-daemon timeout";
+        connectingPairs.remove(pair);
+        pair->boxClient->disconnectFromServer();
+    }
+    if (connectingPairs.isEmpty()) {
+        connectTimer.stop();
+    }
+}
+
+void DbusProxy::onReadyReadServer()
+{
+    DbusEndpoint *daemonClient = static_cast<DbusEndpoint *>(QObject::sender());
+    readServer(daemonClient);
+}
+
+/*
+ * 从dbus-daemon发来的消息报文头中获取客户端的unique name
+ *
+ * @param pair: 连接对
+ * @param data: 消息数据，至少包含完整的报文头
+ * @param size: 数据长度
+ */
+void DbusProxy::readUniqueName(DbusConnectionPair *pair, const char *data, int size)
+{
+    HeaderView header;
+    if (!parseHeaderView(data, size, &header)) {
+        qWarning() << pair->proxyClient << " receive an abnormal dbus msg from dbus-daemon, size:" << size;
+        return;
+    }
+    if (pair->session.readDaemonHeader(header)) {
+        qDebug() << pair->boxClient << " unique name:" << pair->session.uniqueName
+                 << ", unix fd:" << pair->session.isUnixFdEnabled();
+    }
+}
 
-    while (daemonClient->bytesAvailable() > 0) {
-        QByteArray receiveDta = daemonClient->readAll();
-        qDebug() << "receive from dbus-daemon, data size:" << receiveDta.size();
-        qDebug() << receiveDta;
-        QList<QByteArray> msgList;
+/*
+ * 读取dbus-daemon数据并转发给客户端
+ *
+ * @param daemonClient: 与dbus-daemon连接的代理
+ */
+void DbusProxy::readServer(DbusEndpoint *daemonClient)
+{
+    // 代理对应的客户端
+    DbusConnectionPair *pair = pairOf(daemonClient);
+    if (!pair) {
+        qCritical() << daemonClient << " related boxClient not found";
+        return;
+    }
+    DbusEndpoint *boxClient = pair->boxClient;
+
+    DbusFramer &framer = pair->daemonFramer;
+    DbusWriteBatch &batch = pair->daemonBatch;
+    while (!pair->isDaemonPaused) {
+        spliceToPeer(daemonClient, boxClient, &framer);
+        if (pair->isDaemonPaused || !readToFramer(daemonClient, &framer)) {
+            break;
+        }
+        qCDebug(messageLog) << "receive from dbus-daemon, pending size:" << framer.pendingBytes();
         // 分割缓存中的dbus消息
-        splitDBusMsg(receiveDta, msgList);
-        for (const auto &item : msgList) {
-            // is a right way to judge?
-            bool isHelloReply = item.contains("NameAcquired");
-            if (isHelloReply) {
-                qDebug() << "parse msg header from dbus-daemon";
-                Header header;
-                if (!parseDBusMsg(item, &header)) {
-                    qWarning() << "onReadyReadServer parse an abnormal dbus msg, msg:" << item
-                               << ", size:" << item.size();
+        DbusFrame frame;
+        while (framer.next(&frame)) {
+            if (frame.isPartial) {
+                batch.append(frame.data, frame.size);
+                continue;
+            }
+            if (frame.isAuth) {
+                relayAuthLine(pair, daemonClient, frame, &batch);
+                continue;
+            }
+            // 只在获取unique name前解析报文头，之后转发的消息不再检查
+            if (pair->session.uniqueName.isEmpty()) {
+                readUniqueName(pair, frame.data, frame.size);
+            }
+            // 文件描述符在消息数据收完前到达，没有待取出的文件描述符时消息不会附带
+            if (daemonClient->pendingDescriptors() > 0) {
+                HeaderView header;
+                if (parseHeaderView(frame.data, frame.size, &header) && header.unixFds > 0) {
+                    if (!forwardDescriptors(daemonClient, boxClient, frame.data, frame.size, header.unixFds, &batch)) {
+                        pair->isStreamBroken = true;
+                        break;
+                    }
+                    pair->daemonMessages++;
+                    continue;
                 }
-                boxClientAddr = header.destination;
-                qDebug() << "boxClientAddr:" << boxClientAddr;
             }
             // 将消息转发给客户端
-            if (boxClient) {
-                boxClient->write(item);
-                boxClient->waitForBytesWritten(1000);
-                qDebug() << boxClient << " send data to box dbus client done, msg:" << item << ", size:" << item.size();
-            } else {
-                qCritical() << daemonClient << " related boxClient not found";
-            }
+            batch.append(frame.data, frame.size);
+            pair->daemonMessages++;
+            qCDebug(messageLog) << boxClient << " send data to box dbus client done, msg:" << frame.toByteArray()
+                                << ", size:" << frame.size;
+        }
+        // 之前的消息照常发送，之后的数据丢弃
+        if (pair->isStreamBroken) {
+            flushToPeer(daemonClient, boxClient, &batch);
+            qCritical() << daemonClient << " file descriptors do not match messages, disconnect";
+            daemonClient->disconnectFromServer();
+            return;
+        }
+        startPassThrough(daemonClient, boxClient, &framer, &batch);
+        flushToPeer(daemonClient, boxClient, &batch);
+        if (framer.phase() == DbusFramer::Phase::Error) {
+            qCritical() << daemonClient << " receive an invalid dbus stream from dbus-daemon, disconnect";
+            daemonClient->disconnectFromServer();
+            return;
         }
     }
 }
@@ -332,67 +1367,18 @@ void DbusProxy::onReadyReadServer()
 // 与dbus-daemon 断开连接
 void DbusProxy::onDisconnectedServer()
 {
-    QLocalSocket *sender = static_cast<QLocalSocket *>(QObject::sender());
+    DbusEndpoint *sender = static_cast<DbusEndpoint *>(QObject::sender());
     if (sender) {
         sender->disconnectFromServer();
     }
+    qDebug() << "onDisconnectedServer called sender:" << sender;
 
-    QLocalSocket *boxClient = nullptr;
-    for (const auto &client : relations.keys()) {
-        if (relations[client] == sender) {
-            boxClient = client;
-            break;
-        }
-    }
-    if (boxClient) {
-        boxClient->disconnectFromServer();
-    } else {
+    DbusConnectionPair *pair = pairOf(sender);
+    if (!pair) {
         qCritical() << "onDisconnectedServer " << sender << " related boxClient not found";
+        return;
     }
-
-    // 更新代理与dbus daemon连接关系
-    if (connStatus.contains(sender)) {
-        connStatus.remove(sender);
-    }
-    qDebug() << "onDisconnectedServer called sender:" << sender;
+    // 更新代理与dbus daemon连接状态，断开客户端后连接对随之释放
+    pair->isDaemonConnected = false;
+    pair->boxClient->disconnectFromServer();
 }
-
-QByteArray DbusProxy::createFakeReplyMsg(const QByteArray &byteMsg, quint32 serial, const QString &dst,
-                                         const QString &errorName, const QString &errorMsg)
-{
-    DBusError dbErr;
-    dbus_error_init(&dbErr);
-    DBusMessage *receiveMsg = dbus_message_demarshal(byteMsg.constData(), byteMsg.size(), &dbErr);
-    if (!receiveMsg) {
-        qCritical() << "dbus_message_demarshal failed";
-        if (dbus_error_is_set(&dbErr)) {
-            qCritical() << "dbus_message_demarshal err msg:" << dbErr.message;
-            dbus_error_free(&dbErr);
-        }
-        return nullptr;
-    }
-
-    std::string nameString = errorName.toStdString();
-    std::string msgString = errorMsg.toStdString();
-    DBusMessage *reply = dbus_message_new_error(receiveMsg, nameString.c_str(), msgString.c_str());
-    std::string destination = dst.toStdString();
-    auto ret = dbus_message_set_destination(reply, destination.c_str());
-    if (!ret) {
-        // dbus_message_unref(receiveMsg);
-        qCritical() << "createFakeReplyMsg set destination failed";
-    }
-    dbus_message_set_serial(reply, serial);
-
-    char *replyAsc;
-    int len = 0;
-    ret = dbus_message_marshal(reply, &replyAsc, &len);
-    if (!ret) {
-        // dbus_message_unref(receiveMsg);
-        qCritical() << "createFakeReplyMsg dbus_message_marshal failed";
-    }
-    QByteArray data(replyAsc, len);
-    dbus_free(replyAsc);
-    dbus_message_unref(receiveMsg);
-    dbus_message_unref(reply);
-    return data;
-}
\ No newline at end of file
@@ -9,26 +9,52 @@
 
 #include <dbus/dbus.h>
 
+#include <atomic>
+
+#include <QDBusPendingCallWatcher>
 #include <QDebug>
 #include <QFile>
-#include <QLocalSocket>
-#include <QLocalServer>
+#include <QHash>
 #include <QObject>
 #include <QScopedPointer>
+#include <QSet>
+#include <QSharedPointer>
+#include <QSocketNotifier>
+#include <QTimer>
 
+#include "engine/dbus_endpoint.h"
 #include "filter/dbus_filter.h"
+#include "filter/dbus_verdict_cache.h"
+#include "message/dbus_error_reply.h"
+#include "message/dbus_framer.h"
 #include "message/dbus_message.h"
+#include "permission/dbus_permission_cache.h"
+#include "permission/dbus_permission_map.h"
+#include "proxy/dbus_connection_pair.h"
+#include "proxy/dbus_policy_stage.h"
+#include "proxy/dbus_splice_pipe.h"
+#include "proxy/dbus_spsc_queue.h"
+#include "proxy/dbus_write_batch.h"
+
+class DbusProxyWorker;
 
 class DbusProxy : public QObject
 {
     Q_OBJECT
+    // 单元测试中不经过事件循环直接驱动转发流程
+    friend class DbusProxyTester;
 
 public:
-    DbusProxy();
+    /*
+     * @param owner: 接受客户端连接的代理，不为空时为工作线程中的代理，共用其过滤规则及权限状态
+     */
+    explicit DbusProxy(DbusProxy *owner = nullptr);
     ~DbusProxy();
 
     /*
-     * 启动监听
+     * 启动监听，工作线程数大于1时先启动工作线程，接受的连接依次分配给各工作线程
+     * 配置了策略线程时同时启动策略线程，每个处理连接的代理分配一个通道
+     * 过滤规则需要在启动监听前配置完成，之后只读
      *
      * @param socketPath: socket监听地址
      *
@@ -37,14 +63,14 @@ public:
     bool startListenBoxClient(const QString &socketPath);
 
     /*
-     * 连接dbus-daemon
+     * 异步连接dbus-daemon，连接结果通过onConnectedServer/onConnectFailedServer回调
      *
      * @param localProxy: 请求与dbus-daemon连接的客户端
      * @param daemonPath: dbus-daemon地址
      *
-     * @return bool: true:成功 其它:失败
+     * @return bool: true:已开始连接 其它:失败
      */
-    bool startConnectDbusDaemon(QLocalSocket *localProxy, const QString &daemonPath);
+    bool startConnectDbusDaemon(DbusEndpoint *localProxy, const QString &daemonPath);
 
     /*
      * 保存dbus-dameon连接地址
@@ -60,15 +86,49 @@ public:
      */
     void saveAppId(const QString &id) { appId = id; }
 
+    /*
+     * 监听本地控制信号，收到SIGUSR1时清空权限申请结果缓存
+     *
+     * @return bool: true:成功 其它:失败
+     */
+    bool startListenControlSignal();
+
+    /*
+     * 将其它线程接受的客户端连接加入待接管队列，只能在接受连接的线程中调用
+     *
+     * @param fd: 客户端socket，成功后归当前代理所有
+     *
+     * @return bool: true:成功 false:队列已满
+     */
+    bool dispatchClient(int fd);
+
+    // 待接管的客户端连接数，可以在任意线程读取
+    int pendingClientCount() const { return pendingClients.size(); }
+
+    /*
+     * 为处理连接的代理分配策略线程通道，依次分配给各策略线程，只能在策略线程启动前调用
+     *
+     * @param proxy: 处理连接的代理
+     *
+     * @return DbusPolicyLane: 新通道，归proxy所有，未配置策略线程时为空
+     */
+    DbusPolicyLane *attachPolicyLane(DbusProxy *proxy);
+
 private:
+    // 权限申请结果
+    struct PermissionDecision {
+        QString id;
+        int result;
+    };
+
     /*
      * 客户端dbus报文是否需要回复
      *
-     * @param header: dbus socket报文
+     * @param header: dbus消息报文头视图
      *
      * @return bool: true:需要回复 其它:不需要
      */
-    bool isNeedReply(const Header *header)
+    bool isNeedReply(const HeaderView *header)
     {
         if (header->type == (int)MessageType::METHOD_CALL) {
             return (header->flags & 0x1) == 0;
@@ -76,25 +136,6 @@ private:
         return false;
     }
 
-    /*
-     * 客户端dbus报文是否为认证报文
-     *
-     * @param byteArray: dbus socket报文
-     *
-     * @return bool: true:是 其它:不是
-     */
-    bool isDbusAuthMsg(const QByteArray &byteArray)
-    {
-        if (byteArray.size() < 2) {
-            return true;
-        }
-        // buffer[0] 大小端  buffer[1] Message type 1 2 3 4 分别表示METHOD_CALL METHOD_RETURN ERROR SIGNAL
-        if ((byteArray[0] == 'l' || byteArray[0] == 'B') && byteArray[2] < 5) {
-            return false;
-        }
-        return true;
-    }
-
     /*
      * 通过dbus信息获取上报DDE的权限id
      *
@@ -104,35 +145,268 @@ private:
      *
      * @return QString: 权限id
      */
-    QString getPermissionId(const QString &name, const QString &path, const QString &ifce);
+    QString getPermissionId(QLatin1String name, QLatin1String path, QLatin1String ifce);
+
+    /*
+     * 通过dde权限管理器异步向用户申请权限，申请结果在onPermissionReply中处理
+     * 工作线程中的代理交给owner申请，结果在onOwnerPermissionReply中处理
+     *
+     * @param boxClient: 等待申请结果的客户端
+     * @param appId: 应用appId
+     * @param id: 申请的应用权限ID
+     */
+    void requestPermission(DbusEndpoint *boxClient, const QString &appId, const QString &id);
 
     /*
-     * 通过dde权限管理器向用户申请权限
+     * 开始一次权限申请，相同的权限申请未返回时只返回该申请，不重复申请
      *
      * @param appId: 应用appId
      * @param id: 申请的应用权限ID
      *
-     * @return int: 申请结果
+     * @return QDBusPendingCallWatcher: 未返回的权限申请
      */
-    int requestPermission(const QString &appId, const QString &id);
+    QDBusPendingCallWatcher *startPermissionRequest(const QString &appId, const QString &id);
 
     /*
-     * 创建指定参数的dbus错误消息
+     * 通知用户权限已被禁用，不等待弹窗结果
      *
-     * @param byteMsg: dbus socket报文
-     * @param serial: 报文序列号
-     * @param dst: 报文目标地址
-     * @param errorName: 报文错误类型
-     * @param errorMsg: 报文错误消息
+     * @param appId: 应用appId
+     * @param id: 申请的应用权限ID
+     */
+    void showDisablePermissionDialog(const QString &appId, const QString &id);
+
+    /*
+     * 接管其它线程接受的客户端连接
+     *
+     * @param fd: 客户端socket
+     */
+    void adoptClient(int fd);
+
+    /*
+     * 客户端消息加入等待队列，使用策略线程时按顺序交给策略线程判定
+     *
+     * @param pair: 客户端所属的一对连接
+     * @param data: dbus消息数据，拷贝到连接对缓存池的缓存中
+     * @param size: 消息长度
+     * @param canSubmit: 是否可以交给策略线程，等待权限申请结果的消息为false
+     */
+    void holdMessage(DbusConnectionPair *pair, const char *data, int size, bool canSubmit);
+
+    /*
+     * 为新的客户端连接建立与dbus-daemon的连接
      *
-     * @return QByteArray: 报文字节数组
+     * @param client: 客户端
      */
-    QByteArray createFakeReplyMsg(const QByteArray &byteMsg, quint32 serial, const QString &dst,
-                                  const QString &errorName, const QString &errorMsg);
+    void addClient(DbusEndpoint *client);
+
+    /*
+     * 启动工作线程
+     */
+    void startWorkers();
+
+    /*
+     * 创建策略线程，需要在工作线程之前创建，工作线程中的代理创建时从中分配通道
+     */
+    void createPolicyStages();
+
+    /*
+     * 启动策略线程，没有工作线程时当前代理处理连接，先为自己分配通道
+     */
+    void startPolicyStages();
+
+    /*
+     * 将等待队列中的消息交给策略线程判定，判定结果按提交顺序在onPolicyVerdicts中处理
+     *
+     * @param pair: 连接对
+     * @param message: 等待队列中的消息
+     *
+     * @return bool: true:已提交 false:通道已满
+     */
+    bool submitPolicy(DbusConnectionPair *pair, const QByteArray &message);
+
+    /*
+     * 获取socket所属的一对连接
+     *
+     * @param socket: 客户端或与dbus-daemon连接的代理
+     *
+     * @return DbusConnectionPair: 所属的一对连接，连接断开后为空
+     */
+    static DbusConnectionPair *pairOf(DbusEndpoint *socket)
+    {
+        return socket ? static_cast<DbusConnectionPair *>(socket->context()) : nullptr;
+    }
+
+    /*
+     * 将数据写入目标socket，写入不阻塞，由事件循环异步发送
+     * 目标socket待写数据超过高水位时暂停读取来源socket
+     *
+     * @param source: 数据来源socket
+     * @param target: 目标socket
+     * @param data: 待写数据
+     * @param fds: 随数据发送的文件描述符，由目标socket负责关闭
+     */
+    void writeToPeer(DbusEndpoint *source, DbusEndpoint *target, const QByteArray &data,
+                     const QVector<int> &fds = QVector<int>());
+
+    /*
+     * 转发附带文件描述符的消息，文件描述符从来源socket已收到的文件描述符中按顺序取出
+     *
+     * @param source: 数据来源socket
+     * @param target: 目标socket
+     * @param data: 一条完整的dbus消息
+     * @param size: 消息长度
+     * @param count: 消息报文头中的unix_fds
+     * @param batch: 本次读取的转发集合，之前的消息需要先发送
+     *
+     * @return bool: true:已转发 false:收到的文件描述符不足，消息未转发，连接需要断开
+     */
+    bool forwardDescriptors(DbusEndpoint *source, DbusEndpoint *target, const char *data, int size, quint32 count,
+                            DbusWriteBatch *batch);
+
+    /*
+     * 关闭被拦截消息附带的文件描述符
+     *
+     * @param source: 数据来源socket
+     * @param count: 消息报文头中的unix_fds
+     *
+     * @return bool: true:已关闭 false:收到的文件描述符不足，连接需要断开
+     */
+    bool dropDescriptors(DbusEndpoint *source, quint32 count);
+
+    /*
+     * 发送一次读取中需要转发的所有报文
+     * 目标socket允许直接写入且没有待写数据时直接通过sendmsg发送，未发送完的部分交给socket写缓存
+     * 未发送完的部分使用来源连接对缓存池中的缓存拷贝
+     *
+     * @param source: 数据来源socket
+     * @param target: 目标socket
+     * @param batch: 需要转发的报文集合
+     */
+    void flushToPeer(DbusEndpoint *source, DbusEndpoint *target, DbusWriteBatch *batch);
+
+    /*
+     * 来源和目标之间能否通过splice转发
+     *
+     * @param source: 数据来源socket
+     * @param target: 目标socket
+     *
+     * @return bool: true:能 false:不能
+     */
+    bool canSplice(DbusEndpoint *source, DbusEndpoint *target);
+
+    /*
+     * 报文头完整且确定转发的消息开始透传：已收到的部分加入转发集合，剩余消息体到达后直接转发
+     *
+     * @param source: 数据来源socket
+     * @param target: 目标socket
+     * @param framer: 来源socket的分帧器
+     * @param batch: 本次读取的转发集合
+     *
+     * @return bool: true:已开始透传 false:不满足透传条件，消息完整后按原流程处理
+     */
+    bool startPassThrough(DbusEndpoint *source, DbusEndpoint *target, DbusFramer *framer, DbusWriteBatch *batch);
+
+    /*
+     * 透传中剩余的消息体较大时通过splice从来源socket转发到目标socket，数据不经过用户态
+     *
+     * @param source: 数据来源socket
+     * @param target: 目标socket
+     * @param framer: 来源socket的分帧器
+     */
+    void spliceToPeer(DbusEndpoint *source, DbusEndpoint *target, DbusFramer *framer);
+
+    /*
+     * 客户端消息是否无需等待即可转发，不发起权限申请
+     *
+     * @param header: dbus消息报文头视图
+     *
+     * @return bool: true:可以转发 false:需要按完整消息处理
+     */
+    bool isForwardable(const HeaderView &header);
+
+    /*
+     * 读取客户端数据并转发给dbus-daemon
+     *
+     * @param boxClient: 客户端
+     */
+    void readClient(DbusEndpoint *boxClient);
+
+    /*
+     * 从dbus-daemon发来的消息报文头中获取客户端的unique name
+     *
+     * @param pair: 连接对
+     * @param data: 消息数据，至少包含完整的报文头
+     * @param size: 数据长度
+     */
+    void readUniqueName(DbusConnectionPair *pair, const char *data, int size);
+
+    /*
+     * 读取dbus-daemon数据并转发给客户端
+     *
+     * @param daemonClient: 与dbus-daemon连接的代理
+     */
+    void readServer(DbusEndpoint *daemonClient);
+
+    /*
+     * 转发一行握手消息，记录握手进度，握手完成后dbus-daemon方向进入dbus消息阶段
+     *
+     * @param pair: 连接对
+     * @param source: 消息来源socket
+     * @param frame: 握手消息
+     * @param batch: 本次读取的转发集合
+     */
+    void relayAuthLine(DbusConnectionPair *pair, DbusEndpoint *source, const DbusFrame &frame,
+                       DbusWriteBatch *batch);
+
+    /*
+     * 处理客户端发来的一条dbus消息，通过过滤及权限检查后转发给dbus-daemon，握手消息不经过这里
+     *
+     * @param boxClient: 客户端
+     * @param data: dbus消息数据，可以直接指向分帧器缓存
+     * @param size: 消息长度
+     * @param decision: 已获得的权限申请结果，为空时需要检查权限
+     * @param verdict: 策略线程对该消息的判定结果，为空时在当前线程或交给策略线程判定
+     * @param batch: 本次读取的转发集合，为空时直接写入
+     *
+     * @return bool: true:处理完成或已排队交给策略线程 false:需要等待权限申请结果
+     */
+    bool handleClientMessage(DbusEndpoint *boxClient, const char *data, int size, const PermissionDecision *decision,
+                             const DbusPolicyVerdict *verdict, DbusWriteBatch *batch);
+
+    /*
+     * 收到权限申请结果或策略线程判定后继续处理客户端等待队列中的消息
+     *
+     * @param boxClient: 客户端
+     * @param decision: 权限申请结果，队列中申请相同权限的消息均使用该结果，可以为空
+     * @param verdict: 策略线程返回的判定结果，对应最早提交且未返回的消息，可以为空
+     */
+    void resumeClient(DbusEndpoint *boxClient, const PermissionDecision *decision, const DbusPolicyVerdict *verdict);
+
+    /*
+     * 将socket中可读的数据读入分帧器缓存
+     *
+     * @param socket: 读取数据的socket
+     * @param framer: socket对应的分帧器
+     *
+     * @return bool: true:读到数据 false:无数据或读取失败
+     */
+    bool readToFramer(DbusEndpoint *socket, DbusFramer *framer);
+
+    /*
+     * 判断客户端消息是否匹配过滤规则，优先使用缓存的匹配结果
+     *
+     * @param header: dbus消息报文头视图
+     *
+     * @return bool: true: 是 false:否
+     */
+    bool isMessageMatch(const HeaderView &header);
 
 public:
     DbusFilter filter;
 
+    // 过滤规则匹配结果缓存，容量可通过DBUS_PROXY_VERDICT_CACHE_SIZE配置，每个工作线程一个
+    DbusVerdictCache verdictCache;
+
 private slots:
 
     void onNewConnection();
@@ -141,25 +415,113 @@ private slots:
 
     // dbus-daemon 服务端回调函数
     void onConnectedServer();
+    void onConnectFailedServer();
     void onReadyReadServer();
     void onDisconnectedServer();
 
+    // 待写数据发送完成一部分
+    void onBytesWritten();
+
+    // 检查连接dbus-daemon超时的连接对
+    void onConnectTimeout();
+
+    // 待接管队列中有新的客户端连接
+    void onPendingClients();
+
+    // 策略线程返回了判定结果
+    void onPolicyVerdicts();
+
+    // 权限申请返回
+    void onPermissionReply(QDBusPendingCallWatcher *watcher);
+    // 工作线程中的代理请求申请权限，结果通过其onOwnerPermissionReply返回
+    void onWorkerPermissionRequest(QObject *worker, const QString &appId, const QString &id);
+    // owner返回了代为申请的权限结果
+    void onOwnerPermissionReply(const QString &appId, const QString &id, int result);
+    // 本地控制信号
+    void onControlSignal();
+
 private:
+    // 接受客户端连接的代理，为空时为主线程中的代理
+    DbusProxy *owner;
+    // 使用的过滤规则，工作线程中为owner的过滤规则
+    const DbusFilter *rules;
+
+    // I/O引擎，可通过DBUS_PROXY_ENGINE选择 qt epoll io_uring，每个工作线程一个
+    QScopedPointer<DbusEngine> engine;
+
     // dbus-proxy server, wait for dbus client in box to connect
-    QScopedPointer<QLocalServer> serverProxy;
+    QScopedPointer<DbusListener> serverProxy;
 
-    // boxclient & proxy client map
-    QMap<QLocalSocket *, QLocalSocket *> relations;
-    // proxy client connect status map
-    QMap<QLocalSocket *, bool> connStatus;
+    // 当前代理处理的所有连接对，两端socket通过context指向所属的连接对
+    QSet<DbusConnectionPair *> pairs;
+    // 正在连接dbus-daemon的连接对，有连接对时connectTimer定时检查超时
+    QSet<DbusConnectionPair *> connectingPairs;
+    QTimer connectTimer;
 
-    // 客户端地址
-    QString boxClientAddr;
+    // 未返回的权限申请
+    struct PendingPermission {
+        QString appId;
+        QString id;
+        // 等待申请结果的客户端，断开连接后移除
+        QList<DbusEndpoint *> clients;
+        // 等待申请结果的工作线程中的代理
+        QList<QObject *> workers;
+    };
+    QMap<QDBusPendingCallWatcher *, PendingPermission> pendingPermissions;
+    // (appId, 权限id) & 未返回的权限申请 map，相同的申请同一时间只有一个
+    QHash<QPair<QString, QString>, QDBusPendingCallWatcher *> inflightPermissions;
+    // 工作线程中交给owner申请的权限，(appId, 权限id) & 等待结果的客户端，相同的申请只交给owner一次
+    QHash<QPair<QString, QString>, QList<DbusEndpoint *>> forwardedPermissions;
 
     // dbus-daemon path
     QString daemonPath;
 
     QString appId;
+
+    // 是否拦截匹配过滤规则的消息并申请权限，通过DBUS_PROXY_INTERCEPT开启
+    bool isIntercepting;
+    // dbus信息到权限id的映射表，所有工作线程共用
+    QSharedPointer<DbusPermissionMap> permissionMap;
+    // 权限申请结果缓存，有效期可通过DBUS_PROXY_PERMISSION_TTL配置，单位秒，所有工作线程共用
+    QSharedPointer<DbusPermissionCache> permissionCache;
+    // 控制信号通知
+    QScopedPointer<QSocketNotifier> controlNotifier;
+
+    // 写缓存高低水位，可通过DBUS_PROXY_HIGH_WATERMARK/DBUS_PROXY_LOW_WATERMARK配置，单位字节
+    qint64 highWatermark;
+    qint64 lowWatermark;
+
+    // 透传中剩余消息体不小于该长度时通过splice转发，可通过DBUS_PROXY_SPLICE_THRESHOLD配置，0表示关闭
+    qint64 spliceThreshold;
+    // 同一线程中所有连接共用的splice管道
+    DbusSplicePipe splicePipe;
+
+    // 工作线程数，可通过DBUS_PROXY_WORKERS配置，默认为CPU核数，不大于1时在主线程中处理所有连接
+    int workerCount;
+    QList<DbusProxyWorker *> workers;
+    // 下一个连接分配到的工作线程
+    int nextWorker;
+    // 接受连接的线程交给当前代理的客户端socket
+    DbusSpscQueue<int> pendingClients;
+    // 是否已安排在事件循环中接管pendingClients
+    std::atomic<bool> isAdoptScheduled;
+
+    // 策略线程数，可通过DBUS_PROXY_POLICY_THREADS配置，默认为0，在I/O线程中完成过滤规则匹配及权限查询
+    int policyThreads;
+    QList<DbusPolicyStage *> policyStages;
+    // 下一个通道分配到的策略线程
+    int nextPolicyStage;
+    // 当前代理与策略线程之间的通道，未配置策略线程或当前代理不处理连接时为空
+    QScopedPointer<DbusPolicyLane> policyLane;
+    // 下一次提交的编号，从1开始
+    quint64 nextPolicyTicket;
+
+    // 各阶段队列深度统计：等待权限申请结果的消息数及其峰值，目标socket待写数据峰值
+    int heldMessages;
+    int heldMessagesPeak;
+    qint64 writeBacklogPeak;
+    // 拒绝访问时回复给客户端的错误消息，同一线程中所有连接共用
+    DbusErrorReply accessDenied;
     // 授权模块返回值
     enum Choice { Allow = 0, Deny};
 };
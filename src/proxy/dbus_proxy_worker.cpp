@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_proxy_worker.h"
+
+#include <QCoreApplication>
+
+#include "proxy/dbus_proxy.h"
+
+DbusProxyWorker::DbusProxyWorker(DbusProxy *owner, QObject *parent)
+    : QThread(parent)
+    , owner(owner)
+    , proxy(nullptr)
+{
+}
+
+DbusProxyWorker::~DbusProxyWorker()
+{
+    quit();
+    wait();
+}
+
+/*
+ * 启动线程并等待线程中的代理创建完成
+ */
+void DbusProxyWorker::startWorker()
+{
+    start();
+    ready.acquire();
+}
+
+/*
+ * 将已接受的客户端连接交给工作线程处理
+ *
+ * @param fd: 客户端socket，成功后归工作线程所有
+ *
+ * @return bool: true:成功 false:失败
+ */
+bool DbusProxyWorker::dispatch(int fd)
+{
+    if (!proxy) {
+        return false;
+    }
+    return proxy->dispatchClient(fd);
+}
+
+/*
+ * 已分配给工作线程但尚未接管的客户端连接数
+ *
+ * @return int: 连接数
+ */
+int DbusProxyWorker::pendingClients() const
+{
+    return proxy ? proxy->pendingClientCount() : 0;
+}
+
+void DbusProxyWorker::run()
+{
+    // 代理及其I/O引擎需要在工作线程中创建
+    DbusProxy worker(owner);
+    proxy = &worker;
+    ready.release();
+    exec();
+    proxy = nullptr;
+    // 已断开的连接需要在I/O引擎销毁前释放
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+}
@@ -0,0 +1,63 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_PROXY_WORKER_H
+#define LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_PROXY_WORKER_H
+
+#include <QSemaphore>
+#include <QThread>
+
+class DbusProxy;
+
+/*
+ * 代理工作线程
+ *
+ * 线程中运行一个独立的代理，使用自己的I/O引擎及事件循环，分配到该线程的客户端及其与dbus-daemon的连接
+ * 只在该线程中处理；过滤规则及权限状态与接受连接的代理共用
+ */
+class DbusProxyWorker : public QThread
+{
+    Q_OBJECT
+
+public:
+    /*
+     * @param owner: 接受客户端连接的代理
+     * @param parent: 父对象
+     */
+    explicit DbusProxyWorker(DbusProxy *owner, QObject *parent = nullptr);
+    ~DbusProxyWorker() override;
+
+    /*
+     * 启动线程并等待线程中的代理创建完成
+     */
+    void startWorker();
+
+    /*
+     * 将已接受的客户端连接交给工作线程处理
+     *
+     * @param fd: 客户端socket，成功后归工作线程所有
+     *
+     * @return bool: true:成功 false:失败
+     */
+    bool dispatch(int fd);
+
+    /*
+     * 已分配给工作线程但尚未接管的客户端连接数
+     *
+     * @return int: 连接数
+     */
+    int pendingClients() const;
+
+protected:
+    void run() override;
+
+private:
+    DbusProxy *owner;
+    // 线程中的代理，线程运行期间有效
+    DbusProxy *proxy;
+    QSemaphore ready;
+};
+#endif
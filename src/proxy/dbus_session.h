@@ -0,0 +1,219 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_SESSION_H
+#define LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_SESSION_H
+
+#include <cstring>
+
+#include <QList>
+#include <QString>
+
+#include "message/dbus_message.h"
+
+// dbus-daemon自身的服务名及接口名
+static const char kDbusService[] = "org.freedesktop.DBus";
+
+/*
+ * 单个客户端连接的会话状态
+ *
+ * 记录握手进度、协商的特性及dbus-daemon分配的unique name，
+ * 同一应用的多个连接各自持有，伪造的回复消息按连接自己的unique name发送。
+ * 握手阶段两个方向都按行转发，客户端可以不等回复连续发送AUTH、NEGOTIATE_UNIX_FD及BEGIN，
+ * dbus-daemon对BEGIN之外的每条命令回复一行，回复完后dbus-daemon方向才进入dbus消息阶段
+ */
+struct DbusSession {
+    enum class AuthState {
+        // 两个方向都按行转发握手消息
+        Handshake,
+        // 客户端已发送BEGIN，dbus-daemon还有未回复的握手命令
+        WaitingReplies,
+        // 两个方向都只有dbus消息，不再检查握手消息
+        Running
+    };
+
+    DbusSession()
+        : authState(AuthState::Handshake)
+        , pendingReplies(0)
+        , isAuthenticated(false)
+        , isUnixFdRequested(false)
+        , isUnixFdAgreed(false)
+        , helloSerial(0)
+        , canPassDescriptors(true)
+    {
+    }
+
+    /*
+     * 记录客户端发送的一行握手消息
+     *
+     * @param line: 握手消息，以"\r\n"结尾，第一行前可能有credentials字节
+     * @param size: 消息长度
+     *
+     * @return bool: true:转发给dbus-daemon false:由代理回复，通过takeLocalReplies按顺序取出
+     */
+    bool readClientLine(const char *line, int size)
+    {
+        if (authState != AuthState::Handshake) {
+            return true;
+        }
+        if (size > 0 && *line == '\0') {
+            line++;
+            size--;
+        }
+        // 与分帧器一致，只有完整的"BEGIN\r\n"结束握手
+        if (size == 7 && isCommand(line, size, "BEGIN")) {
+            authState = pendingReplies > 0 ? AuthState::WaitingReplies : AuthState::Running;
+            return true;
+        }
+        if (isCommand(line, size, "NEGOTIATE_UNIX_FD")) {
+            isUnixFdRequested = true;
+            // 代理不能传递文件描述符时不让dbus-daemon同意，由代理在之前的回复之后回复ERROR
+            if (!canPassDescriptors) {
+                localReplies.append(pendingReplies);
+                return false;
+            }
+        }
+        pendingReplies++;
+        return true;
+    }
+
+    /*
+     * 记录dbus-daemon回复的一行握手消息
+     *
+     * @param line: 握手消息，以"\r\n"结尾
+     * @param size: 消息长度
+     */
+    void readDaemonLine(const char *line, int size)
+    {
+        if (authState == AuthState::Running) {
+            return;
+        }
+        if (isCommand(line, size, "OK")) {
+            isAuthenticated = true;
+        } else if (isCommand(line, size, "AGREE_UNIX_FD")) {
+            isUnixFdAgreed = true;
+        }
+        if (pendingReplies > 0) {
+            pendingReplies--;
+        }
+        for (int &before : localReplies) {
+            if (before > 0) {
+                before--;
+            }
+        }
+        if (authState == AuthState::WaitingReplies && pendingReplies == 0) {
+            authState = AuthState::Running;
+        }
+    }
+
+    /*
+     * 取出已到发送时机的代理回复，之前的dbus-daemon回复都已转发
+     *
+     * @return int: 需要发送给客户端的ERROR回复数
+     */
+    int takeLocalReplies()
+    {
+        int count = 0;
+        while (!localReplies.isEmpty() && localReplies.first() == 0) {
+            localReplies.removeFirst();
+            count++;
+        }
+        return count;
+    }
+
+    /*
+     * 记录客户端发送的dbus消息报文头，获取unique name前用于找到Hello调用
+     *
+     * @param header: 报文头视图
+     */
+    void readClientHeader(const HeaderView &header)
+    {
+        if (helloSerial == 0 && header.type == (int)MessageType::METHOD_CALL
+            && header.member == QLatin1String("Hello") && header.destination == QLatin1String(kDbusService)) {
+            helloSerial = header.serial;
+        }
+    }
+
+    /*
+     * 根据dbus-daemon发来的dbus消息报文头获取unique name，不检查消息body
+     *
+     * Hello的回复及NameAcquired信号的destination都是dbus-daemon分配的unique name
+     *
+     * @param header: 报文头视图
+     *
+     * @return bool: true:获取到unique name false:不是相关消息
+     */
+    bool readDaemonHeader(const HeaderView &header)
+    {
+        if (header.destination.isEmpty()) {
+            return false;
+        }
+        bool isHelloReply = header.type == (int)MessageType::METHOD_RETURN && header.hasReplySerial
+                            && helloSerial != 0 && header.replySerial == helloSerial;
+        bool isNameAcquired = header.type == (int)MessageType::SIGNAL
+                              && header.member == QLatin1String("NameAcquired")
+                              && header.interface == QLatin1String(kDbusService)
+                              && header.sender == QLatin1String(kDbusService);
+        if (!isHelloReply && !isNameAcquired) {
+            return false;
+        }
+        uniqueName = header.destination;
+        return true;
+    }
+
+    /*
+     * 握手是否已完成，完成后两个方向都按dbus消息分帧
+     *
+     * @return bool: true:已完成 false:握手中
+     */
+    bool isRunning() const { return authState == AuthState::Running; }
+
+    /*
+     * 是否已协商通过unix fd传递
+     *
+     * @return bool: true:双方同意 false:未协商或被拒绝
+     */
+    bool isUnixFdEnabled() const { return isUnixFdRequested && isUnixFdAgreed; }
+
+    // dbus-daemon为该连接分配的unique name，从Hello的回复或NameAcquired中获取，为空时需要检查dbus-daemon的消息
+    QString uniqueName;
+    AuthState authState;
+    // 客户端已发送、dbus-daemon还未回复的握手命令数
+    int pendingReplies;
+    // dbus-daemon回复了OK
+    bool isAuthenticated;
+    // 客户端发送了NEGOTIATE_UNIX_FD
+    bool isUnixFdRequested;
+    // dbus-daemon回复了AGREE_UNIX_FD
+    bool isUnixFdAgreed;
+    // 客户端Hello调用的serial，未发送时为0
+    quint32 helloSerial;
+    // 两端连接都能传递文件描述符，为false时代理拒绝NEGOTIATE_UNIX_FD
+    bool canPassDescriptors;
+    // 由代理回复的握手命令，值为回复前还需转发的dbus-daemon回复数
+    QList<int> localReplies;
+
+private:
+    /*
+     * 判断握手消息是否为指定命令
+     *
+     * @param line: 握手消息
+     * @param size: 消息长度
+     * @param command: 命令名
+     *
+     * @return bool: true:是 false:否
+     */
+    static bool isCommand(const char *line, int size, const char *command)
+    {
+        int length = static_cast<int>(strlen(command));
+        if (size < length || memcmp(line, command, length) != 0) {
+            return false;
+        }
+        // 命令后为参数或行尾
+        return size == length || line[length] == ' ' || line[length] == '\r';
+    }
+};
+#endif
@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_splice_pipe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <QDebug>
+
+// 期望的管道容量，超过系统限制时使用默认容量
+static const int kPipeSize = 256 * 1024;
+
+DbusSplicePipe::DbusSplicePipe()
+    : capacity(0)
+    , syscallCount(0)
+{
+    if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        qWarning() << "create splice pipe failed:" << strerror(errno);
+        fds[0] = -1;
+        fds[1] = -1;
+        return;
+    }
+    capacity = ::fcntl(fds[1], F_SETPIPE_SZ, kPipeSize);
+    if (capacity < 0) {
+        capacity = ::fcntl(fds[1], F_GETPIPE_SZ);
+    }
+}
+
+DbusSplicePipe::~DbusSplicePipe()
+{
+    if (fds[0] >= 0) {
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+}
+
+/*
+ * 非阻塞地将sourceFd中最多size字节转发到targetFd
+ * sourceFd无数据时返回，targetFd不可写时管道中剩余的数据读出到stalled，由调用方写入目标socket写缓存
+ *
+ * @param sourceFd: 来源socket
+ * @param targetFd: 目标socket
+ * @param size: 最多转发的字节数
+ * @param stalled: 未能写入targetFd的数据
+ *
+ * @return qint64: 从sourceFd取出的字节数
+ */
+qint64 DbusSplicePipe::transfer(int sourceFd, int targetFd, qint64 size, QByteArray *stalled)
+{
+    if (!isValid() || capacity <= 0) {
+        return 0;
+    }
+    qint64 total = 0;
+    while (total < size) {
+        ssize_t in = ::splice(sourceFd, nullptr, fds[1], nullptr, qMin<qint64>(size - total, capacity),
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        syscallCount++;
+        if (in < 0 && errno == EINTR) {
+            continue;
+        }
+        // 来源无数据、对端关闭或出错，由调用方之后的读取处理
+        if (in <= 0) {
+            break;
+        }
+        total += in;
+        qint64 buffered = in;
+        while (buffered > 0) {
+            ssize_t out = ::splice(fds[0], nullptr, targetFd, nullptr, buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            syscallCount++;
+            if (out < 0 && errno == EINTR) {
+                continue;
+            }
+            if (out <= 0) {
+                // 目标不可写或出错，管道中的数据交给目标socket写缓存
+                drain(buffered, stalled);
+                return total;
+            }
+            buffered -= out;
+        }
+    }
+    return total;
+}
+
+/*
+ * 将管道中的数据读出
+ *
+ * @param size: 管道中的字节数
+ * @param data: 读出的数据
+ */
+void DbusSplicePipe::drain(qint64 size, QByteArray *data)
+{
+    int offset = data->size();
+    data->resize(offset + size);
+    while (size > 0) {
+        ssize_t ret = ::read(fds[0], data->data() + offset, size);
+        syscallCount++;
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        offset += ret;
+        size -= ret;
+    }
+    data->resize(offset);
+}
@@ -0,0 +1,60 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_SPLICE_PIPE_H
+#define LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_SPLICE_PIPE_H
+
+#include <QByteArray>
+
+/*
+ * 通过splice在两个socket之间转发数据的管道
+ *
+ * 数据经socket->管道->socket在内核中转发，不拷贝到用户态，
+ * 每次transfer返回时管道均已排空，多个连接可以共用一个管道
+ */
+class DbusSplicePipe
+{
+public:
+    DbusSplicePipe();
+    ~DbusSplicePipe();
+
+    /*
+     * 管道是否创建成功
+     *
+     * @return bool: true:成功 false:失败
+     */
+    bool isValid() const { return fds[0] >= 0; }
+
+    /*
+     * 非阻塞地将sourceFd中最多size字节转发到targetFd
+     * sourceFd无数据时返回，targetFd不可写时管道中剩余的数据读出到stalled，由调用方写入目标socket写缓存
+     *
+     * @param sourceFd: 来源socket
+     * @param targetFd: 目标socket
+     * @param size: 最多转发的字节数
+     * @param stalled: 未能写入targetFd的数据
+     *
+     * @return qint64: 从sourceFd取出的字节数
+     */
+    qint64 transfer(int sourceFd, int targetFd, qint64 size, QByteArray *stalled);
+
+    quint64 syscalls() const { return syscallCount; }
+
+private:
+    /*
+     * 将管道中的数据读出
+     *
+     * @param size: 管道中的字节数
+     * @param data: 读出的数据
+     */
+    void drain(qint64 size, QByteArray *data);
+
+    int fds[2];
+    // 管道容量
+    int capacity;
+    quint64 syscallCount;
+};
+#endif
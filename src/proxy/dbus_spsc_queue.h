@@ -0,0 +1,128 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_SPSC_QUEUE_H
+#define LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_SPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+
+#include <QVector>
+
+/*
+ * 单生产者单消费者无锁环形队列
+ *
+ * push只能在生产者线程调用，pop只能在消费者线程调用，size及peakSize可以在任意线程读取。
+ * 容量向上取整为2的幂，满时push失败，由调用方决定如何处理
+ */
+template<typename T>
+class DbusSpscQueue
+{
+public:
+    /*
+     * @param capacity: 队列容量
+     */
+    explicit DbusSpscQueue(int capacity)
+        : head(0)
+        , tail(0)
+        , peak(0)
+    {
+        quint32 size = 2;
+        while (size < static_cast<quint32>(capacity)) {
+            size <<= 1;
+        }
+        items.resize(size);
+        mask = size - 1;
+    }
+
+    /*
+     * 加入队尾，只能在生产者线程调用
+     *
+     * @param item: 数据
+     *
+     * @return bool: true:成功 false:队列已满
+     */
+    bool push(const T &item)
+    {
+        quint32 currentTail = tail.load(std::memory_order_relaxed);
+        quint32 depth = currentTail - head.load(std::memory_order_acquire);
+        if (depth > mask) {
+            return false;
+        }
+        items[currentTail & mask] = item;
+        publish(currentTail, depth);
+        return true;
+    }
+
+    /*
+     * 移入队尾，调用方不再持有数据，只能在生产者线程调用
+     *
+     * @param item: 数据，成功后不再使用
+     *
+     * @return bool: true:成功 false:队列已满
+     */
+    bool push(T &&item)
+    {
+        quint32 currentTail = tail.load(std::memory_order_relaxed);
+        quint32 depth = currentTail - head.load(std::memory_order_acquire);
+        if (depth > mask) {
+            return false;
+        }
+        items[currentTail & mask] = std::move(item);
+        publish(currentTail, depth);
+        return true;
+    }
+
+    /*
+     * 取出队首，只能在消费者线程调用
+     *
+     * @param item: 取出的数据
+     *
+     * @return bool: true:成功 false:队列为空
+     */
+    bool pop(T *item)
+    {
+        quint32 currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *item = items[currentHead & mask];
+        items[currentHead & mask] = T();
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 当前队列深度，其它线程读取时为近似值
+    int size() const
+    {
+        // 先读head，之后读到的tail不会小于head
+        quint32 currentHead = head.load(std::memory_order_acquire);
+        return static_cast<int>(tail.load(std::memory_order_acquire) - currentHead);
+    }
+
+    // 队列深度峰值
+    int peakSize() const { return static_cast<int>(peak.load(std::memory_order_relaxed)); }
+
+    int capacity() const { return items.size(); }
+
+private:
+    // 数据写入后对消费者可见，并更新深度峰值
+    void publish(quint32 currentTail, quint32 depth)
+    {
+        tail.store(currentTail + 1, std::memory_order_release);
+        if (depth + 1 > peak.load(std::memory_order_relaxed)) {
+            peak.store(depth + 1, std::memory_order_relaxed);
+        }
+    }
+
+    QVector<T> items;
+    quint32 mask;
+    // 生产者与消费者各自修改的位置放在不同的缓存行，避免伪共享
+    alignas(64) std::atomic<quint32> head;
+    alignas(64) std::atomic<quint32> tail;
+    std::atomic<quint32> peak;
+};
+#endif
@@ -0,0 +1,135 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "dbus_write_batch.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/socket.h>
+
+DbusWriteBatch::DbusWriteBatch()
+    : messageCount(0)
+    , totalSize(0)
+    , syscallCount(0)
+{
+}
+
+/*
+ * 添加一条待发送的报文，不拷贝数据
+ *
+ * @param data: 报文地址
+ * @param size: 报文长度
+ */
+void DbusWriteBatch::append(const char *data, int size)
+{
+    if (size <= 0) {
+        return;
+    }
+    messageCount++;
+    totalSize += size;
+    // 与上一条报文地址连续时合并
+    if (!iovecs.isEmpty()) {
+        struct iovec &last = iovecs.last();
+        if (static_cast<const char *>(last.iov_base) + last.iov_len == data) {
+            last.iov_len += size;
+            return;
+        }
+    }
+    struct iovec vec;
+    vec.iov_base = const_cast<char *>(data);
+    vec.iov_len = size;
+    iovecs.append(vec);
+}
+
+/*
+ * 通过sendmsg非阻塞发送所有报文，未发送完的数据拷贝到remainder中
+ * 发送后需要clear才能复用
+ *
+ * @param fd: 目标socket
+ * @param remainder: 未发送完的数据
+ *
+ * @return qint64: 已发送的字节数
+ */
+qint64 DbusWriteBatch::writeTo(int fd, QByteArray *remainder)
+{
+    qint64 written = 0;
+    int index = 0;
+    while (index < iovecs.size()) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iovecs.data() + index;
+        msg.msg_iovlen = qMin(iovecs.size() - index, IOV_MAX);
+        // 对端关闭时不触发SIGPIPE，由调用方处理写入错误
+        ssize_t ret = ::sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        syscallCount++;
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        written += ret;
+        // 跳过已发送的数据，部分发送的iovec调整起始地址
+        while (ret > 0) {
+            struct iovec &vec = iovecs[index];
+            if (static_cast<size_t>(ret) >= vec.iov_len) {
+                ret -= vec.iov_len;
+                index++;
+            } else {
+                vec.iov_base = static_cast<char *>(vec.iov_base) + ret;
+                vec.iov_len -= ret;
+                ret = 0;
+            }
+        }
+    }
+
+    // 保留remainder的容量，复用缓存池中的缓存
+    remainder->resize(0);
+    if (index < iovecs.size()) {
+        remainder->reserve(totalSize - written);
+        for (int i = index; i < iovecs.size(); i++) {
+            remainder->append(static_cast<const char *>(iovecs.at(i).iov_base), iovecs.at(i).iov_len);
+        }
+    }
+    return written;
+}
+
+/*
+ * 将所有报文拷贝为一个字节数组
+ *
+ * @return QByteArray: 所有报文数据
+ */
+QByteArray DbusWriteBatch::toByteArray() const
+{
+    QByteArray data;
+    copyTo(&data);
+    return data;
+}
+
+/*
+ * 将所有报文拷贝到指定缓存中，缓存容量足够时不分配内存
+ *
+ * @param data: 输出缓存，原有数据被覆盖
+ */
+void DbusWriteBatch::copyTo(QByteArray *data) const
+{
+    data->resize(0);
+    data->reserve(totalSize);
+    for (const struct iovec &vec : iovecs) {
+        data->append(static_cast<const char *>(vec.iov_base), vec.iov_len);
+    }
+}
+
+/*
+ * 清空报文，保留已分配的iovec空间供下次读取复用，不影响系统调用计数
+ */
+void DbusWriteBatch::clear()
+{
+    iovecs.clear();
+    messageCount = 0;
+    totalSize = 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_WRITE_BATCH_H
+#define LINGLONG_DBUS_PROXY_SRC_PROXY_DBUS_WRITE_BATCH_H
+
+#include <sys/uio.h>
+
+#include <QByteArray>
+#include <QVector>
+
+/*
+ * 一次读取中需要转发的报文集合
+ *
+ * 只记录报文在接收缓存中的地址，地址连续的报文合并为一个iovec，
+ * 通过一次sendmsg发送，调用writeTo前数据需要保持有效
+ */
+class DbusWriteBatch
+{
+public:
+    DbusWriteBatch();
+
+    /*
+     * 添加一条待发送的报文，不拷贝数据
+     *
+     * @param data: 报文地址
+     * @param size: 报文长度
+     */
+    void append(const char *data, int size);
+
+    /*
+     * 通过sendmsg非阻塞发送所有报文，未发送完的数据拷贝到remainder中
+     * 发送后需要clear才能复用
+     *
+     * @param fd: 目标socket
+     * @param remainder: 未发送完的数据
+     *
+     * @return qint64: 已发送的字节数
+     */
+    qint64 writeTo(int fd, QByteArray *remainder);
+
+    /*
+     * 将所有报文拷贝为一个字节数组
+     *
+     * @return QByteArray: 所有报文数据
+     */
+    QByteArray toByteArray() const;
+
+    /*
+     * 将所有报文拷贝到指定缓存中，缓存容量足够时不分配内存
+     *
+     * @param data: 输出缓存，原有数据被覆盖
+     */
+    void copyTo(QByteArray *data) const;
+
+    /*
+     * 清空报文，保留已分配的iovec空间供下次读取复用，不影响系统调用计数
+     */
+    void clear();
+
+    bool isEmpty() const { return iovecs.isEmpty(); }
+    int count() const { return messageCount; }
+    qint64 size() const { return totalSize; }
+    int iovecCount() const { return iovecs.size(); }
+    quint64 syscalls() const { return syscallCount; }
+
+private:
+    QVector<struct iovec> iovecs;
+    int messageCount;
+    qint64 totalSize;
+    quint64 syscallCount;
+};
+#endif
@@ -0,0 +1,467 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <QScopedPointer>
+#include <QTemporaryDir>
+
+#include "engine/dbus_endpoint.h"
+#include "engine/dbus_epoll_engine.h"
+#include "engine/dbus_uring_engine.h"
+
+// 读出连接中当前可读的所有数据
+static QByteArray readAll(DbusEndpoint *endpoint)
+{
+    QByteArray data;
+    char buf[65536];
+    qint64 ret;
+    while ((ret = endpoint->read(buf, sizeof(buf))) > 0) {
+        data.append(buf, ret);
+    }
+    return data;
+}
+
+TEST(engine, engine01)
+{
+    QScopedPointer<DbusEngine> epollEngine(DbusEngine::create("epoll"));
+    EXPECT_EQ(epollEngine->name(), "epoll");
+    QScopedPointer<DbusEngine> qtEngine(DbusEngine::create(""));
+    EXPECT_EQ(qtEngine->name(), "qt");
+    QScopedPointer<DbusEngine> unknownEngine(DbusEngine::create("unknown"));
+    EXPECT_EQ(unknownEngine->name(), "qt");
+}
+
+TEST(engine, epoll01)
+{
+    DbusEpollEngine engine;
+    ASSERT_TRUE(engine.init());
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString socketPath = dir.path() + "/bus";
+
+    QScopedPointer<DbusListener> listener(engine.createListener());
+    ASSERT_TRUE(listener->listen(socketPath));
+    EXPECT_EQ(listener->nextPendingConnection(), nullptr);
+
+    QScopedPointer<DbusEndpoint> client(engine.createEndpoint());
+    client->connectToServer(socketPath);
+    ASSERT_TRUE(client->waitForConnected(1000));
+    EXPECT_TRUE(client->isConnected());
+
+    engine.processEvents();
+    DbusEndpoint *server = listener->nextPendingConnection();
+    ASSERT_NE(server, nullptr);
+    EXPECT_TRUE(server->isConnected());
+
+    // 直接发送，不经过写缓存
+    EXPECT_EQ(client->write("AUTH EXTERNAL\r\n"), 15);
+    EXPECT_EQ(client->bytesToWrite(), 0);
+    engine.processEvents();
+    EXPECT_EQ(readAll(server), QByteArray("AUTH EXTERNAL\r\n"));
+
+    // 对端不读取时数据留在写缓存中
+    QByteArray large(1024 * 1024, 'x');
+    for (int i = 0; i < 8 && server->bytesToWrite() == 0; i++) {
+        EXPECT_EQ(server->write(large), large.size());
+    }
+    EXPECT_GT(server->bytesToWrite(), 0);
+    qint64 total = 0;
+    for (int i = 0; i < 10000 && (server->bytesToWrite() > 0 || total == 0); i++) {
+        total += readAll(client.data()).size();
+        engine.processEvents();
+    }
+    EXPECT_EQ(server->bytesToWrite(), 0);
+    readAll(client.data());
+
+    // 写缓存发送完后才关闭连接
+    server->write(large);
+    server->disconnectFromServer();
+    EXPECT_FALSE(server->isConnected());
+    qint64 received = 0;
+    bool isClosed = false;
+    for (int i = 0; i < 10000 && !isClosed; i++) {
+        char buf[65536];
+        qint64 ret;
+        while ((ret = client->read(buf, sizeof(buf))) > 0) {
+            received += ret;
+        }
+        isClosed = ret < 0;
+        engine.processEvents();
+    }
+    EXPECT_TRUE(isClosed);
+    EXPECT_EQ(received, large.size());
+
+    listener->close();
+    QScopedPointer<DbusEndpoint> refused(engine.createEndpoint());
+    refused->connectToServer(socketPath);
+    EXPECT_FALSE(refused->waitForConnected(100));
+}
+
+TEST(engine, adopt01)
+{
+    // 监听socket与连接属于不同的引擎，模拟主线程接受连接后交给工作线程
+    DbusEpollEngine acceptEngine;
+    ASSERT_TRUE(acceptEngine.init());
+    DbusEpollEngine workerEngine;
+    ASSERT_TRUE(workerEngine.init());
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString socketPath = dir.path() + "/bus";
+
+    QScopedPointer<DbusListener> listener(acceptEngine.createListener());
+    ASSERT_TRUE(listener->listen(socketPath));
+    EXPECT_EQ(listener->nextPendingDescriptor(), -1);
+
+    QScopedPointer<DbusEndpoint> client(workerEngine.createEndpoint());
+    client->connectToServer(socketPath);
+    ASSERT_TRUE(client->waitForConnected(1000));
+    // 接受前已发送的数据留在socket中，由接管连接的引擎读取
+    EXPECT_EQ(client->write("AUTH EXTERNAL\r\n"), 15);
+
+    acceptEngine.processEvents();
+    int fd = listener->nextPendingDescriptor();
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(listener->nextPendingConnection(), nullptr);
+
+    QScopedPointer<DbusEndpoint> server(workerEngine.adoptEndpoint(fd));
+    ASSERT_TRUE(server->isConnected());
+    EXPECT_EQ(server->socketDescriptor(), fd);
+    workerEngine.processEvents();
+    EXPECT_EQ(readAll(server.data()), QByteArray("AUTH EXTERNAL\r\n"));
+    EXPECT_EQ(server->write("OK\r\n"), 4);
+    workerEngine.processEvents();
+    EXPECT_EQ(readAll(client.data()), QByteArray("OK\r\n"));
+
+    // 未取出的连接随监听socket关闭
+    QScopedPointer<DbusEndpoint> pending(workerEngine.createEndpoint());
+    pending->connectToServer(socketPath);
+    ASSERT_TRUE(pending->waitForConnected(1000));
+    acceptEngine.processEvents();
+    listener.reset();
+    bool isClosed = false;
+    for (int i = 0; i < 10000 && !isClosed; i++) {
+        char buf[16];
+        isClosed = pending->read(buf, sizeof(buf)) < 0;
+        workerEngine.processEvents();
+    }
+    EXPECT_TRUE(isClosed);
+}
+
+TEST(engine, connect01)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString socketPath = dir.path() + "/bus";
+    // 连接结果通过信号通知，调用方不需要等待连接完成
+    const char *names[] = {"epoll", "io_uring"};
+    for (const char *name : names) {
+        QScopedPointer<DbusEngine> engine(DbusEngine::create(name));
+        int connected = 0;
+        int failed = 0;
+        QScopedPointer<DbusEndpoint> missing(engine->createEndpoint());
+        QObject::connect(missing.data(), &DbusEndpoint::connectFailed, [&failed]() { failed++; });
+        missing->connectToServer(socketPath);
+        EXPECT_EQ(failed, 1);
+        EXPECT_FALSE(missing->isConnected());
+        EXPECT_FALSE(missing->errorString().isEmpty());
+
+        QScopedPointer<DbusListener> listener(engine->createListener());
+        ASSERT_TRUE(listener->listen(socketPath));
+        QScopedPointer<DbusEndpoint> client(engine->createEndpoint());
+        QObject::connect(client.data(), &DbusEndpoint::connected, [&connected]() { connected++; });
+        QObject::connect(client.data(), &DbusEndpoint::connectFailed, [&failed]() { failed++; });
+        client->connectToServer(socketPath);
+        EXPECT_EQ(connected, 1);
+        EXPECT_EQ(failed, 1);
+        EXPECT_TRUE(client->isConnected());
+        listener->close();
+    }
+}
+
+TEST(engine, fds01)
+{
+    DbusEpollEngine engine;
+    ASSERT_TRUE(engine.init());
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString socketPath = dir.path() + "/bus";
+
+    QScopedPointer<DbusListener> listener(engine.createListener());
+    ASSERT_TRUE(listener->listen(socketPath));
+    QScopedPointer<DbusEndpoint> client(engine.createEndpoint());
+    client->connectToServer(socketPath);
+    ASSERT_TRUE(client->isConnected());
+    engine.processEvents();
+    QScopedPointer<DbusEndpoint> server(listener->nextPendingConnection());
+    ASSERT_FALSE(server.isNull());
+    EXPECT_TRUE(client->canPassDescriptors());
+
+    // 文件描述符随数据发送，发送后由连接关闭本端的副本
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+    QVector<int> sent;
+    sent.append(fds[0]);
+    EXPECT_EQ(client->writeWithDescriptors("hello", sent), 5);
+    EXPECT_EQ(readAll(server.data()), QByteArray("hello"));
+    EXPECT_EQ(server->pendingDescriptors(), 1);
+    QVector<int> received;
+    EXPECT_FALSE(server->takeDescriptors(2, &received));
+    ASSERT_TRUE(server->takeDescriptors(1, &received));
+    ASSERT_EQ(received.size(), 1);
+    EXPECT_EQ(::write(fds[1], "x", 1), 1);
+    char c = 0;
+    EXPECT_EQ(::read(received.at(0), &c, 1), 1);
+    EXPECT_EQ(c, 'x');
+    ::close(received.at(0));
+
+    // 写缓存中有数据时文件描述符随消息排队，之前的数据先发送
+    QByteArray large(1024 * 1024, 'x');
+    for (int i = 0; i < 8 && client->bytesToWrite() == 0; i++) {
+        client->write(large);
+    }
+    ASSERT_GT(client->bytesToWrite(), 0);
+    int queued[2];
+    ASSERT_EQ(::pipe(queued), 0);
+    sent.clear();
+    sent.append(queued[0]);
+    EXPECT_EQ(client->writeWithDescriptors("world", sent), 5);
+    QByteArray data;
+    for (int i = 0; i < 10000 && !data.endsWith("world"); i++) {
+        data.append(readAll(server.data()));
+        engine.processEvents();
+    }
+    EXPECT_TRUE(data.endsWith("world"));
+    ASSERT_TRUE(server->takeDescriptors(1, &received));
+    EXPECT_EQ(::write(queued[1], "y", 1), 1);
+    EXPECT_EQ(::read(received.at(0), &c, 1), 1);
+    EXPECT_EQ(c, 'y');
+    ::close(received.at(0));
+    ::close(fds[1]);
+    ::close(queued[1]);
+}
+
+TEST(engine, fds02)
+{
+    DbusEpollEngine engine;
+    ASSERT_TRUE(engine.init());
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString socketPath = dir.path() + "/bus";
+
+    QScopedPointer<DbusListener> listener(engine.createListener());
+    ASSERT_TRUE(listener->listen(socketPath));
+    QScopedPointer<DbusEndpoint> client(engine.createEndpoint());
+    client->connectToServer(socketPath);
+    ASSERT_TRUE(client->isConnected());
+    engine.processEvents();
+    QScopedPointer<DbusEndpoint> server(listener->nextPendingConnection());
+    ASSERT_FALSE(server.isNull());
+
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+    QVector<int> sent;
+    sent.append(fds[0]);
+    EXPECT_EQ(client->writeWithDescriptors("hello", sent), 5);
+
+    // 文件描述符数达到上限时接收的描述符被截断，之后的消息无法对应描述符，丢弃数据并关闭连接
+    struct rlimit limit;
+    ASSERT_EQ(::getrlimit(RLIMIT_NOFILE, &limit), 0);
+    struct rlimit lowered = limit;
+    lowered.rlim_cur = ::dup(0);
+    ::close(lowered.rlim_cur);
+    ASSERT_EQ(::setrlimit(RLIMIT_NOFILE, &lowered), 0);
+    char buf[16];
+    qint64 ret = server->read(buf, sizeof(buf));
+    ASSERT_EQ(::setrlimit(RLIMIT_NOFILE, &limit), 0);
+    EXPECT_EQ(ret, -1);
+    EXPECT_EQ(server->pendingDescriptors(), 0);
+    EXPECT_TRUE(server->errorString().contains("truncated"));
+    ::close(fds[1]);
+}
+
+#ifdef HAVE_IO_URING
+// 处理完成事件直到条件满足
+template<typename Predicate>
+static bool processUntil(DbusUringEngine *engine, Predicate predicate)
+{
+    for (int i = 0; i < 10000; i++) {
+        if (predicate()) {
+            return true;
+        }
+        engine->processEvents();
+    }
+    return predicate();
+}
+
+TEST(engine, uring01)
+{
+    DbusUringEngine engine;
+    // 内核不支持时由DbusEngine::create回退到epoll
+    if (!engine.init()) {
+        QScopedPointer<DbusEngine> fallback(DbusEngine::create("io_uring"));
+        EXPECT_EQ(fallback->name(), "epoll");
+        return;
+    }
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString socketPath = dir.path() + "/bus";
+
+    QScopedPointer<DbusListener> listener(engine.createListener());
+    ASSERT_TRUE(listener->listen(socketPath));
+
+    QScopedPointer<DbusEndpoint> client(engine.createEndpoint());
+    client->connectToServer(socketPath);
+    ASSERT_TRUE(client->waitForConnected(1000));
+    EXPECT_FALSE(client->canWriteDirectly());
+
+    // multishot accept
+    DbusEndpoint *server = nullptr;
+    ASSERT_TRUE(processUntil(&engine, [&]() { return (server = listener->nextPendingConnection()) != nullptr; }));
+    EXPECT_TRUE(server->isConnected());
+
+    // 多次写入在一条请求链中按顺序发送
+    QByteArray expected;
+    for (int i = 0; i < 100; i++) {
+        QByteArray chunk(32, static_cast<char>('a' + i % 26));
+        EXPECT_EQ(client->write(chunk), chunk.size());
+        expected.append(chunk);
+    }
+    EXPECT_EQ(client->bytesToWrite(), expected.size());
+    QByteArray received;
+    ASSERT_TRUE(processUntil(&engine, [&]() {
+        received.append(readAll(server));
+        return received.size() >= expected.size();
+    }));
+    EXPECT_EQ(received, expected);
+    EXPECT_EQ(client->bytesToWrite(), 0);
+
+    // 超过单个缓冲区大小的数据分多个缓冲区接收，对端不读取时停止接收
+    QByteArray large(1024 * 1024, 'x');
+    for (int i = 0; i < 4; i++) {
+        server->write(large);
+    }
+    qint64 total = 0;
+    ASSERT_TRUE(processUntil(&engine, [&]() {
+        total += readAll(client.data()).size();
+        return total >= 4 * large.size();
+    }));
+    EXPECT_EQ(total, 4 * large.size());
+    EXPECT_EQ(server->bytesToWrite(), 0);
+
+    // 待发送数据发送完后才关闭连接
+    server->write(large);
+    server->disconnectFromServer();
+    EXPECT_FALSE(server->isConnected());
+    total = 0;
+    bool isClosed = false;
+    ASSERT_TRUE(processUntil(&engine, [&]() {
+        char buf[65536];
+        qint64 ret;
+        while ((ret = client->read(buf, sizeof(buf))) > 0) {
+            total += ret;
+        }
+        isClosed = ret < 0;
+        return isClosed;
+    }));
+    EXPECT_EQ(total, large.size());
+
+    listener->close();
+    QScopedPointer<DbusEndpoint> refused(engine.createEndpoint());
+    refused->connectToServer(socketPath);
+    EXPECT_FALSE(refused->waitForConnected(100));
+}
+TEST(engine, uring02)
+{
+    DbusUringEngine engine;
+    if (!engine.init()) {
+        return;
+    }
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString socketPath = dir.path() + "/bus";
+    QScopedPointer<DbusListener> listener(engine.createListener());
+    ASSERT_TRUE(listener->listen(socketPath));
+
+    QScopedPointer<DbusEndpoint> slowClient(engine.createEndpoint());
+    slowClient->connectToServer(socketPath);
+    ASSERT_TRUE(slowClient->waitForConnected(1000));
+    DbusEndpoint *slowServer = nullptr;
+    ASSERT_TRUE(
+        processUntil(&engine, [&]() { return (slowServer = listener->nextPendingConnection()) != nullptr; }));
+    QScopedPointer<DbusEndpoint> client(engine.createEndpoint());
+    client->connectToServer(socketPath);
+    ASSERT_TRUE(client->waitForConnected(1000));
+    DbusEndpoint *server = nullptr;
+    ASSERT_TRUE(processUntil(&engine, [&]() { return (server = listener->nextPendingConnection()) != nullptr; }));
+
+    // 一个连接不读取，发送的数据超过所有接收缓冲区的大小，该连接只占用少量缓冲区，
+    // 取消recv前已完成的接收会多占一些
+    QByteArray large(1024 * 1024, 'x');
+    for (int i = 0; i < 8; i++) {
+        slowServer->write(large);
+    }
+    for (int i = 0; i < 100; i++) {
+        engine.processEvents();
+    }
+    EXPECT_GE(engine.freeBufferCount(), 256 / 2);
+
+    // 其它连接不受影响
+    for (int i = 0; i < 8; i++) {
+        server->write(large);
+    }
+    qint64 total = 0;
+    ASSERT_TRUE(processUntil(&engine, [&]() {
+        total += readAll(client.data()).size();
+        return total >= 8 * large.size();
+    }));
+    EXPECT_EQ(total, 8 * large.size());
+
+    // 不读取的连接读取后恢复接收
+    total = 0;
+    ASSERT_TRUE(processUntil(&engine, [&]() {
+        total += readAll(slowClient.data()).size();
+        return total >= 8 * large.size();
+    }));
+    EXPECT_EQ(total, 8 * large.size());
+    EXPECT_EQ(slowServer->bytesToWrite(), 0);
+}
+
+TEST(engine, uring03)
+{
+    DbusUringEngine engine;
+    if (!engine.init()) {
+        return;
+    }
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    const int closedFd = fds[0];
+    DbusEndpoint *endpoint = engine.adoptEndpoint(fds[0]);
+    ASSERT_TRUE(endpoint->isConnected());
+    // send请求还未提交时释放连接
+    EXPECT_EQ(endpoint->write(QByteArray(64, 'x')), 64);
+    delete endpoint;
+
+    // 请求结束前描述符不会分配给新连接，请求不会发到新连接
+    int newFds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, newFds), 0);
+    EXPECT_NE(newFds[0], closedFd);
+    EXPECT_NE(newFds[1], closedFd);
+    ASSERT_TRUE(processUntil(&engine, [&]() { return ::fcntl(closedFd, F_GETFD) < 0; }));
+    char buf[128];
+    EXPECT_LT(::recv(newFds[1], buf, sizeof(buf), 0), 0);
+    EXPECT_LT(::recv(newFds[0], buf, sizeof(buf), 0), 0);
+
+    ::close(fds[1]);
+    ::close(newFds[0]);
+    ::close(newFds[1]);
+}
+#endif
@@ -7,8 +7,10 @@
 #include <gtest/gtest.h>
 
 #include <QDebug>
+#include <QElapsedTimer>
 
 #include "filter/dbus_filter.h"
+#include "filter/dbus_verdict_cache.h"
 
 TEST(filter, filter01)
 {
@@ -65,4 +67,160 @@ TEST(filter, dump01)
     QString config = "";
     filter.dumpConfig(config);
     EXPECT_EQ(config.isEmpty(), false);
-}
\ No newline at end of file
+}
+TEST(filter, matcher01)
+{
+    DbusRuleMatcher matcher;
+    EXPECT_EQ(matcher.addRule("org.freedesktop.Notifications"), true);
+    EXPECT_EQ(matcher.addRule("org.freedesktop.Notifications"), false);
+    matcher.addRule("com.deepin.linglong.*");
+    matcher.addRule("org.kde.Status*");
+    matcher.addRule("org.fcitx.Fcitx[0-9]+");
+
+    EXPECT_EQ(matcher.isMatch(QString("org.freedesktop.Notifications")), true);
+    EXPECT_EQ(matcher.isMatch(QString("org.freedesktop.Notifications2")), false);
+    // "name.*" 匹配name本身及其子名称
+    EXPECT_EQ(matcher.isMatch(QString("com.deepin.linglong")), true);
+    EXPECT_EQ(matcher.isMatch(QString("com.deepin.linglong.AppManager")), true);
+    EXPECT_EQ(matcher.isMatch(QString("com.deepin.linglongX")), false);
+    EXPECT_EQ(matcher.isMatch(QString("org.kde.StatusNotifierWatcher")), true);
+    EXPECT_EQ(matcher.isMatch(QString("org.fcitx.Fcitx5")), true);
+    // 规则整串锚定匹配
+    EXPECT_EQ(matcher.isMatch(QString("x.com.deepin.linglong.AppManager")), false);
+    EXPECT_EQ(matcher.isMatch(QString("org.fcitx.Fcitx5.InputContext")), false);
+    EXPECT_EQ(matcher.isMatch(QLatin1String("org.kde.Status")), true);
+
+    // 不合法的正则规则不添加
+    int ruleCount = matcher.ruleCount();
+    EXPECT_EQ(matcher.addRule("org.fcitx.Fcitx("), false);
+    EXPECT_EQ(matcher.ruleCount(), ruleCount);
+    // 超过栈上转换长度的输入同样可以匹配正则规则
+    matcher.addRule("/org/test/[a-z]+");
+    QString path = "/org/test/" + QString(QByteArray(300, 'a'));
+    EXPECT_EQ(matcher.isMatch(path), true);
+    EXPECT_EQ(matcher.isMatch(QString("/org/test/abc")), true);
+    EXPECT_EQ(matcher.isMatch(QString("/org/test/")), false);
+}
+
+TEST(filter, benchmark01)
+{
+    const int lookupCount = 100000;
+    for (int ruleCount : {10, 1000, 10000}) {
+        DbusFilter filter;
+        for (int i = 0; i < ruleCount / 2; i++) {
+            filter.addNameFilter(QString("org.example.Service%1").arg(i));
+            filter.addInterfaceFilter(QString("org.example.Group%1.*").arg(i));
+        }
+        QByteArray name = QString("org.example.Service%1").arg(ruleCount / 2 - 1).toUtf8();
+        QByteArray interface = QString("org.example.Group%1.Settings").arg(ruleCount / 2 - 1).toUtf8();
+        QByteArray missName("org.other.Service");
+
+        QElapsedTimer timer;
+        timer.start();
+        int matchCount = 0;
+        for (int i = 0; i < lookupCount; i++) {
+            if (filter.isMessageMatch(QLatin1String(name), QLatin1String(), QLatin1String(interface))) {
+                matchCount++;
+            }
+            if (filter.isMessageMatch(QLatin1String(missName), QLatin1String(), QLatin1String())) {
+                matchCount++;
+            }
+        }
+        qint64 elapsed = timer.nsecsElapsed();
+        EXPECT_EQ(matchCount, lookupCount);
+        qInfo() << "rules:" << ruleCount << ", lookups:" << lookupCount * 2
+                << ", ns per lookup:" << elapsed / (lookupCount * 2);
+    }
+}
+
+TEST(filter, pathTree01)
+{
+    DbusPathTree tree;
+    tree.addRule("/org/freedesktop/portal/desktop");
+    tree.addRule("/org/freedesktop/Notifications/*");
+    tree.addRule("/org/kde/StatusNotifierItem/+");
+    EXPECT_EQ(tree.addRule("/org/freedesktop/portal/desktop"), false);
+
+    EXPECT_EQ(tree.isMatch(QString("/org/freedesktop/portal/desktop")), true);
+    EXPECT_EQ(tree.isMatch(QString("/org/freedesktop/portal")), false);
+    EXPECT_EQ(tree.isMatch(QString("/org/freedesktop/portal/desktop/request")), false);
+    // 节点及其子路径
+    EXPECT_EQ(tree.isMatch(QString("/org/freedesktop/Notifications")), true);
+    EXPECT_EQ(tree.isMatch(QString("/org/freedesktop/Notifications/a/b")), true);
+    EXPECT_EQ(tree.isMatch(QString("/org/freedesktop/NotificationsX")), false);
+    // 只匹配子路径
+    EXPECT_EQ(tree.isMatch(QString("/org/kde/StatusNotifierItem")), false);
+    EXPECT_EQ(tree.isMatch(QString("/org/kde/StatusNotifierItem/1")), true);
+    EXPECT_EQ(tree.isMatch(QLatin1String("/")), false);
+
+    EXPECT_EQ(DbusPathTree::isTreeRule("/com/deepin/linglong/*"), true);
+    EXPECT_EQ(DbusPathTree::isTreeRule("/com/deepin/linglong*"), false);
+    EXPECT_EQ(DbusPathTree::isTreeRule("/"), true);
+    // 不是合法路径的规则不用路径树表示
+    EXPECT_EQ(DbusPathTree::isTreeRule("*"), false);
+    EXPECT_EQ(DbusPathTree::isTreeRule("/com/deepin/linglong/"), false);
+    EXPECT_EQ(DbusPathTree::isTreeRule("/com//linglong"), false);
+    EXPECT_EQ(DbusPathTree::isTreeRule("//*"), false);
+    tree.addRule("/*");
+    EXPECT_EQ(tree.isMatch(QLatin1String("/")), true);
+}
+
+TEST(filter, pathTree02)
+{
+    // 不是合法路径的规则与之前一样不匹配任何路径
+    DbusFilter filter;
+    filter.addNameFilter("org.test.Service");
+    filter.addInterfaceFilter("org.test.Service");
+    filter.addPathFilter("*");
+    filter.addPathFilter("/org/test/");
+    filter.addPathFilter("/org//service");
+    EXPECT_EQ(filter.isMessageMatch("org.test.Service", "/org/test", "org.test.Service"), false);
+    EXPECT_EQ(filter.isMessageMatch("org.test.Service", "/org/service", "org.test.Service"), false);
+    EXPECT_EQ(filter.isMessageMatch("org.test.Service", "/", "org.test.Service"), false);
+    filter.addPathFilter("/org/test");
+    EXPECT_EQ(filter.isMessageMatch("org.test.Service", "/org/test", "org.test.Service"), true);
+}
+
+TEST(filter, verdictCache01)
+{
+    DbusVerdictCache cache(2);
+    QLatin1String dst("org.freedesktop.Notifications");
+    QLatin1String path("/org/freedesktop/Notifications");
+    QLatin1String ifce("org.freedesktop.Notifications");
+    bool verdict = false;
+    EXPECT_EQ(cache.lookup(1, dst, path, ifce, QLatin1String("Notify"), &verdict), false);
+    cache.insert(1, dst, path, ifce, QLatin1String("Notify"), true);
+    EXPECT_EQ(cache.lookup(1, dst, path, ifce, QLatin1String("Notify"), &verdict), true);
+    EXPECT_EQ(verdict, true);
+    // member不同不能命中
+    EXPECT_EQ(cache.lookup(1, dst, path, ifce, QLatin1String("CloseNotification"), &verdict), false);
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 2u);
+
+    // 容量满后淘汰最近未访问的条目
+    cache.insert(1, dst, path, ifce, QLatin1String("CloseNotification"), false);
+    cache.lookup(1, dst, path, ifce, QLatin1String("Notify"), &verdict);
+    cache.insert(1, dst, path, ifce, QLatin1String("GetCapabilities"), false);
+    EXPECT_EQ(cache.lookup(1, dst, path, ifce, QLatin1String("Notify"), &verdict), true);
+    EXPECT_EQ(cache.lookup(1, dst, path, ifce, QLatin1String("CloseNotification"), &verdict), false);
+
+    // 规则版本变化后缓存失效
+    EXPECT_EQ(cache.lookup(2, dst, path, ifce, QLatin1String("Notify"), &verdict), false);
+}
+
+TEST(filter, generation01)
+{
+    DbusFilter filter;
+    quint64 generation = filter.generation();
+    filter.addNameFilter("org.freedesktop.Notifications");
+    EXPECT_NE(filter.generation(), generation);
+    generation = filter.generation();
+    filter.addNameFilter("org.freedesktop.Notifications");
+    EXPECT_EQ(filter.generation(), generation);
+    // 不合法的规则不生效，不改变版本也不出现在配置中
+    filter.addInterfaceFilter("org.freedesktop.(");
+    EXPECT_EQ(filter.generation(), generation);
+    QString config;
+    filter.dumpConfig(config);
+    EXPECT_EQ(config.contains("org.freedesktop.("), false);
+}
@@ -6,8 +6,12 @@
 
 #include <gtest/gtest.h>
 
+#include <string.h>
+
 #include <QDebug>
 
+#include "message/dbus_error_reply.h"
+#include "message/dbus_framer.h"
 #include "message/dbus_message.h"
 
 TEST(dbusmsg, message01)
@@ -125,4 +129,252 @@ TEST(dbusmsg, message07)
     EXPECT_EQ(ret, true);
     bool isMemberOk = (header.member == "Hello");
     EXPECT_EQ(isMemberOk, true);
-}
\ No newline at end of file
+}
+TEST(dbusmsg, framer01)
+{
+    // Hello消息分两次到达，第一次只有报文头的一部分
+    QByteArray byteArray(
+        "l\x01\x00\x01\x00\x00\x00\x00\x01\x00\x00\x00n\x00\x00\x00\x01\x01o\x00\x15\x00\x00\x00/org/freedesktop/DBus\x00\x00\x00\x06\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x02\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x03\x01s\x00\x05\x00\x00\x00Hello\x00\x00\x00",
+        128);
+    DbusFramer framer(DbusFramer::Phase::Binary);
+    DbusFrame frame;
+    framer.append(byteArray.constData(), 10);
+    EXPECT_EQ(framer.next(&frame), false);
+    framer.append(byteArray.constData() + 10, 100);
+    EXPECT_EQ(framer.next(&frame), false);
+    framer.append(byteArray.constData() + 110, byteArray.size() - 110);
+    EXPECT_EQ(framer.next(&frame), true);
+    EXPECT_EQ(frame.isAuth, false);
+    EXPECT_EQ(frame.toByteArray() == byteArray, true);
+    EXPECT_EQ(framer.next(&frame), false);
+    EXPECT_EQ(framer.pendingBytes(), 0);
+}
+
+TEST(dbusmsg, framer02)
+{
+    // 认证消息跨两次读取，BEGIN之后紧跟dbus消息
+    DbusFramer framer;
+    DbusFrame frame;
+    QByteArray auth("\x00""AUTH EXTERNAL 31303030\r", 24);
+    framer.append(auth.constData(), auth.size());
+    EXPECT_EQ(framer.next(&frame), false);
+    QByteArray left("\nNEGOTIATE_UNIX_FD\r\nBEGIN\r\nl\x01\x00\x01", 31);
+    framer.append(left.constData(), left.size());
+    EXPECT_EQ(framer.next(&frame), true);
+    EXPECT_EQ(frame.isAuth, true);
+    EXPECT_EQ(frame.size, 25);
+    EXPECT_EQ(framer.next(&frame), true);
+    EXPECT_EQ(frame.toByteArray() == QByteArray("NEGOTIATE_UNIX_FD\r\n"), true);
+    EXPECT_EQ(framer.phase(), DbusFramer::Phase::Auth);
+    EXPECT_EQ(framer.next(&frame), true);
+    EXPECT_EQ(frame.toByteArray() == QByteArray("BEGIN\r\n"), true);
+    EXPECT_EQ(framer.phase(), DbusFramer::Phase::Binary);
+    EXPECT_EQ(framer.next(&frame), false);
+    EXPECT_EQ(framer.pendingBytes(), 4);
+}
+
+TEST(dbusmsg, framer03)
+{
+    // 非法的大小端标志
+    DbusFramer framer(DbusFramer::Phase::Binary);
+    DbusFrame frame;
+    QByteArray byteArray("x\x01\x00\x01\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00", 16);
+    framer.append(byteArray.constData(), byteArray.size());
+    EXPECT_EQ(framer.next(&frame), false);
+    EXPECT_EQ(framer.phase(), DbusFramer::Phase::Error);
+}
+
+TEST(dbusmsg, framer04)
+{
+    // 消息体1000字节的大消息，报文头完整后剩余消息体透传
+    QByteArray byteArray(
+        "l\x01\x00\x01\x00\x00\x00\x00\x01\x00\x00\x00n\x00\x00\x00\x01\x01o\x00\x15\x00\x00\x00/org/freedesktop/DBus\x00\x00\x00\x06\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x02\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x03\x01s\x00\x05\x00\x00\x00Hello\x00\x00\x00",
+        128);
+    QByteArray large = byteArray;
+    large[4] = '\xe8';
+    large[5] = '\x03';
+    large.append(QByteArray(1000, 'x'));
+    DbusFramer framer(DbusFramer::Phase::Binary);
+    DbusFrame frame;
+    // 报文头不完整
+    framer.append(large.constData(), 100);
+    EXPECT_EQ(framer.peekPartial(&frame, 512), false);
+    framer.append(large.constData() + 100, 128);
+    EXPECT_EQ(framer.next(&frame), false);
+    EXPECT_EQ(framer.peekPartial(&frame, 2048), false);
+    EXPECT_EQ(framer.peekPartial(&frame, 512), true);
+    EXPECT_EQ(frame.size, 228);
+    framer.startPassThrough();
+    EXPECT_EQ(framer.pendingBytes(), 0);
+    EXPECT_EQ(framer.passThroughBytes(), 900);
+
+    // 透传的消息体逐段取出，部分在分帧器之外转发
+    framer.append(large.constData() + 228, 500);
+    EXPECT_EQ(framer.next(&frame), true);
+    EXPECT_EQ(frame.isPartial, true);
+    EXPECT_EQ(frame.size, 500);
+    framer.skip(300);
+    EXPECT_EQ(framer.passThroughBytes(), 100);
+    framer.append(large.constData() + 1028, 100);
+    framer.append(byteArray.constData(), byteArray.size());
+    EXPECT_EQ(framer.next(&frame), true);
+    EXPECT_EQ(frame.isPartial, true);
+    EXPECT_EQ(frame.size, 100);
+    EXPECT_EQ(framer.next(&frame), true);
+    EXPECT_EQ(frame.isPartial, false);
+    EXPECT_EQ(frame.toByteArray() == byteArray, true);
+    EXPECT_EQ(framer.passThroughBytes(), 0);
+    EXPECT_EQ(framer.pendingBytes(), 0);
+}
+
+TEST(dbusmsg, framer05)
+{
+    // 4MiB消息每次读取64KiB，报文头完整后立即开始透传，不等待整条消息
+    QByteArray byteArray(
+        "l\x01\x00\x01\x00\x00\x00\x00\x01\x00\x00\x00n\x00\x00\x00\x01\x01o\x00\x15\x00\x00\x00/org/freedesktop/DBus\x00\x00\x00\x06\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x02\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x03\x01s\x00\x05\x00\x00\x00Hello\x00\x00\x00",
+        128);
+    const int bodySize = 4 * 1024 * 1024;
+    const int readSize = 64 * 1024;
+    QByteArray stream = byteArray;
+    stream[6] = '\x40';
+    stream.append(QByteArray(bodySize, 'x'));
+    stream.append(byteArray);
+
+    DbusFramer framer(DbusFramer::Phase::Binary);
+    DbusFrame frame;
+    QByteArray forwarded;
+    int messages = 0;
+    for (int offset = 0; offset < stream.size(); offset += readSize) {
+        int size = qMin(readSize, stream.size() - offset);
+        memcpy(framer.reserve(readSize), stream.constData() + offset, size);
+        framer.commit(size);
+        while (framer.next(&frame)) {
+            forwarded.append(frame.data, frame.size);
+            messages += frame.isPartial ? 0 : 1;
+        }
+        if (framer.peekPartial(&frame, readSize)) {
+            EXPECT_EQ(offset, 0);
+            forwarded.append(frame.data, frame.size);
+            framer.startPassThrough();
+        }
+        // 缓存中不会积压整条消息
+        EXPECT_LE(framer.pendingBytes(), readSize);
+    }
+    EXPECT_EQ(messages, 1);
+    EXPECT_EQ(forwarded == stream, true);
+    EXPECT_EQ(framer.passThroughBytes(), 0);
+}
+
+TEST(dbusmsg, framer06)
+{
+    // 整条缓存的1MiB消息取出后，下次读取时释放过大的缓存
+    QByteArray byteArray(
+        "l\x01\x00\x01\x00\x00\x00\x00\x01\x00\x00\x00n\x00\x00\x00\x01\x01o\x00\x15\x00\x00\x00/org/freedesktop/DBus\x00\x00\x00\x06\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x02\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x03\x01s\x00\x05\x00\x00\x00Hello\x00\x00\x00",
+        128);
+    const int readSize = 64 * 1024;
+    QByteArray large = byteArray;
+    large[6] = '\x10';
+    large.append(QByteArray(1024 * 1024, 'x'));
+
+    DbusFramer framer(DbusFramer::Phase::Binary);
+    DbusFrame frame;
+    framer.append(large.constData(), large.size());
+    EXPECT_GE(framer.capacity(), large.size());
+    EXPECT_EQ(framer.next(&frame), true);
+    EXPECT_EQ(frame.size, large.size());
+    EXPECT_EQ(framer.pendingBytes(), 0);
+
+    memcpy(framer.reserve(readSize), byteArray.constData(), byteArray.size());
+    framer.commit(byteArray.size());
+    EXPECT_LE(framer.capacity(), 2 * readSize);
+    EXPECT_EQ(framer.next(&frame), true);
+    EXPECT_EQ(frame.toByteArray() == byteArray, true);
+
+    // 有未处理的数据时不释放
+    framer.append(large.constData(), 16);
+    int capacity = framer.capacity();
+    framer.reserve(readSize);
+    EXPECT_EQ(framer.pendingBytes(), 16);
+    EXPECT_GE(framer.capacity(), capacity);
+}
+
+TEST(dbusmsg, headerView01)
+{
+    QByteArray byteArray(
+        "l\x01\x00\x01\x14\x00\x00\x00\x02\x00\x00\x00\x9F\x00\x00\x00\x01\x01o\x00#\x00\x00\x00/com/deepin/linglong/PackageManager\x00\x00\x00\x00\x00\x02\x01s\x00\"\x00\x00\x00"
+        "com.deepin.linglong.PackageManager\x00\x00\x00\x00\x00\x00\x03\x01s\x00\x04\x00\x00\x00test\x00\x00\x00\x00\x06\x01s\x00\x1E\x00\x00\x00"
+        "com.deepin.linglong.AppManager\x00\x00\b\x01g\x00\x01s\x00\x00\x0F\x00\x00\x00org.deepin.demo\x00",
+        196);
+    HeaderView header;
+    bool ret = parseHeaderView(byteArray.constData(), byteArray.size(), &header);
+    EXPECT_EQ(ret, true);
+    EXPECT_EQ(header.headerLength, 176u);
+    EXPECT_EQ(header.length, 20u);
+    EXPECT_EQ(header.serial, 2u);
+    EXPECT_EQ(header.path == QLatin1String("/com/deepin/linglong/PackageManager"), true);
+    EXPECT_EQ(header.interface == QLatin1String("com.deepin.linglong.PackageManager"), true);
+    EXPECT_EQ(header.member == QLatin1String("test"), true);
+    EXPECT_EQ(header.destination == QLatin1String("com.deepin.linglong.AppManager"), true);
+    EXPECT_EQ(header.signature == QLatin1String("s"), true);
+    // 字段直接指向报文数据
+    EXPECT_EQ(header.path.data() >= byteArray.constData(), true);
+    EXPECT_EQ(header.path.data() < byteArray.constData() + byteArray.size(), true);
+
+    // 只有报文头也能解析，不需要body
+    ret = parseHeaderView(byteArray.constData(), header.headerLength, &header);
+    EXPECT_EQ(ret, true);
+}
+
+TEST(dbusmsg, headerView02)
+{
+    QByteArray byteArray(
+        "l\x01\x00\x01\x00\x00\x00\x00\x01\x00\x00\x00n\x00\x00\x00\x01\x01o\x00\x15\x00\x00\x00/org/freedesktop/DBus\x00\x00\x00\x06\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x02\x01s\x00\x14\x00\x00\x00org.freedesktop.DBus\x00\x00\x00\x00\x03\x01s\x00\x05\x00\x00\x00Hello\x00\x00\x00",
+        128);
+    HeaderView header;
+    // 报文截断时不能越界访问
+    for (int size = 0; size < byteArray.size(); size++) {
+        QByteArray truncated = byteArray.left(size);
+        EXPECT_EQ(parseHeaderView(truncated.constData(), truncated.size(), &header), false);
+    }
+    // 字符串长度字段被篡改
+    QByteArray broken = byteArray;
+    broken[20] = '\xff';
+    EXPECT_EQ(parseHeaderView(broken.constData(), broken.size(), &header), false);
+}
+
+TEST(dbusmsg, errorReply01)
+{
+    DbusErrorReply errorReply("org.freedesktop.DBus.Error.AccessDenied", "access denied");
+    QByteArray reply = errorReply.build(8, 7, ":1.42");
+    HeaderView header;
+    bool ret = parseHeaderView(reply.constData(), reply.size(), &header);
+    EXPECT_EQ(ret, true);
+    EXPECT_EQ(header.type, (uchar)MessageType::ERROR);
+    EXPECT_EQ(header.flags & 0x01, 1);
+    EXPECT_EQ(header.serial, 8u);
+    EXPECT_EQ(header.hasReplySerial, true);
+    EXPECT_EQ(header.replySerial, 7u);
+    EXPECT_EQ(header.errorName == QLatin1String("org.freedesktop.DBus.Error.AccessDenied"), true);
+    EXPECT_EQ(header.destination == QLatin1String(":1.42"), true);
+    EXPECT_EQ(header.signature == QLatin1String("s"), true);
+    EXPECT_EQ(header.headerLength % 8, 0u);
+    EXPECT_EQ(header.headerLength + header.length, (quint32)reply.size());
+    Header full;
+    EXPECT_EQ(parseHeader(reply, &full), true);
+    EXPECT_EQ(full.destination == ":1.42", true);
+    // body为错误消息字符串
+    EXPECT_EQ(readUint32(reply.constData() + header.headerLength, false), 13u);
+    EXPECT_EQ(strcmp(reply.constData() + header.headerLength + 4, "access denied"), 0);
+
+    // 不同长度的destination及不填写destination时复用缓存
+    const char *destinations[] = {":1.7", ":1.1000", ""};
+    for (const char *destination : destinations) {
+        const QByteArray &next = errorReply.build(100, 99, destination);
+        ret = parseHeaderView(next.constData(), next.size(), &header);
+        EXPECT_EQ(ret, true);
+        EXPECT_EQ(header.serial, 100u);
+        EXPECT_EQ(header.replySerial, 99u);
+        EXPECT_EQ(header.destination == QLatin1String(destination), true);
+        EXPECT_EQ(header.headerLength + header.length, (quint32)next.size());
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ * SPDX-FileCopyrightText: 2022 UnionTech Software Technology Co., Ltd.  
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include "permission/dbus_permission_cache.h"
+#include "permission/dbus_permission_map.h"
+
+static bool writeConfig(const QString &path, const QByteArray &content)
+{
+    QFile cfgFile(path);
+    if (!cfgFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    cfgFile.write(content);
+    cfgFile.close();
+    return true;
+}
+
+TEST(permission, map01)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    QString path = dir.path() + "/dbus_map_config";
+    ASSERT_TRUE(writeConfig(path, R"({
+        "org.test.Read": [
+            {"name": "org.test.Service", "path": "/org/test/Service", "ifce": "org.test.Service.Read"}
+        ],
+        "org.test.Write": [
+            {"name": "org.test.Service", "path": "/org/test/Service", "ifce": "org.test.Service.Write"},
+            {"name": "org.test.Service", "path": "/org/test/Service", "ifce": "org.test.Service.Read"}
+        ]
+    })"));
+
+    DbusPermissionMap permissionMap(path);
+    EXPECT_EQ(permissionMap.permissionId("org.test.Service", "/org/test/Service", "org.test.Service.Read"),
+              "org.test.Read");
+    EXPECT_EQ(permissionMap.permissionId("org.test.Service", "/org/test/Service", "org.test.Service.Write"),
+              "org.test.Write");
+    EXPECT_EQ(permissionMap.permissionId("org.test.Service", "/org/test/Service", "org.test.Service.Other"), "");
+    EXPECT_EQ(permissionMap.permissionId("org.test.Service", "/org/test/Service", "org.test.Service.Other"), "");
+
+    // 配置更新后重新加载，之前未命中的条目也可以查到
+    ASSERT_TRUE(writeConfig(path, R"({
+        "org.test.Other": [
+            {"name": "org.test.Service", "path": "/org/test/Service", "ifce": "org.test.Service.Other"}
+        ]
+    })"));
+    EXPECT_TRUE(permissionMap.load());
+    EXPECT_EQ(permissionMap.permissionId("org.test.Service", "/org/test/Service", "org.test.Service.Other"),
+              "org.test.Other");
+    EXPECT_EQ(permissionMap.permissionId("org.test.Service", "/org/test/Service", "org.test.Service.Read"), "");
+
+    // 配置格式错误时保留原有索引
+    ASSERT_TRUE(writeConfig(path, "{"));
+    EXPECT_FALSE(permissionMap.load());
+    EXPECT_EQ(permissionMap.permissionId("org.test.Service", "/org/test/Service", "org.test.Service.Other"),
+              "org.test.Other");
+}
+
+TEST(permission, cache01)
+{
+    DbusPermissionCache permissionCache(50);
+    int result = -1;
+    EXPECT_FALSE(permissionCache.lookup("org.test.app", "org.test.Read", &result));
+    permissionCache.insert("org.test.app", "org.test.Read", 0);
+    permissionCache.insert("org.test.app", "org.test.Write", 0);
+    EXPECT_TRUE(permissionCache.lookup("org.test.app", "org.test.Read", &result));
+    EXPECT_EQ(result, 0);
+    EXPECT_FALSE(permissionCache.lookup("org.test.other", "org.test.Read", &result));
+
+    permissionCache.clear();
+    EXPECT_FALSE(permissionCache.lookup("org.test.app", "org.test.Write", &result));
+
+    // 超过有效期后需要重新申请
+    permissionCache.insert("org.test.app", "org.test.Read", 0);
+    QThread::msleep(100);
+    EXPECT_FALSE(permissionCache.lookup("org.test.app", "org.test.Read", &result));
+    EXPECT_EQ(permissionCache.size(), 0);
+
+    // 有效期为0时不缓存
+    DbusPermissionCache disabledCache(0);
+    disabledCache.insert("org.test.app", "org.test.Read", 0);
+    EXPECT_FALSE(disabledCache.lookup("org.test.app", "org.test.Read", &result));
+}
+
+TEST(permission, cache02)
+{
+    // 各工作线程共用一个缓存，同时查询、写入及清空
+    DbusPermissionCache permissionCache(60 * 1000);
+    const int kThreads = 4;
+    const int kRounds = 2000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; i++) {
+        threads.emplace_back([&permissionCache, i]() {
+            QString appId = QString("org.test.app%1").arg(i);
+            for (int j = 0; j < kRounds; j++) {
+                QString id = QString("org.test.Permission%1").arg(j % 16);
+                int result = -1;
+                if (!permissionCache.lookup(appId, id, &result)) {
+                    permissionCache.insert(appId, id, 0);
+                }
+            }
+        });
+    }
+    threads.emplace_back([&permissionCache]() {
+        for (int j = 0; j < kRounds / 100; j++) {
+            permissionCache.clear();
+            std::this_thread::yield();
+        }
+    });
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_LE(permissionCache.size(), kThreads * 16);
+
+    int result = -1;
+    permissionCache.insert("org.test.app0", "org.test.Permission0", 0);
+    EXPECT_TRUE(permissionCache.lookup("org.test.app0", "org.test.Permission0", &result));
+    EXPECT_EQ(result, 0);
+}
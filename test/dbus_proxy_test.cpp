@@ -6,10 +6,80 @@
 
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+
 #include <QDebug>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QThread>
 
+#include "engine/dbus_epoll_engine.h"
+#include "engine/dbus_local_engine.h"
+#include "message/dbus_message.h"
+#include "proxy/dbus_buffer_pool.h"
+#include "proxy/dbus_connection_pair.h"
+#include "proxy/dbus_policy_stage.h"
 #include "proxy/dbus_proxy.h"
+#include "proxy/dbus_session.h"
+#include "proxy/dbus_splice_pipe.h"
+#include "proxy/dbus_spsc_queue.h"
+#include "proxy/dbus_write_batch.h"
+
+#ifndef __SANITIZE_ADDRESS__
+// 统计堆内存分配次数，替换glibc的分配函数，Qt容器及operator new最终都经过这里
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+
+// 只统计当前线程开启统计期间的分配
+static thread_local bool isCountingAllocations = false;
+static thread_local int allocationCount = 0;
+
+extern "C" void *malloc(size_t size)
+{
+    if (isCountingAllocations) {
+        allocationCount++;
+    }
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    if (isCountingAllocations) {
+        allocationCount++;
+    }
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    if (isCountingAllocations) {
+        allocationCount++;
+    }
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+// 读出socket中的所有数据
+static QByteArray readAll(int fd)
+{
+    QByteArray data;
+    char buf[65536];
+    ssize_t ret;
+    while ((ret = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        data.append(buf, ret);
+    }
+    return data;
+}
 
 TEST(dbusProxy, proxy01)
 {
@@ -17,7 +87,7 @@ TEST(dbusProxy, proxy01)
     DbusProxy server;
     server.saveDbusDaemonPath(daemonPath);
 
-    QLocalSocket *proxyClient = new QLocalSocket();
+    DbusEndpoint *proxyClient = new DbusLocalEndpoint();
     bool ret = server.startConnectDbusDaemon(proxyClient, daemonPath);
     delete proxyClient;
     EXPECT_EQ(ret, true);
@@ -28,3 +98,951 @@ TEST(dbusProxy, proxy01)
     ret = server.startListenBoxClient(socketPath);
     EXPECT_EQ(ret, true);
 }
+
+TEST(dbusProxy, writeBatch01)
+{
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    // 地址连续的报文合并为一个iovec
+    QByteArray buffer("aaaabbbbcccc");
+    QByteArray other("ddd");
+    DbusWriteBatch batch;
+    batch.append(buffer.constData(), 4);
+    batch.append(buffer.constData() + 4, 4);
+    batch.append(other.constData(), other.size());
+    batch.append(buffer.constData() + 8, 4);
+    EXPECT_EQ(batch.count(), 4);
+    EXPECT_EQ(batch.iovecCount(), 3);
+    EXPECT_EQ(batch.size(), 15);
+    EXPECT_EQ(batch.toByteArray(), QByteArray("aaaabbbbdddcccc"));
+
+    QByteArray remainder;
+    EXPECT_EQ(batch.writeTo(fds[0], &remainder), 15);
+    EXPECT_EQ(batch.syscalls(), 1u);
+    EXPECT_TRUE(remainder.isEmpty());
+    EXPECT_EQ(readAll(fds[1]), QByteArray("aaaabbbbdddcccc"));
+
+    // 对端不读取时只发送一部分，剩余数据保留到remainder中
+    int sendBufSize = 4096;
+    ::setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sendBufSize, sizeof(sendBufSize));
+    QByteArray large(4 * 1024 * 1024, 'x');
+    for (int i = 0; i < large.size(); i++) {
+        large[i] = static_cast<char>(i % 251);
+    }
+    batch.clear();
+    batch.append(large.constData(), large.size() / 2);
+    batch.append(other.constData(), other.size());
+    batch.append(large.constData() + large.size() / 2, large.size() / 2);
+    QByteArray expected = batch.toByteArray();
+    qint64 written = batch.writeTo(fds[0], &remainder);
+    EXPECT_GT(written, 0);
+    EXPECT_LT(written, expected.size());
+    EXPECT_EQ(remainder, expected.mid(written));
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST(dbusProxy, benchmark01)
+{
+    // 一次读取中转发200条小报文，对比逐条write与合并发送的系统调用次数
+    const int messageCount = 200;
+    const int rounds = 100;
+    QList<QByteArray> messages;
+    for (int i = 0; i < messageCount; i++) {
+        messages.append(QByteArray(64 + i % 32, 'a' + i % 26));
+    }
+
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    quint64 writeSyscalls = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int round = 0; round < rounds; round++) {
+        for (const QByteArray &msg : messages) {
+            ASSERT_EQ(::send(fds[0], msg.constData(), msg.size(), MSG_NOSIGNAL), msg.size());
+            writeSyscalls++;
+        }
+        readAll(fds[1]);
+    }
+    qint64 writeElapsed = timer.nsecsElapsed();
+
+    DbusWriteBatch batch;
+    timer.restart();
+    for (int round = 0; round < rounds; round++) {
+        for (const QByteArray &msg : messages) {
+            batch.append(msg.constData(), msg.size());
+        }
+        QByteArray remainder;
+        batch.writeTo(fds[0], &remainder);
+        ASSERT_TRUE(remainder.isEmpty());
+        batch.clear();
+        readAll(fds[1]);
+    }
+    qint64 batchElapsed = timer.nsecsElapsed();
+
+    EXPECT_EQ(writeSyscalls, quint64(messageCount * rounds));
+    EXPECT_EQ(batch.syscalls(), quint64(rounds));
+    qInfo() << "messages per cycle:" << messageCount << ", cycles:" << rounds;
+    qInfo() << "write per message, syscalls:" << writeSyscalls << ", ns per cycle:" << writeElapsed / rounds;
+    qInfo() << "sendmsg per cycle, syscalls:" << batch.syscalls() << ", ns per cycle:" << batchElapsed / rounds;
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST(dbusProxy, splice01)
+{
+    DbusSplicePipe pipe;
+    ASSERT_TRUE(pipe.isValid());
+    int source[2];
+    int target[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, source), 0);
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, target), 0);
+
+    QByteArray large(4 * 1024 * 1024, 'x');
+    for (int i = 0; i < large.size(); i++) {
+        large[i] = static_cast<char>(i % 251);
+    }
+
+    // 边写边转发，转发的数据与写入的一致
+    qint64 sent = 0;
+    qint64 transferred = 0;
+    QByteArray received;
+    QByteArray stalled;
+    for (int i = 0; i < 100000 && received.size() < large.size(); i++) {
+        ssize_t ret = ::send(source[1], large.constData() + sent, large.size() - sent, MSG_NOSIGNAL);
+        if (ret > 0) {
+            sent += ret;
+        }
+        transferred += pipe.transfer(source[0], target[0], large.size() - transferred, &stalled);
+        EXPECT_TRUE(stalled.isEmpty());
+        received.append(readAll(target[1]));
+    }
+    EXPECT_EQ(transferred, large.size());
+    EXPECT_EQ(received, large);
+
+    // 目标不读取时管道中的数据交给调用方
+    sent = 0;
+    transferred = 0;
+    received.clear();
+    for (int i = 0; i < 1000 && stalled.isEmpty(); i++) {
+        ssize_t ret = ::send(source[1], large.constData() + sent, large.size() - sent, MSG_NOSIGNAL);
+        if (ret > 0) {
+            sent += ret;
+        }
+        transferred += pipe.transfer(source[0], target[0], large.size() - transferred, &stalled);
+    }
+    EXPECT_FALSE(stalled.isEmpty());
+    received = readAll(target[1]);
+    EXPECT_EQ(received + stalled, large.left(transferred));
+
+    ::close(source[0]);
+    ::close(source[1]);
+    ::close(target[0]);
+    ::close(target[1]);
+}
+
+TEST(dbusProxy, spsc01)
+{
+    // 容量向上取整为2的幂
+    DbusSpscQueue<int> queue(3);
+    EXPECT_EQ(queue.capacity(), 4);
+    int item = -1;
+    EXPECT_FALSE(queue.pop(&item));
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(queue.push(i));
+    }
+    EXPECT_FALSE(queue.push(4));
+    EXPECT_EQ(queue.size(), 4);
+    EXPECT_EQ(queue.peakSize(), 4);
+    // 取出后位置可以复用，顺序不变
+    for (int round = 0; round < 10; round++) {
+        ASSERT_TRUE(queue.pop(&item));
+        EXPECT_EQ(item, round);
+        EXPECT_TRUE(queue.push(round + 4));
+    }
+    EXPECT_EQ(queue.size(), 4);
+    for (int i = 10; i < 14; i++) {
+        ASSERT_TRUE(queue.pop(&item));
+        EXPECT_EQ(item, i);
+    }
+    EXPECT_EQ(queue.size(), 0);
+    EXPECT_EQ(queue.peakSize(), 4);
+
+    // 生产者与消费者在不同线程，消费者按顺序收到所有数据
+    const int kCount = 200000;
+    DbusSpscQueue<int> sharedQueue(64);
+    std::thread producer([&sharedQueue]() {
+        for (int i = 0; i < kCount;) {
+            if (sharedQueue.push(i)) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    int expected = 0;
+    bool isOrdered = true;
+    while (expected < kCount) {
+        if (!sharedQueue.pop(&item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        isOrdered = isOrdered && item == expected;
+        expected++;
+    }
+    producer.join();
+    EXPECT_TRUE(isOrdered);
+    EXPECT_EQ(sharedQueue.size(), 0);
+    EXPECT_LE(sharedQueue.peakSize(), sharedQueue.capacity());
+}
+
+TEST(dbusProxy, pair01)
+{
+    DbusLocalEndpoint client;
+    DbusLocalEndpoint daemon;
+    DbusConnectionPair pair(&client, &daemon);
+    client.setContext(&pair);
+    daemon.setContext(&pair);
+    // 两端socket直接取得所属的连接对
+    EXPECT_EQ(client.context(), &pair);
+    EXPECT_EQ(static_cast<DbusConnectionPair *>(daemon.context())->boxClient, &client);
+    EXPECT_FALSE(pair.isDaemonConnected);
+    EXPECT_EQ(pair.clientFramer.phase(), DbusFramer::Phase::Auth);
+    EXPECT_EQ(pair.daemonFramer.phase(), DbusFramer::Phase::Auth);
+
+    // 两个方向的暂停状态互不影响，返回之前的状态
+    EXPECT_FALSE(pair.setPaused(&client, true));
+    EXPECT_TRUE(pair.isPaused(&client));
+    EXPECT_FALSE(pair.isPaused(&daemon));
+    EXPECT_TRUE(pair.setPaused(&client, true));
+    EXPECT_FALSE(pair.setPaused(&daemon, true));
+    EXPECT_TRUE(pair.setPaused(&client, false));
+    EXPECT_FALSE(pair.isClientPaused);
+    EXPECT_TRUE(pair.isDaemonPaused);
+
+    client.setContext(nullptr);
+    EXPECT_EQ(client.context(), nullptr);
+}
+
+// 写入数据直到待写数据超过指定大小
+static void fillBacklog(DbusEndpoint *endpoint, qint64 size)
+{
+    QByteArray large(1024 * 1024, 'x');
+    for (int i = 0; i < 64 && endpoint->bytesToWrite() <= size; i++) {
+        endpoint->write(large);
+    }
+}
+
+// 对端读取直到待写数据发送完
+static void drainBacklog(DbusEpollEngine *engine, DbusEndpoint *endpoint, int peer)
+{
+    for (int i = 0; i < 10000 && endpoint->bytesToWrite() > 0; i++) {
+        readAll(peer);
+        engine->processEvents();
+    }
+    readAll(peer);
+}
+
+TEST(dbusProxy, pair02)
+{
+    DbusEpollEngine engine;
+    ASSERT_TRUE(engine.init());
+    int clientFds[2];
+    int daemonFds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, clientFds), 0);
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, daemonFds), 0);
+    QScopedPointer<DbusEndpoint> client(engine.adoptEndpoint(clientFds[0]));
+    QScopedPointer<DbusEndpoint> daemon(engine.adoptEndpoint(daemonFds[0]));
+    DbusConnectionPair pair(client.data(), daemon.data());
+    const qint64 lowWatermark = 64 * 1024;
+
+    // 客户端不读取，两个方向同时有数据积压
+    fillBacklog(client.data(), lowWatermark);
+    fillBacklog(daemon.data(), lowWatermark);
+    ASSERT_GT(client->bytesToWrite(), lowWatermark);
+    ASSERT_GT(daemon->bytesToWrite(), lowWatermark);
+    EXPECT_FALSE(pair.canResume(client.data(), lowWatermark));
+    EXPECT_FALSE(pair.canResume(daemon.data(), lowWatermark));
+
+    // dbus-daemon读完后客户端仍在积压，dbus-daemon的消息及对客户端的错误回复都会继续写入客户端
+    drainBacklog(&engine, daemon.data(), daemonFds[1]);
+    EXPECT_EQ(daemon->bytesToWrite(), 0);
+    EXPECT_GT(client->bytesToWrite(), lowWatermark);
+    EXPECT_FALSE(pair.canResume(client.data(), lowWatermark));
+    EXPECT_FALSE(pair.canResume(daemon.data(), lowWatermark));
+
+    // 只有dbus-daemon方向积压时可以继续读取dbus-daemon
+    drainBacklog(&engine, client.data(), clientFds[1]);
+    EXPECT_EQ(client->bytesToWrite(), 0);
+    fillBacklog(daemon.data(), lowWatermark);
+    EXPECT_FALSE(pair.canResume(client.data(), lowWatermark));
+    EXPECT_TRUE(pair.canResume(daemon.data(), lowWatermark));
+
+    drainBacklog(&engine, daemon.data(), daemonFds[1]);
+    EXPECT_TRUE(pair.canResume(client.data(), lowWatermark));
+    EXPECT_TRUE(pair.canResume(daemon.data(), lowWatermark));
+
+    ::close(clientFds[1]);
+    ::close(daemonFds[1]);
+}
+
+TEST(dbusProxy, session01)
+{
+    DbusLocalEndpoint client1;
+    DbusLocalEndpoint daemon1;
+    DbusLocalEndpoint client2;
+    DbusLocalEndpoint daemon2;
+    DbusConnectionPair pair1(&client1, &daemon1);
+    DbusConnectionPair pair2(&client2, &daemon2);
+    EXPECT_EQ(pair1.session.authState, DbusSession::AuthState::Handshake);
+
+    // 逐条等待回复的握手，只有双方都同意时才启用unix fd传递
+    pair1.session.readClientLine("\0AUTH EXTERNAL 31303030\r\n", 25);
+    pair1.session.readDaemonLine("OK 1234deadbeef\r\n", 17);
+    EXPECT_TRUE(pair1.session.isAuthenticated);
+    pair1.session.readClientLine("NEGOTIATE_UNIX_FD\r\n", 19);
+    EXPECT_FALSE(pair1.session.isUnixFdEnabled());
+    pair1.session.readDaemonLine("AGREE_UNIX_FD\r\n", 15);
+    EXPECT_TRUE(pair1.session.isUnixFdEnabled());
+    EXPECT_EQ(pair1.session.pendingReplies, 0);
+    pair1.session.readClientLine("BEGIN\r\n", 7);
+    EXPECT_TRUE(pair1.session.isRunning());
+
+    // 命令需要完整匹配
+    pair2.session.readClientLine("AUTH EXTERNAL\r\n", 15);
+    pair2.session.readDaemonLine("OKAY\r\n", 6);
+    pair2.session.readClientLine("NEGOTIATE_UNIX_FD\r\n", 19);
+    pair2.session.readDaemonLine("ERROR\r\n", 7);
+    EXPECT_FALSE(pair2.session.isAuthenticated);
+    EXPECT_FALSE(pair2.session.isUnixFdEnabled());
+    EXPECT_EQ(pair2.session.authState, DbusSession::AuthState::Handshake);
+
+    // 每个连接的unique name互不影响
+    pair1.session.uniqueName = ":1.10";
+    pair2.session.uniqueName = ":1.11";
+    EXPECT_EQ(pair1.session.uniqueName, QString(":1.10"));
+    EXPECT_EQ(pair2.session.uniqueName, QString(":1.11"));
+}
+
+TEST(dbusProxy, session02)
+{
+    // 客户端不等回复连续发送握手命令，dbus-daemon回复完后才进入dbus消息阶段
+    DbusSession session;
+    session.readClientLine("\0AUTH EXTERNAL 31303030\r\n", 25);
+    session.readClientLine("NEGOTIATE_UNIX_FD\r\n", 19);
+    session.readClientLine("BEGIN\r\n", 7);
+    EXPECT_EQ(session.authState, DbusSession::AuthState::WaitingReplies);
+    EXPECT_EQ(session.pendingReplies, 2);
+    session.readDaemonLine("OK 1234deadbeef\r\n", 17);
+    EXPECT_FALSE(session.isRunning());
+    session.readDaemonLine("AGREE_UNIX_FD\r\n", 15);
+    EXPECT_TRUE(session.isRunning());
+    EXPECT_TRUE(session.isUnixFdEnabled());
+
+    // 进入dbus消息阶段后不再检查握手消息
+    session.readClientLine("NEGOTIATE_UNIX_FD\r\n", 19);
+    EXPECT_EQ(session.pendingReplies, 0);
+
+    // 带参数的BEGIN不结束握手，与分帧器一致
+    DbusSession other;
+    other.readClientLine("BEGIN now\r\n", 11);
+    EXPECT_EQ(other.authState, DbusSession::AuthState::Handshake);
+}
+
+TEST(dbusProxy, session03)
+{
+    DbusSession session;
+    HeaderView hello = {};
+    hello.type = (int)MessageType::METHOD_CALL;
+    hello.serial = 1;
+    hello.destination = QLatin1String("org.freedesktop.DBus");
+    hello.member = QLatin1String("Hello");
+    session.readClientHeader(hello);
+    EXPECT_EQ(session.helloSerial, 1u);
+
+    // body中含有NameAcquired的普通信号不影响unique name
+    HeaderView other = {};
+    other.type = (int)MessageType::SIGNAL;
+    other.serial = 2;
+    other.sender = QLatin1String(":1.3");
+    other.destination = QLatin1String(":1.99");
+    other.interface = QLatin1String("org.example.Name");
+    other.member = QLatin1String("NameAcquired");
+    EXPECT_FALSE(session.readDaemonHeader(other));
+    EXPECT_TRUE(session.uniqueName.isEmpty());
+
+    // Hello的回复只按reply serial匹配
+    HeaderView reply = {};
+    reply.type = (int)MessageType::METHOD_RETURN;
+    reply.serial = 1;
+    reply.hasReplySerial = true;
+    reply.replySerial = 2;
+    reply.destination = QLatin1String(":1.42");
+    EXPECT_FALSE(session.readDaemonHeader(reply));
+    reply.replySerial = 1;
+    EXPECT_TRUE(session.readDaemonHeader(reply));
+    EXPECT_EQ(session.uniqueName, QString(":1.42"));
+
+    // 未记录Hello调用时从NameAcquired信号获取
+    DbusSession signal;
+    HeaderView acquired = {};
+    acquired.type = (int)MessageType::SIGNAL;
+    acquired.serial = 2;
+    acquired.sender = QLatin1String("org.freedesktop.DBus");
+    acquired.destination = QLatin1String(":1.43");
+    acquired.interface = QLatin1String("org.freedesktop.DBus");
+    acquired.member = QLatin1String("NameAcquired");
+    EXPECT_FALSE(signal.readDaemonHeader(reply));
+    EXPECT_TRUE(signal.readDaemonHeader(acquired));
+    EXPECT_EQ(signal.uniqueName, QString(":1.43"));
+}
+
+TEST(dbusProxy, session04)
+{
+    // 代理不能传递文件描述符时拒绝NEGOTIATE_UNIX_FD，ERROR在之前的回复之后发送
+    DbusSession session;
+    session.canPassDescriptors = false;
+    EXPECT_TRUE(session.readClientLine("\0AUTH EXTERNAL 31303030\r\n", 25));
+    EXPECT_FALSE(session.readClientLine("NEGOTIATE_UNIX_FD\r\n", 19));
+    EXPECT_TRUE(session.readClientLine("BEGIN\r\n", 7));
+    EXPECT_EQ(session.takeLocalReplies(), 0);
+    EXPECT_EQ(session.authState, DbusSession::AuthState::WaitingReplies);
+    session.readDaemonLine("OK 1234deadbeef\r\n", 17);
+    EXPECT_EQ(session.takeLocalReplies(), 1);
+    EXPECT_TRUE(session.isRunning());
+    EXPECT_FALSE(session.isUnixFdEnabled());
+
+    // 没有未回复的命令时立即回复
+    DbusSession waited;
+    waited.canPassDescriptors = false;
+    waited.readClientLine("AUTH EXTERNAL\r\n", 15);
+    waited.readDaemonLine("OK 1234deadbeef\r\n", 17);
+    EXPECT_FALSE(waited.readClientLine("NEGOTIATE_UNIX_FD\r\n", 19));
+    EXPECT_EQ(waited.takeLocalReplies(), 1);
+    EXPECT_EQ(waited.takeLocalReplies(), 0);
+    EXPECT_EQ(waited.pendingReplies, 0);
+}
+
+TEST(dbusProxy, bufferPool01)
+{
+    DbusBufferPool pool;
+    // 按需要的容量分级，申请到的缓存长度为0
+    QByteArray small = pool.acquire(100);
+    EXPECT_TRUE(small.isEmpty());
+    EXPECT_GE(small.capacity(), 256);
+    QByteArray medium = pool.acquire(1000);
+    EXPECT_GE(medium.capacity(), 1024);
+    EXPECT_EQ(pool.allocations(), 2u);
+
+    // 归还后同一级的申请复用同一块缓存
+    small.append("hello", 5);
+    const char *smallData = small.constData();
+    pool.release(&small);
+    EXPECT_TRUE(small.isEmpty());
+    EXPECT_EQ(pool.freeCount(), 1);
+    QByteArray reused = pool.acquire(200);
+    EXPECT_EQ(reused.constData(), smallData);
+    EXPECT_TRUE(reused.isEmpty());
+    EXPECT_EQ(pool.allocations(), 2u);
+    EXPECT_EQ(pool.freeCount(), 0);
+
+    // 超过最大一级的缓存不复用
+    QByteArray large = pool.acquire(1024 * 1024);
+    EXPECT_EQ(pool.allocations(), 3u);
+    pool.release(&large);
+    EXPECT_EQ(pool.freeCount(), 0);
+
+    // 每一级保留的空闲缓存数有上限，连接释放时整体释放
+    QByteArray buffers[8];
+    for (QByteArray &buffer : buffers) {
+        buffer = pool.acquire(100);
+    }
+    for (QByteArray &buffer : buffers) {
+        pool.release(&buffer);
+    }
+    EXPECT_EQ(pool.freeCount(), 4);
+    pool.release(&medium);
+    EXPECT_EQ(pool.freeCount(), 5);
+    pool.clear();
+    EXPECT_EQ(pool.freeCount(), 0);
+}
+
+// 单元测试中不经过事件循环直接调用DbusProxy的转发流程
+class DbusProxyTester
+{
+public:
+    static void adoptClient(DbusProxy *proxy, int fd) { proxy->adoptClient(fd); }
+    static void readClient(DbusProxy *proxy, DbusConnectionPair *pair) { proxy->readClient(pair->boxClient); }
+    static void readServer(DbusProxy *proxy, DbusConnectionPair *pair) { proxy->readServer(pair->proxyClient); }
+    static DbusConnectionPair *firstPair(DbusProxy *proxy)
+    {
+        return proxy->pairs.isEmpty() ? nullptr : *proxy->pairs.constBegin();
+    }
+    static void setPermissionMap(DbusProxy *proxy, const QString &path)
+    {
+        proxy->permissionMap.reset(new DbusPermissionMap(path));
+    }
+    static DbusPermissionCache *permissionCache(DbusProxy *proxy) { return proxy->permissionCache.data(); }
+    static void startPolicyStages(DbusProxy *proxy)
+    {
+        proxy->createPolicyStages();
+        proxy->startPolicyStages();
+    }
+    static DbusPolicyLane *policyLane(DbusProxy *proxy) { return proxy->policyLane.data(); }
+    static void policyVerdicts(DbusProxy *proxy) { proxy->onPolicyVerdicts(); }
+    static void workerPermissionRequest(DbusProxy *owner, DbusProxy *worker, const QString &appId, const QString &id)
+    {
+        owner->onWorkerPermissionRequest(worker, appId, id);
+    }
+    static void ownerPermissionReply(DbusProxy *worker, const QString &appId, const QString &id, int result)
+    {
+        worker->onOwnerPermissionReply(appId, id, result);
+    }
+    static void permissionDecision(DbusProxy *proxy, DbusConnectionPair *pair, const QString &id, int result)
+    {
+        DbusProxy::PermissionDecision decision = {id, result};
+        proxy->resumeClient(pair->boxClient, &decision, nullptr);
+    }
+    static int inflightPermissions(DbusProxy *proxy) { return proxy->inflightPermissions.size(); }
+    static int permissionWorkers(DbusProxy *proxy)
+    {
+        return proxy->pendingPermissions.isEmpty() ? 0 : proxy->pendingPermissions.constBegin().value().workers.size();
+    }
+    static int forwardedPermissions(DbusProxy *proxy, const QString &appId, const QString &id)
+    {
+        return proxy->forwardedPermissions.value(qMakePair(appId, id)).size();
+    }
+};
+
+TEST(dbusProxy, allocation01)
+{
+#ifndef __SANITIZE_ADDRESS__
+    QByteArray message(
+        "l\x01\x00\x01\x14\x00\x00\x00\x02\x00\x00\x00\x9F\x00\x00\x00\x01\x01o\x00#\x00\x00\x00/com/deepin/linglong/PackageManager\x00\x00\x00\x00\x00\x02\x01s\x00\"\x00\x00\x00"
+        "com.deepin.linglong.PackageManager\x00\x00\x00\x00\x00\x00\x03\x01s\x00\x04\x00\x00\x00test\x00\x00\x00\x00\x06\x01s\x00\x1E\x00\x00\x00"
+        "com.deepin.linglong.AppManager\x00\x00\b\x01g\x00\x01s\x00\x00\x0F\x00\x00\x00org.deepin.demo\x00",
+        196);
+    const int messageCount = 32;
+    const int rounds = 100;
+
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString mapPath = dir.path() + "/dbus_map_config";
+    QFile mapFile(mapPath);
+    ASSERT_TRUE(mapFile.open(QIODevice::WriteOnly));
+    mapFile.write(R"({"org.test.Manage": [{"name": "com.deepin.linglong.AppManager",
+        "path": "/com/deepin/linglong/PackageManager", "ifce": "com.deepin.linglong.PackageManager"}]})");
+    mapFile.close();
+
+    // 模拟dbus-daemon
+    DbusEpollEngine daemonEngine;
+    ASSERT_TRUE(daemonEngine.init());
+    const QString daemonPath = dir.path() + "/bus";
+    QScopedPointer<DbusListener> listener(daemonEngine.createListener());
+    ASSERT_TRUE(listener->listen(daemonPath));
+
+    // 消息匹配过滤规则，拦截后按缓存的权限申请结果放行
+    qputenv("DBUS_PROXY_ENGINE", "epoll");
+    qputenv("DBUS_PROXY_INTERCEPT", "1");
+    DbusProxy proxy;
+    qunsetenv("DBUS_PROXY_ENGINE");
+    qunsetenv("DBUS_PROXY_INTERCEPT");
+    proxy.filter.addNameFilter("com.deepin.linglong.AppManager");
+    proxy.filter.addPathFilter("/com/deepin/linglong/PackageManager");
+    proxy.filter.addInterfaceFilter("com.deepin.linglong.PackageManager");
+    proxy.saveAppId("org.deepin.demo");
+    proxy.saveDbusDaemonPath(daemonPath);
+    DbusProxyTester::setPermissionMap(&proxy, mapPath);
+    DbusProxyTester::permissionCache(&proxy)->insert("org.deepin.demo", "org.test.Manage", 0);
+
+    int clientFds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, clientFds), 0);
+    DbusProxyTester::adoptClient(&proxy, clientFds[1]);
+    DbusConnectionPair *pair = DbusProxyTester::firstPair(&proxy);
+    ASSERT_NE(pair, nullptr);
+    // 连接unix socket立即完成
+    ASSERT_TRUE(pair->isDaemonConnected);
+    daemonEngine.processEvents();
+    int daemonFd = listener->nextPendingDescriptor();
+    ASSERT_GE(daemonFd, 0);
+
+    // 握手
+    ::send(clientFds[0], "\0AUTH EXTERNAL 31303030\r\n", 25, MSG_NOSIGNAL);
+    DbusProxyTester::readClient(&proxy, pair);
+    EXPECT_EQ(readAll(daemonFd), QByteArray("\0AUTH EXTERNAL 31303030\r\n", 25));
+    ::send(daemonFd, "OK 1234deadbeef\r\n", 17, MSG_NOSIGNAL);
+    DbusProxyTester::readServer(&proxy, pair);
+    EXPECT_EQ(readAll(clientFds[0]), QByteArray("OK 1234deadbeef\r\n"));
+    ::send(clientFds[0], "BEGIN\r\n", 7, MSG_NOSIGNAL);
+    DbusProxyTester::readClient(&proxy, pair);
+    EXPECT_EQ(readAll(daemonFd), QByteArray("BEGIN\r\n"));
+
+    qint64 receivedSize = 0;
+    // 第一轮分配分帧器、转发集合及缓存池的缓存，之后每轮转发相同的流量，不应再分配内存
+    for (int round = 0; round <= rounds; round++) {
+        for (int i = 0; i < messageCount; i++) {
+            ::send(clientFds[0], message.constData(), message.size(), MSG_NOSIGNAL);
+        }
+        isCountingAllocations = round > 0;
+        DbusProxyTester::readClient(&proxy, pair);
+        isCountingAllocations = false;
+        receivedSize += readAll(daemonFd).size();
+    }
+
+    EXPECT_EQ(allocationCount, 0);
+    EXPECT_EQ(receivedSize, qint64(message.size()) * messageCount * (rounds + 1));
+    EXPECT_EQ(pair->clientMessages, quint64(2 + messageCount * (rounds + 1)));
+    EXPECT_EQ(proxy.verdictCache.misses(), 1u);
+    EXPECT_TRUE(readAll(clientFds[0]).isEmpty());
+
+    ::close(clientFds[0]);
+    ::close(daemonFd);
+#endif
+}
+
+TEST(dbusProxy, pipeline01)
+{
+    QByteArray message(
+        "l\x01\x00\x01\x14\x00\x00\x00\x02\x00\x00\x00\x9F\x00\x00\x00\x01\x01o\x00#\x00\x00\x00/com/deepin/linglong/PackageManager\x00\x00\x00\x00\x00\x02\x01s\x00\"\x00\x00\x00"
+        "com.deepin.linglong.PackageManager\x00\x00\x00\x00\x00\x00\x03\x01s\x00\x04\x00\x00\x00test\x00\x00\x00\x00\x06\x01s\x00\x1E\x00\x00\x00"
+        "com.deepin.linglong.AppManager\x00\x00\b\x01g\x00\x01s\x00\x00\x0F\x00\x00\x00org.deepin.demo\x00",
+        196);
+    const int messageCount = 8;
+
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString mapPath = dir.path() + "/dbus_map_config";
+    QFile mapFile(mapPath);
+    ASSERT_TRUE(mapFile.open(QIODevice::WriteOnly));
+    mapFile.write(R"({"org.test.Manage": [{"name": "com.deepin.linglong.AppManager",
+        "path": "/com/deepin/linglong/PackageManager", "ifce": "com.deepin.linglong.PackageManager"}]})");
+    mapFile.close();
+
+    DbusEpollEngine daemonEngine;
+    ASSERT_TRUE(daemonEngine.init());
+    const QString daemonPath = dir.path() + "/bus";
+    QScopedPointer<DbusListener> listener(daemonEngine.createListener());
+    ASSERT_TRUE(listener->listen(daemonPath));
+
+    // 过滤规则匹配及权限查询在策略线程中完成
+    qputenv("DBUS_PROXY_ENGINE", "epoll");
+    qputenv("DBUS_PROXY_INTERCEPT", "1");
+    qputenv("DBUS_PROXY_POLICY_THREADS", "1");
+    DbusProxy proxy;
+    qunsetenv("DBUS_PROXY_ENGINE");
+    qunsetenv("DBUS_PROXY_INTERCEPT");
+    qunsetenv("DBUS_PROXY_POLICY_THREADS");
+    proxy.filter.addNameFilter("com.deepin.linglong.AppManager");
+    proxy.filter.addPathFilter("/com/deepin/linglong/PackageManager");
+    proxy.filter.addInterfaceFilter("com.deepin.linglong.PackageManager");
+    proxy.saveAppId("org.deepin.demo");
+    proxy.saveDbusDaemonPath(daemonPath);
+    DbusProxyTester::setPermissionMap(&proxy, mapPath);
+    DbusProxyTester::permissionCache(&proxy)->insert("org.deepin.demo", "org.test.Manage", 0);
+    DbusProxyTester::startPolicyStages(&proxy);
+    DbusPolicyLane *lane = DbusProxyTester::policyLane(&proxy);
+    ASSERT_NE(lane, nullptr);
+
+    int clientFds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, clientFds), 0);
+    DbusProxyTester::adoptClient(&proxy, clientFds[1]);
+    DbusConnectionPair *pair = DbusProxyTester::firstPair(&proxy);
+    ASSERT_NE(pair, nullptr);
+    ASSERT_TRUE(pair->isDaemonConnected);
+    daemonEngine.processEvents();
+    int daemonFd = listener->nextPendingDescriptor();
+    ASSERT_GE(daemonFd, 0);
+
+    ::send(clientFds[0], "\0AUTH EXTERNAL 31303030\r\nBEGIN\r\n", 32, MSG_NOSIGNAL);
+    DbusProxyTester::readClient(&proxy, pair);
+    EXPECT_EQ(readAll(daemonFd), QByteArray("\0AUTH EXTERNAL 31303030\r\nBEGIN\r\n", 32));
+
+    // 不同serial的消息，检查判定返回后的转发顺序
+    QByteArray expected;
+    for (int i = 0; i < messageCount; i++) {
+        message[8] = char(2 + i);
+        expected.append(message);
+        ::send(clientFds[0], message.constData(), message.size(), MSG_NOSIGNAL);
+    }
+    DbusProxyTester::readClient(&proxy, pair);
+    // 队首消息未命中匹配结果缓存，与排在其后的消息按顺序全部交给策略线程
+    EXPECT_TRUE(readAll(daemonFd).isEmpty());
+    EXPECT_EQ(pair->holdQueue.size(), messageCount);
+    EXPECT_EQ(pair->heldUnsubmitted, 0);
+    EXPECT_EQ(pair->policyTickets.size(), messageCount);
+    EXPECT_EQ(lane->inflight, messageCount);
+
+    // 等待判定期间dbus-daemon方向的数据照常转发
+    ::send(daemonFd, "OK 1234deadbeef\r\n", 17, MSG_NOSIGNAL);
+    DbusProxyTester::readServer(&proxy, pair);
+    EXPECT_EQ(readAll(clientFds[0]), QByteArray("OK 1234deadbeef\r\n"));
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!pair->holdQueue.isEmpty() && timer.elapsed() < 5000) {
+        if (lane->verdicts.size() == 0) {
+            QThread::msleep(1);
+            continue;
+        }
+        DbusProxyTester::policyVerdicts(&proxy);
+    }
+    EXPECT_EQ(readAll(daemonFd), expected);
+    EXPECT_TRUE(pair->policyTickets.isEmpty());
+    EXPECT_TRUE(pair->policyVerdicts.isEmpty());
+    EXPECT_EQ(pair->clientMessages, quint64(2 + messageCount));
+    EXPECT_EQ(lane->inflight, 0);
+    EXPECT_EQ(lane->verdicts.size(), 0);
+    // 只有第一条消息查询了匹配结果缓存
+    EXPECT_EQ(proxy.verdictCache.misses(), 1u);
+
+    // 匹配结果及权限申请结果均已缓存的消息在I/O线程中直接转发
+    expected.clear();
+    for (int i = 0; i < messageCount; i++) {
+        message[8] = char(2 + messageCount + i);
+        expected.append(message);
+        ::send(clientFds[0], message.constData(), message.size(), MSG_NOSIGNAL);
+    }
+    DbusProxyTester::readClient(&proxy, pair);
+    EXPECT_EQ(readAll(daemonFd), expected);
+    EXPECT_TRUE(pair->holdQueue.isEmpty());
+    EXPECT_TRUE(pair->policyTickets.isEmpty());
+    EXPECT_EQ(lane->inflight, 0);
+    EXPECT_EQ(pair->clientMessages, quint64(2 + 2 * messageCount));
+
+    ::close(clientFds[0]);
+    ::close(daemonFd);
+}
+
+TEST(dbusProxy, pipeline02)
+{
+    QByteArray message(
+        "l\x01\x00\x01\x14\x00\x00\x00\x02\x00\x00\x00\x9F\x00\x00\x00\x01\x01o\x00#\x00\x00\x00/com/deepin/linglong/PackageManager\x00\x00\x00\x00\x00\x02\x01s\x00\"\x00\x00\x00"
+        "com.deepin.linglong.PackageManager\x00\x00\x00\x00\x00\x00\x03\x01s\x00\x04\x00\x00\x00test\x00\x00\x00\x00\x06\x01s\x00\x1E\x00\x00\x00"
+        "com.deepin.linglong.AppManager\x00\x00\b\x01g\x00\x01s\x00\x00\x0F\x00\x00\x00org.deepin.demo\x00",
+        196);
+    const int messageCount = 4;
+
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString mapPath = dir.path() + "/dbus_map_config";
+    QFile mapFile(mapPath);
+    ASSERT_TRUE(mapFile.open(QIODevice::WriteOnly));
+    mapFile.write(R"({"org.test.Manage": [{"name": "com.deepin.linglong.AppManager",
+        "path": "/com/deepin/linglong/PackageManager", "ifce": "com.deepin.linglong.PackageManager"}]})");
+    mapFile.close();
+
+    DbusEpollEngine daemonEngine;
+    ASSERT_TRUE(daemonEngine.init());
+    const QString daemonPath = dir.path() + "/bus";
+    QScopedPointer<DbusListener> listener(daemonEngine.createListener());
+    ASSERT_TRUE(listener->listen(daemonPath));
+
+    qputenv("DBUS_PROXY_ENGINE", "epoll");
+    qputenv("DBUS_PROXY_INTERCEPT", "1");
+    qputenv("DBUS_PROXY_POLICY_THREADS", "1");
+    DbusProxy proxy;
+    qunsetenv("DBUS_PROXY_ENGINE");
+    qunsetenv("DBUS_PROXY_INTERCEPT");
+    qunsetenv("DBUS_PROXY_POLICY_THREADS");
+    proxy.filter.addNameFilter("com.deepin.linglong.AppManager");
+    proxy.filter.addPathFilter("/com/deepin/linglong/PackageManager");
+    proxy.filter.addInterfaceFilter("com.deepin.linglong.PackageManager");
+    proxy.saveAppId("org.deepin.demo");
+    proxy.saveDbusDaemonPath(daemonPath);
+    DbusProxyTester::setPermissionMap(&proxy, mapPath);
+    DbusProxyTester::startPolicyStages(&proxy);
+    DbusPolicyLane *lane = DbusProxyTester::policyLane(&proxy);
+    ASSERT_NE(lane, nullptr);
+
+    int clientFds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, clientFds), 0);
+    DbusProxyTester::adoptClient(&proxy, clientFds[1]);
+    DbusConnectionPair *pair = DbusProxyTester::firstPair(&proxy);
+    ASSERT_NE(pair, nullptr);
+    daemonEngine.processEvents();
+    int daemonFd = listener->nextPendingDescriptor();
+    ASSERT_GE(daemonFd, 0);
+    ::send(clientFds[0], "\0AUTH EXTERNAL 31303030\r\nBEGIN\r\n", 32, MSG_NOSIGNAL);
+    DbusProxyTester::readClient(&proxy, pair);
+    EXPECT_EQ(readAll(daemonFd), QByteArray("\0AUTH EXTERNAL 31303030\r\nBEGIN\r\n", 32));
+
+    // 队首消息的判定返回后需要申请权限，排在其后的消息继续交给策略线程
+    QByteArray expected;
+    for (int i = 0; i < messageCount; i++) {
+        message[8] = char(2 + i);
+        expected.append(message);
+        ::send(clientFds[0], message.constData(), message.size(), MSG_NOSIGNAL);
+        DbusProxyTester::readClient(&proxy, pair);
+        QElapsedTimer timer;
+        timer.start();
+        while (lane->inflight > 0 && timer.elapsed() < 5000) {
+            if (lane->verdicts.size() == 0) {
+                QThread::msleep(1);
+                continue;
+            }
+            DbusProxyTester::policyVerdicts(&proxy);
+        }
+    }
+    EXPECT_TRUE(readAll(daemonFd).isEmpty());
+    EXPECT_EQ(pair->holdQueue.size(), messageCount);
+    EXPECT_EQ(pair->heldUnsubmitted, 1);
+    EXPECT_TRUE(pair->policyTickets.isEmpty());
+    EXPECT_EQ(pair->policyVerdicts.size(), messageCount - 1);
+    EXPECT_EQ(DbusProxyTester::inflightPermissions(&proxy), 1);
+
+    // 申请结果返回后按顺序使用保存的判定结果转发
+    DbusProxyTester::permissionDecision(&proxy, pair, "org.test.Manage", 0);
+    EXPECT_EQ(readAll(daemonFd), expected);
+    EXPECT_TRUE(pair->holdQueue.isEmpty());
+    EXPECT_EQ(pair->heldUnsubmitted, 0);
+    EXPECT_TRUE(pair->policyVerdicts.isEmpty());
+
+    ::close(clientFds[0]);
+    ::close(daemonFd);
+}
+
+TEST(dbusProxy, permission01)
+{
+    QByteArray message(
+        "l\x01\x00\x01\x14\x00\x00\x00\x02\x00\x00\x00\x9F\x00\x00\x00\x01\x01o\x00#\x00\x00\x00/com/deepin/linglong/PackageManager\x00\x00\x00\x00\x00\x02\x01s\x00\"\x00\x00\x00"
+        "com.deepin.linglong.PackageManager\x00\x00\x00\x00\x00\x00\x03\x01s\x00\x04\x00\x00\x00test\x00\x00\x00\x00\x06\x01s\x00\x1E\x00\x00\x00"
+        "com.deepin.linglong.AppManager\x00\x00\b\x01g\x00\x01s\x00\x00\x0F\x00\x00\x00org.deepin.demo\x00",
+        196);
+    const int workerCount = 2;
+
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    const QString mapPath = dir.path() + "/dbus_map_config";
+    QFile mapFile(mapPath);
+    ASSERT_TRUE(mapFile.open(QIODevice::WriteOnly));
+    mapFile.write(R"({"org.test.Manage": [{"name": "com.deepin.linglong.AppManager",
+        "path": "/com/deepin/linglong/PackageManager", "ifce": "com.deepin.linglong.PackageManager"}]})");
+    mapFile.close();
+
+    DbusEpollEngine daemonEngine;
+    ASSERT_TRUE(daemonEngine.init());
+    const QString daemonPath = dir.path() + "/bus";
+    QScopedPointer<DbusListener> listener(daemonEngine.createListener());
+    ASSERT_TRUE(listener->listen(daemonPath));
+
+    qputenv("DBUS_PROXY_ENGINE", "epoll");
+    qputenv("DBUS_PROXY_INTERCEPT", "1");
+    DbusProxy owner;
+    owner.filter.addNameFilter("com.deepin.linglong.AppManager");
+    owner.filter.addPathFilter("/com/deepin/linglong/PackageManager");
+    owner.filter.addInterfaceFilter("com.deepin.linglong.PackageManager");
+    owner.saveAppId("org.deepin.demo");
+    owner.saveDbusDaemonPath(daemonPath);
+    DbusProxyTester::setPermissionMap(&owner, mapPath);
+    // 同一应用的两个连接分配到不同的工作线程
+    QScopedPointer<DbusProxy> workers[workerCount];
+    int clientFds[workerCount];
+    int daemonFds[workerCount];
+    DbusConnectionPair *pairs[workerCount];
+    for (int i = 0; i < workerCount; i++) {
+        workers[i].reset(new DbusProxy(&owner));
+        int fds[2];
+        ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+        clientFds[i] = fds[0];
+        DbusProxyTester::adoptClient(workers[i].data(), fds[1]);
+        pairs[i] = DbusProxyTester::firstPair(workers[i].data());
+        ASSERT_NE(pairs[i], nullptr);
+        daemonEngine.processEvents();
+        daemonFds[i] = listener->nextPendingDescriptor();
+        ASSERT_GE(daemonFds[i], 0);
+        ::send(clientFds[i], "\0AUTH EXTERNAL 31303030\r\nBEGIN\r\n", 32, MSG_NOSIGNAL);
+        ::send(clientFds[i], message.constData(), message.size(), MSG_NOSIGNAL);
+        DbusProxyTester::readClient(workers[i].data(), pairs[i]);
+        EXPECT_EQ(readAll(daemonFds[i]), QByteArray("\0AUTH EXTERNAL 31303030\r\nBEGIN\r\n", 32));
+    }
+    qunsetenv("DBUS_PROXY_ENGINE");
+    qunsetenv("DBUS_PROXY_INTERCEPT");
+
+    // 工作线程不直接申请权限，交给owner，等待期间的后续消息排队
+    ::send(clientFds[0], message.constData(), message.size(), MSG_NOSIGNAL);
+    DbusProxyTester::readClient(workers[0].data(), pairs[0]);
+    for (int i = 0; i < workerCount; i++) {
+        EXPECT_EQ(pairs[i]->holdQueue.size(), i == 0 ? 2 : 1);
+        EXPECT_EQ(DbusProxyTester::inflightPermissions(workers[i].data()), 0);
+        EXPECT_EQ(DbusProxyTester::forwardedPermissions(workers[i].data(), "org.deepin.demo", "org.test.Manage"), 1);
+    }
+
+    // owner对不同工作线程的相同申请只发起一次
+    for (int i = 0; i < workerCount; i++) {
+        DbusProxyTester::workerPermissionRequest(&owner, workers[i].data(), "org.deepin.demo", "org.test.Manage");
+    }
+    EXPECT_EQ(DbusProxyTester::inflightPermissions(&owner), 1);
+    EXPECT_EQ(DbusProxyTester::permissionWorkers(&owner), workerCount);
+
+    // owner返回允许后各工作线程放行等待的消息
+    for (int i = 0; i < workerCount; i++) {
+        DbusProxyTester::ownerPermissionReply(workers[i].data(), "org.deepin.demo", "org.test.Manage", 0);
+        EXPECT_TRUE(pairs[i]->holdQueue.isEmpty());
+        EXPECT_EQ(DbusProxyTester::forwardedPermissions(workers[i].data(), "org.deepin.demo", "org.test.Manage"), 0);
+        EXPECT_EQ(readAll(daemonFds[i]), i == 0 ? message + message : message);
+        ::close(clientFds[i]);
+        ::close(daemonFds[i]);
+    }
+}
+
+TEST(dbusProxy, fds01)
+{
+    QByteArray message(
+        "l\x01\x00\x01\x14\x00\x00\x00\x02\x00\x00\x00\x9F\x00\x00\x00\x01\x01o\x00#\x00\x00\x00/com/deepin/linglong/PackageManager\x00\x00\x00\x00\x00\x02\x01s\x00\"\x00\x00\x00"
+        "com.deepin.linglong.PackageManager\x00\x00\x00\x00\x00\x00\x03\x01s\x00\x04\x00\x00\x00test\x00\x00\x00\x00\x06\x01s\x00\x1E\x00\x00\x00"
+        "com.deepin.linglong.AppManager\x00\x00\b\x01g\x00\x01s\x00\x00\x0F\x00\x00\x00org.deepin.demo\x00",
+        196);
+    // 报文头增加unix_fds为1的字段
+    QByteArray fdMessage = message.left(175);
+    fdMessage[12] = char(168);
+    fdMessage.append(QByteArray("\x00\x09\x01u\x00\x01\x00\x00\x00", 9));
+    fdMessage.append(message.mid(176));
+
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    DbusEpollEngine daemonEngine;
+    ASSERT_TRUE(daemonEngine.init());
+    const QString daemonPath = dir.path() + "/bus";
+    QScopedPointer<DbusListener> listener(daemonEngine.createListener());
+    ASSERT_TRUE(listener->listen(daemonPath));
+
+    qputenv("DBUS_PROXY_ENGINE", "epoll");
+    DbusProxy proxy;
+    qunsetenv("DBUS_PROXY_ENGINE");
+    proxy.saveDbusDaemonPath(daemonPath);
+
+    int clientFds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, clientFds), 0);
+    DbusProxyTester::adoptClient(&proxy, clientFds[1]);
+    DbusConnectionPair *pair = DbusProxyTester::firstPair(&proxy);
+    ASSERT_NE(pair, nullptr);
+    daemonEngine.processEvents();
+    int daemonFd = listener->nextPendingDescriptor();
+    ASSERT_GE(daemonFd, 0);
+
+    ::send(clientFds[0], "\0AUTH EXTERNAL 31303030\r\nNEGOTIATE_UNIX_FD\r\n", 44, MSG_NOSIGNAL);
+    DbusProxyTester::readClient(&proxy, pair);
+    EXPECT_EQ(readAll(daemonFd), QByteArray("\0AUTH EXTERNAL 31303030\r\nNEGOTIATE_UNIX_FD\r\n", 44));
+    ::send(daemonFd, "OK 1234deadbeef\r\nAGREE_UNIX_FD\r\n", 32, MSG_NOSIGNAL);
+    DbusProxyTester::readServer(&proxy, pair);
+    EXPECT_EQ(readAll(clientFds[0]), QByteArray("OK 1234deadbeef\r\nAGREE_UNIX_FD\r\n"));
+    ::send(clientFds[0], "BEGIN\r\n", 7, MSG_NOSIGNAL);
+    DbusProxyTester::readClient(&proxy, pair);
+    EXPECT_EQ(readAll(daemonFd), QByteArray("BEGIN\r\n"));
+    ASSERT_TRUE(pair->session.isUnixFdEnabled());
+
+    // 消息声明的文件描述符没有随数据到达，之前的消息照常转发，之后的消息无法对应文件描述符，断开连接
+    QByteArray data = message + fdMessage + message;
+    ::send(clientFds[0], data.constData(), data.size(), MSG_NOSIGNAL);
+    DbusProxyTester::readClient(&proxy, pair);
+    EXPECT_EQ(readAll(daemonFd), message);
+    char c;
+    EXPECT_EQ(::recv(clientFds[0], &c, 1, MSG_DONTWAIT), 0);
+
+    ::close(clientFds[0]);
+    ::close(daemonFd);
+}